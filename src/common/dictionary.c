@@ -22,16 +22,24 @@
  */
 
 #include <string.h>
+#include <limits.h>
 #include <common/heap.h>
 #include <common/debug.h>
 #include "dictionary.h"
 
-#define DICTIONARY_KEY_SIZE(keyspec)            (keyspec & 0xFFFF)
+/* key hash and compare are inlined in the generated lookups, also with -Os */
+#if defined(__GNUC__)
+#define DICTIONARY_INLINE                       static inline __attribute__((always_inline))
+#else
+#define DICTIONARY_INLINE                       static inline
+#endif
 
-typedef struct dlist *  (*DICTIONARY_KEYVAL_ALLOC_T)(struct dictionary * /* dict */, const char * /* s */, unsigned int /* valuesize */) ;
+typedef struct dlist *  (*DICTIONARY_KEYVAL_ALLOC_T)(struct dictionary * /* dict */, const char * /* s */, unsigned int /* valuesize */, unsigned int /* hash */) ;
 typedef void            (*DICTIONARY_KEYVAL_FREE_T)(struct dictionary * /* dict */, struct dlist * /* np */) ;
 typedef unsigned int    (*DICTIONARY_KEY_HASH_T)(struct dictionary * /* dict */, const char * /* s */) ;
-typedef unsigned int    (*DICTIONARY_KEY_CMP_T)(struct dictionary * /* dict */, struct dlist * /* np */, const char * /* s */) ;
+typedef unsigned int    (*DICTIONARY_KEY_CMP_T)(struct dictionary * /* dict */, struct dlist * /* np */, const char * /* s */, unsigned int /* hash */) ;
+typedef struct dlist *  (*DICTIONARY_KEY_LOOKUP_T)(struct dictionary * /* dict */, const char * /* s */, unsigned int /* limit */) ;
+typedef struct dlist *  (*DICTIONARY_KEY_LOOKUP_HASHED_T)(struct dictionary * /* dict */, const char * /* s */, unsigned int /* hash */, unsigned int /* limit */) ;
 typedef const char*     (*DICTIONARY_KEY_T)(struct dictionary * /* dict */, struct dlist * /* np */) ;
 typedef char*           (*DICTIONARY_VALUE_T)(struct dictionary * /* dict */, struct dlist * /* np */) ;
 
@@ -41,67 +49,255 @@ struct dictionary_keyval {
     DICTIONARY_KEYVAL_FREE_T        free ;
     DICTIONARY_KEY_HASH_T           hash ;
     DICTIONARY_KEY_CMP_T            cmp ;
+    DICTIONARY_KEY_LOOKUP_T         lookup ;
+    DICTIONARY_KEY_LOOKUP_HASHED_T  lookup_hashed ;
     DICTIONARY_KEY_T                key ;
     DICTIONARY_VALUE_T              value ;
 } ;
 
+struct dictionary_slab_block {
+    struct dictionary_slab_block *  next ;
+    uintptr_t                       mem[] ;
+} ;
+
+struct dictionary_slab {
+    struct dictionary_slab_block *  blocks ;    /* all blocks, oldest first */
+    struct dictionary_slab_block *  block ;     /* block nodes are carved from */
+    struct dlist *                  free ;      /* nodes released to the slab */
+    unsigned int                    used ;      /* nodes carved from block */
+    unsigned int                    size ;      /* node size class, 0 if no slab */
+} ;
+
 struct dictionary {
     const struct dictionary_keyval * key ;
     unsigned int                    hashsize ;
     unsigned int                    keyspec ;
     unsigned int                    count ;
     heapspace                       heap ;
+    struct dictionary_slab          slab ;
+    struct dlist *                  head ;      /* all nodes in insertion order */
+    struct dlist *                  tail ;
+    struct dlist *                  retired ;   /* removed nodes not yet reclaimed */
+    unsigned int                    retired_count ;
+    unsigned int                    concurrent ;
+    DICTIONARY_KEY_LOAD_T           key_load ;  /* fingerprint keys */
+    uintptr_t                       key_parm ;
+    uint32_t                        keybuf[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
+    uint32_t *                      filter ;    /* Bloom filter, 0 if none */
+    unsigned int                    filter_mask ;
     struct dlist *                  hashtab[]; /* pointer table */
 } ;
 
+/*
+ * Optional Bloom filter over the full hash of every key installed, two bits
+ * per key. A lookup for a key with a bit clear fails without walking its
+ * chain. Bits of removed keys stay set until dictionary_filter_rebuild().
+ */
+DICTIONARY_INLINE uint32_t
+dict_filter_mix (uint32_t hash)
+{
+    hash ^= hash >> 16 ;
+    hash *= 0x7feb352dUL ;
+    hash ^= hash >> 15 ;
+    hash *= 0x846ca68bUL ;
+    hash ^= hash >> 16 ;
+    return hash ;
+}
+
+DICTIONARY_INLINE int
+dict_filter_test (struct dictionary * dict, unsigned int hash)
+{
+    uint32_t mix, b1, b2 ;
+
+    if (!dict->filter) return 1 ;
+    mix = dict_filter_mix (hash) ;
+    b1 = mix & dict->filter_mask ;
+    b2 = (mix >> 16) & dict->filter_mask ;
+
+    return (dict->filter[b1 >> 5] & (1UL << (b1 & 31))) &&
+            (dict->filter[b2 >> 5] & (1UL << (b2 & 31))) ;
+}
+
+static inline void
+dict_filter_add (struct dictionary * dict, unsigned int hash)
+{
+    uint32_t mix, b1, b2 ;
+
+    if (!dict->filter) return ;
+    mix = dict_filter_mix (hash) ;
+    b1 = mix & dict->filter_mask ;
+    b2 = (mix >> 16) & dict->filter_mask ;
+    dict->filter[b1 >> 5] |= 1UL << (b1 & 31) ;
+    dict->filter[b2 >> 5] |= 1UL << (b2 & 31) ;
+}
+
+/*
+ * Nodes are allocated from the slab of the dictionary if one was configured
+ * with dictionary_init_slab(), else from the heap.
+ */
+static struct dlist *
+dict_node_alloc (struct dictionary * dict, unsigned int size)
+{
+    struct dictionary_slab * slab = &dict->slab ;
+    struct dlist * np ;
+
+    if (!slab->size) {
+        return (struct dlist *) DICTIONARY_MALLOC(dict->heap, size) ;
+    }
+
+    DBG_CHECK_T(size <= slab->size, 0,
+            "UTIL  :E: dictionary node %d exceeds slab size %d",
+            size, slab->size) ;
+
+    if (slab->free) {
+        np = slab->free ;
+        slab->free = np->next ;
+        return np ;
+    }
+
+    if (!slab->block || (slab->used >= DICTIONARY_SLAB_BLOCK_NODES)) {
+        if (slab->block && slab->block->next) {
+            /* reuse a block kept after dictionary_remove_all() */
+            slab->block = slab->block->next ;
+        } else {
+            struct dictionary_slab_block * block =
+                    (struct dictionary_slab_block *) DICTIONARY_MALLOC(
+                    dict->heap, sizeof(struct dictionary_slab_block) +
+                    slab->size * DICTIONARY_SLAB_BLOCK_NODES) ;
+            if (!block) return 0 ;
+            block->next = 0 ;
+            if (slab->block) {
+                slab->block->next = block ;
+            } else {
+                slab->blocks = block ;
+            }
+            slab->block = block ;
+        }
+        slab->used = 0 ;
+    }
+
+    np = (struct dlist *)((char*)slab->block->mem + slab->size * slab->used) ;
+    slab->used++ ;
+
+    return np ;
+}
+
+static void
+dict_node_release (struct dictionary * dict, struct dlist * np)
+{
+    if (!dict->slab.size) {
+        DICTIONARY_FREE(dict->heap, np) ;
+        return ;
+    }
+
+    np->next = dict->slab.free ;
+    dict->slab.free = np ;
+}
+
+/*
+ * With concurrent lookups enabled a removed node is only retired. Its key and
+ * value stay intact, and its next pointer still leads to a node of this
+ * dictionary or 0, until dictionary_reclaim() releases it.
+ */
+static void
+dict_node_free (struct dictionary * dict, struct dlist * np)
+{
+    if (dict->concurrent) {
+        np->next = dict->retired ;
+        dict->retired = np ;
+        dict->retired_count++ ;
+        return ;
+    }
+
+    dict_node_release (dict, np) ;
+}
+
+static void
+dict_slab_reset (struct dictionary * dict)
+{
+    dict->slab.block = dict->slab.blocks ;
+    dict->slab.free = 0 ;
+    dict->slab.used = 0 ;
+    dict->retired = 0 ;
+    dict->retired_count = 0 ;
+}
+
+static void
+dict_slab_destroy (struct dictionary * dict)
+{
+    struct dictionary_slab_block * block = dict->slab.blocks ;
+    while (block) {
+        struct dictionary_slab_block * next = block->next ;
+        DICTIONARY_FREE(dict->heap, block) ;
+        block = next ;
+    }
+    dict->slab.blocks = 0 ;
+    dict_slab_reset (dict) ;
+}
+
+
+/*
+ * String key nodes start with the key, its full hash and its length. Chain
+ * walks reject a node on the hash without touching the key.
+ */
+struct dictionary_str_keyval {
+    const char *                    key ;       /* inline or const key */
+    unsigned int                    hash ;
+    unsigned int                    length ;    /* excluding the \0 */
+} ;
+
+#define DICT_STR_KEYVAL(np)         ((struct dictionary_str_keyval *)((char *)(np) + sizeof(struct dlist)))
 
 static struct dlist *
 dictionary_str_keyval_alloc(struct dictionary * dict, const char *s,
-                    unsigned int valuesize)
+                    unsigned int valuesize, unsigned int hash)
 {
     char *p;
     struct dlist * np ;
+    unsigned int length ;
     if (s == 0) return 0 ;
-    np = (struct dlist *) DICTIONARY_MALLOC(dict->heap,
-            		sizeof(struct dlist) + sizeof(uintptr_t) + valuesize);
+    length = strlen(s) ;
+    /* the key is stored inline, after the value */
+    np = dict_node_alloc(dict, sizeof(struct dlist) +
+                    sizeof(struct dictionary_str_keyval) +
+                    valuesize + length + 1); /* + 1 for \0 */
     if (!np) return 0 ;
-    p = (char *) DICTIONARY_MALLOC(dict->heap, strlen(s)+1); /* + 1 for \0 */
-    if (!p ) {
-        DICTIONARY_FREE(dict->heap, np);
-        return 0;
-    }
-   strcpy(p, s);
-   np->keyval[0] = (uintptr_t)p ;
-   return np ;
+    p = (char *)(DICT_STR_KEYVAL(np) + 1) + valuesize ;
+    memcpy(p, s, length + 1);
+    DICT_STR_KEYVAL(np)->key = p ;
+    DICT_STR_KEYVAL(np)->hash = hash ;
+    DICT_STR_KEYVAL(np)->length = length ;
+    return np ;
 }
 
 static void
 dictionary_str_keyval_free(struct dictionary * dict, struct dlist *np)
 {
-    DICTIONARY_FREE (dict->heap, (char *)np->keyval[0]) ;
-    DICTIONARY_FREE (dict->heap, np) ;
+    dict_node_free (dict, np) ;
 }
 
 static struct dlist *
 dictionary_const_str_keyval_alloc(struct dictionary * dict, const char *s,
-                    unsigned int valuesize)
+                    unsigned int valuesize, unsigned int hash)
 {
     struct dlist * np ;
     if (s == 0) return 0 ;
-    np = (struct dlist *) DICTIONARY_MALLOC(dict->heap,
-            		sizeof(struct dlist) + sizeof(uintptr_t) + valuesize);
+    np = dict_node_alloc(dict, sizeof(struct dlist) +
+                    sizeof(struct dictionary_str_keyval) + valuesize);
     if (!np) return 0 ;
-    np->keyval[0] = (uintptr_t)s ;
+    DICT_STR_KEYVAL(np)->key = s ;
+    DICT_STR_KEYVAL(np)->hash = hash ;
+    DICT_STR_KEYVAL(np)->length = strlen(s) ;
     return np ;
 }
 
 static void
 dictionary_const_str_keyval_free(struct dictionary * dict, struct dlist *np)
 {
-    DICTIONARY_FREE(dict->heap, np);
+    dict_node_free (dict, np) ;
 }
 
-static unsigned int
+DICTIONARY_INLINE unsigned int
 dictionary_str_key_hash(struct dictionary * dict, const char *s)
 {
     unsigned int hashval;
@@ -109,15 +305,18 @@ dictionary_str_key_hash(struct dictionary * dict, const char *s)
     for (hashval = 0; *s != '\0'; s++) {
       hashval = *s + 31 * hashval;
     }
-    return hashval % dict->hashsize;
+    return hashval ;
 }
 
-static unsigned int
+DICTIONARY_INLINE unsigned int
 dictionary_str_key_cmp(struct dictionary * dict, struct dlist *np,
-                    const char *s)
+                    const char *s, unsigned int hash)
 {
-    char* p = (char*)np->keyval[0] ;
+    const char* p = DICT_STR_KEYVAL(np)->key ;
     if (s == p) return 1 ;// NULL key
+    if (DICT_STR_KEYVAL(np)->hash != hash) {
+        return 0 ;
+    }
     if (strcmp(s, p) == 0) {
         return 1 ;
     }
@@ -127,50 +326,50 @@ dictionary_str_key_cmp(struct dictionary * dict, struct dlist *np,
 static const char*
 dictionary_str_key(struct dictionary * dict, struct dlist *np)
 {
-    return (const char*)np->keyval[0] ;
+    return DICT_STR_KEYVAL(np)->key ;
 }
 
 
 static char*
 dictionary_str_value(struct dictionary * dict, struct dlist *np)
 {
-    return (char*)&np->keyval[1] ;
+    return (char*)(DICT_STR_KEYVAL(np) + 1) ;
 }
 
 static struct dlist *
 dictionary_ushort_keyval_alloc(struct dictionary * dict, const char *s,
-                    unsigned int valuesize)
+                    unsigned int valuesize, unsigned int hash)
 {
     struct dlist * np ;
-    np = (struct dlist *) DICTIONARY_MALLOC(dict->heap,
+    np = dict_node_alloc(dict,
                     sizeof(struct dlist) + sizeof(uint32_t) + valuesize);
     if (!np) return 0 ;
-    ((uint32_t*)np->keyval)[0] =  *((uint16_t*)s)  ; /* for alignment of value */
+    memset (np->keyval, 0, sizeof(uint32_t)) ; /* for alignment of value */
+    memcpy (np->keyval, s, sizeof(uint16_t)) ;
     return np ;
 }
 
 static void
 dictionary_ushort_keyval_free(struct dictionary * dict, struct dlist *np)
 {
-    DICTIONARY_FREE (dict->heap, np) ;
+    dict_node_free (dict, np) ;
     return ;
 }
 
-static unsigned
+DICTIONARY_INLINE unsigned int
 dictionary_ushort_key_hash(struct dictionary * dict, const char *s)
 {
-    return *((uint16_t*)s) % dict->hashsize ;
+    uint16_t key ;
+    memcpy (&key, s, sizeof(key)) ;
+    return key ;
 }
 
 
-static unsigned int
+DICTIONARY_INLINE unsigned int
 dictionary_ushort_key_cmp(struct dictionary * dict, struct dlist *np,
-                    const char *s)
+                    const char *s, unsigned int hash)
 {
-    if (((uint16_t*)np->keyval)[0] == *((uint16_t*)s)) {
-        return 1 ;
-    }
-    return 0 ;
+    return memcmp (np->keyval, s, sizeof(uint16_t)) == 0 ;
 }
 
 const char*
@@ -188,11 +387,11 @@ dictionary_ushort_value(struct dictionary * dict, struct dlist *np)
 
 static struct dlist *
 dictionary_binary_keyval_alloc(struct dictionary * dict, const char *s,
-                    unsigned int valuesize)
+                    unsigned int valuesize, unsigned int hash)
 {
     struct dlist * np ;
     unsigned int keylen = dict->keyspec & 0xFFFF ;
-    np = (struct dlist *) DICTIONARY_MALLOC(dict->heap,
+    np = dict_node_alloc(dict,
             	sizeof(struct dlist) + keylen * sizeof(uint32_t) + valuesize);
     if (!np) return 0 ;
     memcpy(np->keyval, s, keylen*sizeof(uint32_t)) ;
@@ -202,40 +401,31 @@ dictionary_binary_keyval_alloc(struct dictionary * dict, const char *s,
 static void
 dictionary_binary_keyval_free(struct dictionary * dict, struct dlist *np)
 {
-    DICTIONARY_FREE (dict->heap, np) ;
+    dict_node_free (dict, np) ;
     return ;
 }
 
-static unsigned
+DICTIONARY_INLINE unsigned int
 dictionary_binary_key_hash(struct dictionary * dict, const char *s)
 {
-	uint32_t  * pkey = (uint32_t*)s ;
     uint16_t len = dict->keyspec & 0xFFFF ;
     unsigned int i ;
+    uint32_t key ;
     uint32_t hash = 0 ;
     for (i=0; i<len; i++) {
-        hash += pkey[i] ;
+        memcpy (&key, s + i * sizeof(key), sizeof(key)) ;
+        hash += key ;
     }
-    return hash % dict->hashsize ;
+    return hash ;
 }
 
 
-static unsigned int
+DICTIONARY_INLINE unsigned int
 dictionary_binary_key_cmp(struct dictionary * dict, struct dlist *np,
-                    const char *s)
+                    const char *s, unsigned int hash)
 {
-	uint32_t  * pkey = (uint32_t*)s ;
-	uint32_t  * pkeyval = (uint32_t*)np->keyval ;
     uint16_t len = dict->keyspec & 0xFFFF ;
-    unsigned int i ;
-    uint32_t cmp = 1 ;
-    for (i=0; i<len; i++) {
-        if (pkey[i] != pkeyval[i]) {
-            cmp = 0 ;
-            break ;
-        }
-    }
-    return cmp ;
+    return memcmp (np->keyval, s, len * sizeof(uint32_t)) == 0 ;
 }
 
 const char*
@@ -251,13 +441,233 @@ dictionary_value(struct dictionary * dict, struct dlist *np)
     return (char*)&pkeyval[dict->keyspec & 0xFFFF] ;
 }
 
+/*
+ * Chain walk generated per key type with the hash and compare of the key type
+ * inlined, so a lookup costs one indirect call instead of one per node. The
+ * walk gives up after limit nodes.
+ */
+#define DICTIONARY_KEYVAL_LOOKUP(type, hashfn, cmpfn) \
+static struct dlist * \
+dictionary_##type##_lookup_hashed (struct dictionary * dict, const char *s, \
+                    unsigned int hash, unsigned int limit) \
+{ \
+    struct dlist *np ; \
+    if (!dict_filter_test (dict, hash)) { \
+        return 0 ; /* not found */ \
+    } \
+    for (np = dict->hashtab[hash % dict->hashsize]; np != 0; \
+                        np = np->next) { \
+        if (cmpfn (dict, np, s, hash)) { \
+            return np ; /* found */ \
+        } \
+        if (!limit--) break ; \
+    } \
+    return 0 ; /* not found */ \
+} \
+static struct dlist * \
+dictionary_##type##_lookup (struct dictionary * dict, const char *s, \
+                    unsigned int limit) \
+{ \
+    return dictionary_##type##_lookup_hashed (dict, s, hashfn (dict, s), \
+            limit) ; \
+}
+
+DICTIONARY_KEYVAL_LOOKUP(str, dictionary_str_key_hash, dictionary_str_key_cmp)
+DICTIONARY_KEYVAL_LOOKUP(ushort, dictionary_ushort_key_hash, dictionary_ushort_key_cmp)
+DICTIONARY_KEYVAL_LOOKUP(binary, dictionary_binary_key_hash, dictionary_binary_key_cmp)
+
+/*
+ * Binary keys of a length fixed at compile time. The compare folds all words
+ * without branching, for the 6 word registry key this is a handful of
+ * instructions instead of a loop bounded by the keyspec.
+ */
+#define DICTIONARY_BINARY_KEYVAL(n) \
+DICTIONARY_INLINE unsigned int \
+dictionary_binary##n##_key_hash (struct dictionary * dict, const char *s) \
+{ \
+    uint32_t key ; \
+    uint32_t hash = 0 ; \
+    unsigned int i ; \
+    for (i=0; i<n; i++) { \
+        memcpy (&key, s + i * sizeof(key), sizeof(key)) ; \
+        hash += key ; \
+    } \
+    return hash ; \
+} \
+DICTIONARY_INLINE unsigned int \
+dictionary_binary##n##_key_cmp (struct dictionary * dict, struct dlist *np, \
+                    const char *s, unsigned int hash) \
+{ \
+    uint32_t key, keyval ; \
+    uint32_t diff = 0 ; \
+    unsigned int i ; \
+    for (i=0; i<n; i++) { \
+        memcpy (&key, s + i * sizeof(key), sizeof(key)) ; \
+        memcpy (&keyval, (const char*)np->keyval + i * sizeof(keyval), \
+                sizeof(keyval)) ; \
+        diff |= key ^ keyval ; \
+    } \
+    return diff == 0 ; \
+} \
+DICTIONARY_KEYVAL_LOOKUP(binary##n, dictionary_binary##n##_key_hash, \
+        dictionary_binary##n##_key_cmp) \
+static const struct dictionary_keyval dictionary_binary##n##_keyval = { \
+        &dictionary_binary_keyval_alloc, \
+        &dictionary_binary_keyval_free, \
+        &dictionary_binary##n##_key_hash, \
+        &dictionary_binary##n##_key_cmp, \
+        &dictionary_binary##n##_lookup, \
+        &dictionary_binary##n##_lookup_hashed, \
+        &dictionary_key, \
+        &dictionary_value \
+} ;
+
+DICTIONARY_BINARY_KEYVAL(1)     /* DICTIONARY_KEYSPEC_UINT */
+DICTIONARY_BINARY_KEYVAL(2)
+DICTIONARY_BINARY_KEYVAL(4)
+DICTIONARY_BINARY_KEYVAL(6)     /* registry keys */
+
+/*
+ * Fingerprint nodes keep the full hash of the key instead of the key. A
+ * matching hash is confirmed by comparing the key fetched with the key load
+ * function, without one the hash alone identifies the key.
+ */
+static struct dlist *
+dictionary_fingerprint_keyval_alloc(struct dictionary * dict, const char *s,
+                    unsigned int valuesize, unsigned int hash)
+{
+    struct dlist * np ;
+    uint32_t fingerprint = hash ;
+    np = dict_node_alloc(dict,
+                    sizeof(struct dlist) + sizeof(uint32_t) + valuesize);
+    if (!np) return 0 ;
+    memcpy (np->keyval, &fingerprint, sizeof(fingerprint)) ;
+    return np ;
+}
+
+DICTIONARY_INLINE unsigned int
+dictionary_fingerprint_key_cmp(struct dictionary * dict, struct dlist *np,
+                    const char *s, unsigned int hash)
+{
+    uint32_t key[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
+    uint32_t fingerprint ;
+    const char * p ;
+
+    memcpy (&fingerprint, np->keyval, sizeof(fingerprint)) ;
+    if (fingerprint != hash) {
+        return 0 ;
+    }
+    if (!dict->key_load) {
+        return 1 ;
+    }
+    p = dict->key_load (dict, np, (char*)key, dict->key_parm) ;
+
+    return p && (memcmp (p, s,
+            DICTIONARY_KEY_SIZE(dict->keyspec) * sizeof(uint32_t)) == 0) ;
+}
+
+/* not reentrant, the key is loaded to a buffer of the dictionary */
+static const char*
+dictionary_fingerprint_key(struct dictionary * dict, struct dlist *np)
+{
+    if (!dict->key_load) return 0 ;
+    return dict->key_load (dict, np, (char*)dict->keybuf, dict->key_parm) ;
+}
+
+static char*
+dictionary_fingerprint_value(struct dictionary * dict, struct dlist *np)
+{
+    uint32_t  * pkeyval = (uint32_t*)np->keyval ;
+    return (char*)&pkeyval[1] ;
+}
+
+DICTIONARY_KEYVAL_LOOKUP(fingerprint, dictionary_binary_key_hash,
+        dictionary_fingerprint_key_cmp)
+
+/*
+ * Key hash functions return the full hash, reduced to a bucket here so a
+ * hash computed ahead of time (e.g. at compile time) can be used for lookup.
+ */
+static inline unsigned int
+dict_bucket (struct dictionary * dict, unsigned int hash)
+{
+    return hash % dict->hashsize ;
+}
+
+/* hash of a node already in a dictionary, cached for string keys */
+static inline unsigned int
+dict_node_hash (struct dictionary * dict, struct dlist *np)
+{
+    if (((dict->keyspec >> 16) == DICTIONARY_KEYTYPE_STRING) ||
+            ((dict->keyspec >> 16) == DICTIONARY_KEYTYPE_CONST_STRING)) {
+        return DICT_STR_KEYVAL(np)->hash ;
+    }
+    if ((dict->keyspec >> 16) == DICTIONARY_KEYTYPE_FINGERPRINT) {
+        uint32_t fingerprint ;
+        memcpy (&fingerprint, np->keyval, sizeof(fingerprint)) ;
+        return fingerprint ;
+    }
+    return dict->key->hash (dict, dict->key->key (dict, np)) ;
+}
+
+/*
+ * All nodes are also kept on a list in insertion order, iteration walks it
+ * instead of every bucket. A node unlinked from the list keeps its succ, an
+ * iterator standing on a removed node still finds the next one.
+ */
+static inline void
+dict_list_append (struct dictionary * dict, struct dlist *np)
+{
+    np->succ = 0 ;
+    np->pred = dict->tail ;
+    if (dict->tail) {
+        dict->tail->succ = np ;
+    } else {
+        dict->head = np ;
+    }
+    dict->tail = np ;
+}
+
+static inline void
+dict_list_unlink (struct dictionary * dict, struct dlist *np)
+{
+    if (np->pred) {
+        np->pred->succ = np->succ ;
+    } else {
+        dict->head = np->succ ;
+    }
+    if (np->succ) {
+        np->succ->pred = np->pred ;
+    } else {
+        dict->tail = np->pred ;
+    }
+}
+
+/* unlink np from its chain and the list */
+static void
+dict_unlink (struct dictionary * dict, struct dlist *np)
+{
+    struct dlist **pp =
+            &dict->hashtab[dict_bucket (dict, dict_node_hash (dict, np))] ;
+
+    while (*pp && (*pp != np)) {
+        pp = &(*pp)->next ;
+    }
+    if (*pp) {
+        *pp = np->next ;
+    }
+    dict_list_unlink (dict, np) ;
+    dict->count-- ;
+}
+
 static struct dlist *
 dict_remove (struct dictionary * dict, const char *s) {
     struct dlist *np;
     struct dlist *prev = 0 ;
-    unsigned hashval = dict->key->hash (dict, s) ;
+    unsigned int hash = dict->key->hash (dict, s) ;
+    unsigned hashval = dict_bucket (dict, hash) ;
     for (np = dict->hashtab[hashval]; np != 0; np = np->next) {
-        if (dict->key->cmp(dict, np, s)) {
+        if (dict->key->cmp(dict, np, s, hash)) {
           break ; /* found */
         }
         prev = np ;
@@ -270,6 +680,7 @@ dict_remove (struct dictionary * dict, const char *s) {
         else {
             dict->hashtab[hashval] = np->next ;
         }
+        dict_list_unlink (dict, np) ;
     }
     return np;
 }
@@ -278,14 +689,7 @@ dict_remove (struct dictionary * dict, const char *s) {
 static struct dlist *
 dict_lookup (struct dictionary * dict, const char *key)
 {
-    struct dlist *np;
-    for (np = dict->hashtab[dict->key->hash(dict, key)]; np != 0;
-                        np = np->next) {
-        if (dict->key->cmp(dict, np, key)) {
-          return np; /* found */
-        }
-    }
-    return 0; /* not found */
+    return dict->key->lookup (dict, key, UINT_MAX) ;
 }
 
 struct dictionary *
@@ -296,6 +700,8 @@ dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize)
             &dictionary_str_keyval_free,
             &dictionary_str_key_hash,
             &dictionary_str_key_cmp,
+            &dictionary_str_lookup,
+            &dictionary_str_lookup_hashed,
             &dictionary_str_key,
             &dictionary_str_value
 
@@ -305,6 +711,8 @@ dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize)
             &dictionary_const_str_keyval_free,
             &dictionary_str_key_hash,
             &dictionary_str_key_cmp,
+            &dictionary_str_lookup,
+            &dictionary_str_lookup_hashed,
             &dictionary_str_key,
             &dictionary_str_value
 
@@ -314,6 +722,8 @@ dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize)
             &dictionary_ushort_keyval_free,
             &dictionary_ushort_key_hash,
             &dictionary_ushort_key_cmp,
+            &dictionary_ushort_lookup,
+            &dictionary_ushort_lookup_hashed,
             &dictionary_ushort_key,
             &dictionary_ushort_value
 
@@ -324,16 +734,35 @@ dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize)
             &dictionary_binary_keyval_free,
             &dictionary_binary_key_hash,
             &dictionary_binary_key_cmp,
+            &dictionary_binary_lookup,
+            &dictionary_binary_lookup_hashed,
             &dictionary_key,
             &dictionary_value
 
     };
 
+    static const struct dictionary_keyval fingerprint_key = {
+            &dictionary_fingerprint_keyval_alloc,
+            &dictionary_binary_keyval_free,
+            &dictionary_binary_key_hash,
+            &dictionary_fingerprint_key_cmp,
+            &dictionary_fingerprint_lookup,
+            &dictionary_fingerprint_lookup_hashed,
+            &dictionary_fingerprint_key,
+            &dictionary_fingerprint_value
+
+    };
+
 
     struct dictionary * dict ; 
 #define DICTSIZE(hashsize) \
             (sizeof(struct dictionary) + sizeof(struct dlist *) * hashsize)
 
+    DBG_CHECK_T(((keyspec >> 16) != DICTIONARY_KEYTYPE_FINGERPRINT) ||
+            (DICTIONARY_KEY_SIZE(keyspec) <= DICTIONARY_FINGERPRINT_WORDS_MAX),
+            0, "UTIL  :E: dictionary fingerprint key %d words",
+            DICTIONARY_KEY_SIZE(keyspec)) ;
+
      dict = (struct dictionary *) DICTIONARY_MALLOC(heap, DICTSIZE(hashsize)) ;
      if (dict) {
         memset (dict,0,DICTSIZE(hashsize)) ;
@@ -341,7 +770,16 @@ dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize)
         dict->keyspec = keyspec ;
 
         if ((keyspec >> 16) == DICTIONARY_KEYTYPE_BINARY) {
-            dict->key = &binary_key ;
+            switch (DICTIONARY_KEY_SIZE(keyspec)) {
+            case 1: dict->key = &dictionary_binary1_keyval ; break ;
+            case 2: dict->key = &dictionary_binary2_keyval ; break ;
+            case 4: dict->key = &dictionary_binary4_keyval ; break ;
+            case 6: dict->key = &dictionary_binary6_keyval ; break ;
+            default: dict->key = &binary_key ; break ;
+            }
+
+        } else if ((keyspec >> 16) == DICTIONARY_KEYTYPE_FINGERPRINT) {
+            dict->key = &fingerprint_key ;
 
         } else if (keyspec == DICTIONARY_KEYSPEC_USHORT) {
             dict->key = &ushort_key ;
@@ -361,6 +799,47 @@ dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize)
     return dict ;
 }
 
+/*
+ * Nodes of this dictionary are carved from blocks of
+ * DICTIONARY_SLAB_BLOCK_NODES nodes of one fixed size class, large enough for
+ * a key of keysize bytes (only used for DICTIONARY_KEYSPEC_STRING, including
+ * the terminating \0) and a value of valuesize bytes. Allocations for larger
+ * values fail.
+ */
+struct dictionary *
+dictionary_init_slab (heapspace heap, unsigned int keyspec,
+                    unsigned int hashsize, unsigned int keysize,
+                    unsigned int valuesize)
+{
+    struct dictionary * dict = dictionary_init (heap, keyspec, hashsize) ;
+    unsigned int size = sizeof(struct dlist) + valuesize ;
+
+    if (dict) {
+        if ((keyspec >> 16) == DICTIONARY_KEYTYPE_BINARY) {
+            size += DICTIONARY_KEY_SIZE(keyspec) * sizeof(uint32_t) ;
+
+        } else if ((keyspec >> 16) == DICTIONARY_KEYTYPE_FINGERPRINT) {
+            size += sizeof(uint32_t) ;
+
+        } else if (keyspec == DICTIONARY_KEYSPEC_USHORT) {
+            size += sizeof(uint32_t) ;
+
+        } else if (keyspec == DICTIONARY_KEYSPEC_CONST_STRING) {
+            size += sizeof(struct dictionary_str_keyval) ;
+
+        } else {
+            size += sizeof(struct dictionary_str_keyval) + keysize ;
+
+        }
+
+        /* keep every node in the block aligned */
+        dict->slab.size = (size + sizeof(uintptr_t) - 1) &
+                            ~(sizeof(uintptr_t) - 1) ;
+    }
+
+    return dict ;
+}
+
 /* put key in hashtab, alloc if not found */
 struct dlist*
 dictionary_install_size(struct dictionary * dict, const char *key,
@@ -368,12 +847,16 @@ dictionary_install_size(struct dictionary * dict, const char *key,
 {
     struct dlist *np;
     unsigned hashval;
-     if ((np = dict_lookup(dict, key)) == 0) { /* not found */
-        np = dict->key->alloc(dict, key, valuesize) ;
+    unsigned int hash = dict->key->hash (dict, key) ;
+     if ((np = dict->key->lookup_hashed(dict, key, hash, UINT_MAX)) == 0) {
+        /* not found */
+        np = dict->key->alloc(dict, key, valuesize, hash) ;
         if (np == 0) return 0;
-        hashval = dict->key->hash(dict, key);
+        dict_filter_add (dict, hash) ;
+        hashval = dict_bucket(dict, hash);
         np->next = dict->hashtab[hashval];
         dict->hashtab[hashval] = np;
+        dict_list_append (dict, np) ;
         dict->count++ ;
     }
 
@@ -398,12 +881,16 @@ dictionary_lookup(struct dictionary * dict, const char *key, const char *value,
 {
     struct dlist *np;
     unsigned hashval;
-     if ((np = dict_lookup(dict, key)) == 0) { /* not found */
-        np = dict->key->alloc(dict, key, valuesize) ;
+    unsigned int hash = dict->key->hash (dict, key) ;
+     if ((np = dict->key->lookup_hashed(dict, key, hash, UINT_MAX)) == 0) {
+        /* not found */
+        np = dict->key->alloc(dict, key, valuesize, hash) ;
         if (np == 0) return 0;
-        hashval = dict->key->hash(dict, key);
+        dict_filter_add (dict, hash) ;
+        hashval = dict_bucket(dict, hash);
         np->next = dict->hashtab[hashval];
         dict->hashtab[hashval] = np;
+        dict_list_append (dict, np) ;
         dict->count++ ;
         char* p = dict->key->value(dict, np);
         memcpy (p, value, valuesize) ;
@@ -420,6 +907,119 @@ dictionary_get(struct dictionary * dict, const char *key)
     return dict_lookup(dict, key) ;
 }
 
+/*
+ * Lookup that may run while one other thread modifies the dictionary. The
+ * result is only valid if the caller can verify that no modification
+ * happened meanwhile (e.g. with a sequence count). The walk is bounded so a
+ * chain being relinked can never hold the reader.
+ */
+struct dlist*
+dictionary_get_concurrent(struct dictionary * dict, const char *key)
+{
+    return dict->key->lookup (dict, key,
+            dict->count + dict->retired_count + 1) ;
+}
+
+/*
+ * As dictionary_get_concurrent() with the hash of the key computed by the
+ * caller, see dictionary_hash().
+ */
+struct dlist*
+dictionary_get_concurrent_hashed(struct dictionary * dict, const char *key,
+                    unsigned int hash)
+{
+    return dict->key->lookup_hashed (dict, key, hash,
+            dict->count + dict->retired_count + 1) ;
+}
+
+/*
+ * Fetch the key of a fingerprint node from where it is stored (e.g. FLASH).
+ * load copies the DICTIONARY_KEY_SIZE words of the key of np to key and
+ * returns it, or returns 0 if it can not be read. It may be called from
+ * concurrent lookups.
+ */
+void
+dictionary_set_key_load (struct dictionary * dict, DICTIONARY_KEY_LOAD_T load,
+                    uintptr_t parm)
+{
+    dict->key_load = load ;
+    dict->key_parm = parm ;
+}
+
+/*
+ * Add a Bloom filter of bits bits (rounded up to a power of 2 from 32 to
+ * 65536) so lookups of absent keys mostly fail without walking a chain. Set
+ * it before the dictionary is shared with concurrent lookups. Returns the
+ * bytes allocated, 0 if the allocation failed.
+ */
+unsigned int
+dictionary_set_filter (struct dictionary * dict, unsigned int bits)
+{
+    unsigned int size = 32 ;
+
+    while ((size < bits) && (size < 65536)) {
+        size <<= 1 ;
+    }
+    if (dict->filter) {
+        DICTIONARY_FREE (dict->heap, dict->filter) ;
+    }
+    dict->filter = (uint32_t *) DICTIONARY_MALLOC(dict->heap, size / 8) ;
+    if (!dict->filter) return 0 ;
+    dict->filter_mask = size - 1 ;
+    dictionary_filter_rebuild (dict) ;
+
+    return size / 8 ;
+}
+
+/*
+ * Recompute the filter from the keys installed, dropping the bits of removed
+ * keys. Concurrent lookups must be able to detect the change, as with any
+ * other modification.
+ */
+void
+dictionary_filter_rebuild (struct dictionary * dict)
+{
+    struct dlist *np ;
+
+    if (!dict->filter) return ;
+    memset (dict->filter, 0, (dict->filter_mask + 1) / 8) ;
+    for (np = dict->head; np != 0; np = np->succ) {
+        dict_filter_add (dict, dict_node_hash (dict, np)) ;
+    }
+}
+
+/*
+ * Once enabled, removed nodes are retired instead of freed, so a lookup with
+ * dictionary_get_concurrent() never reads a node that was reused. The owner
+ * releases retired nodes with dictionary_reclaim() when no lookup can still
+ * reference them.
+ */
+void
+dictionary_set_concurrent (struct dictionary * dict)
+{
+    dict->concurrent = 1 ;
+}
+
+unsigned int
+dictionary_retired (struct dictionary * dict)
+{
+    return dict->retired_count ;
+}
+
+void
+dictionary_reclaim (struct dictionary * dict)
+{
+    struct dlist *np = dict->retired ;
+
+    while (np) {
+        struct dlist *next = np->next ;
+        dict_node_release (dict, np) ;
+        np = next ;
+    }
+    dict->retired = 0 ;
+    dict->retired_count = 0 ;
+}
+
 unsigned int
 dictionary_remove(struct dictionary * dict, const char *key)
 {
@@ -439,19 +1039,34 @@ dictionary_remove_all(struct dictionary * dict, void (*cb)(struct dictionary *,
                     struct dlist*, uintptr_t), uintptr_t parm)
 {
     struct dlist *np;
-    unsigned  i ;
-    for (i=0; i<dict->hashsize; i++) {
-     for (np = dict->hashtab[i]; np != 0; np = dict->hashtab[i]) {
-         if (cb) {
-             cb (dict, np, parm) ;
-         }
-         dict->hashtab[i] = np->next ;
-         dict->key->free (dict, np) ;
-         dict->count-- ;
-            
-     }
+    struct dlist *next;
+
+    if (dict->slab.size) {
+        /* nodes are owned by the slab, release them all at once */
+        for (np = dict->head; cb && (np != 0); np = np->succ) {
+            cb (dict, np, parm) ;
+        }
+        memset (dict->hashtab, 0, sizeof(struct dlist *) * dict->hashsize) ;
+        dict->head = dict->tail = 0 ;
+        dict->count = 0 ;
+        dict_slab_reset (dict) ;
+        dictionary_filter_rebuild (dict) ;
+        return ;
     }
 
+    memset (dict->hashtab, 0, sizeof(struct dlist *) * dict->hashsize) ;
+    for (np = dict->head; np != 0; np = next) {
+        next = np->succ ;
+        if (cb) {
+            cb (dict, np, parm) ;
+        }
+        dict->key->free (dict, np) ;
+        dict->count-- ;
+
+    }
+    dict->head = dict->tail = 0 ;
+    dictionary_filter_rebuild (dict) ;
+
     DBG_CHECKV_T(dict->count == 0, "UTIL  :A: dictionary_remove_all") ;
 
 }
@@ -460,32 +1075,26 @@ void
 dictionary_destroy(struct dictionary * dict)
 {
     dictionary_remove_all (dict, 0, 0) ;
+    dictionary_reclaim (dict) ;
+    dict_slab_destroy (dict) ;
+    if (dict->filter) {
+        DICTIONARY_FREE (dict->heap, dict->filter) ;
+    }
     DICTIONARY_FREE (dict->heap, dict) ;
 }
 
 static struct dlist*
 _it_next (struct dictionary * dict, struct dictionary_it* it)
 {
-    struct dlist *np;
-    unsigned  i ;
-
-    if (it->np && it->np->next) {
-        it->prev = it->np ;
-        it->np = it->np->next ;
-        return it->np ;
+    if (it->np) {
+        it->np = it->np->succ ;
+    } else if (it->idx < 0) {
+        it->np = dict->head ;
     }
+    it->idx = 0 ;
     it->prev = 0 ;
-    for (i=it->idx+1; i<dict->hashsize; i++) {
-        for (np = dict->hashtab[i]; np != 0; ) {
-             it->np = np ;
-             it->idx = i ;
-             return np ;
-
-        }
-    }
-    it->np = 0 ;
-    return 0 ;
 
+    return it->np ;
 }
 
 struct dlist*
@@ -494,7 +1103,6 @@ dictionary_it_first (struct dictionary * dict, struct dictionary_it* it,
 {
     struct dlist *np ;
     struct dlist *nextnp = 0 ;
-    int idx ;
     it->idx = -1 ;
     it->cmp = cmp ;
     it->parm = parm ;
@@ -506,12 +1114,10 @@ dictionary_it_first (struct dictionary * dict, struct dictionary_it* it,
     while ((np = _it_next (dict, it))) {
         if (it->cmp(dict, it->parm, nextnp, np)>0) {
             nextnp = np ;
-            idx = it->idx ;
         }
     }
 
     it->np = nextnp ;
-    it->idx = idx ;
     return nextnp ;
 }
 
@@ -524,7 +1130,6 @@ dictionary_it_next (struct dictionary * dict, struct dictionary_it* it)
     struct dlist *nextnp  = 0 ;
     struct dlist *np;
     struct dictionary_it _it = {0, 0, -1, 0, 0} ;
-    int idx = -1 ;
 
     while ((np = _it_next (dict, &_it))) {
         if (it->np == np) {
@@ -535,16 +1140,13 @@ dictionary_it_next (struct dictionary * dict, struct dictionary_it* it)
         }
         if (!nextnp) {
             nextnp = np ;
-            idx = _it.idx ;
     }
         else if (it->cmp(dict, it->parm, nextnp, np)>0) {
             nextnp = np ;
-            idx = _it.idx ;
          }
      }
 
     it->np = nextnp ;
-    it->idx = idx ;
     return nextnp ;
 }
 
@@ -552,12 +1154,13 @@ struct dlist*
 dictionary_it_at (struct dictionary * dict, const char *key,
                     struct dictionary_it* it)
 {
-    it->idx = dict->key->hash(dict, key) ;
+    unsigned int hash = dict->key->hash (dict, key) ;
+    it->idx = dict_bucket(dict, hash) ;
     it->prev = 0 ;
 
-    for (it->np = dict->hashtab[dict->key->hash(dict, key)]; it->np != 0;
+    for (it->np = dict->hashtab[it->idx]; it->np != 0;
             it->np = it->np->next) {
-        if (dict->key->cmp(dict, it->np, key)) {
+        if (dict->key->cmp(dict, it->np, key, hash)) {
           return it->np ; /* found */
         }
         it->prev = it->np ;
@@ -583,15 +1186,31 @@ dictionary_get_key (struct dictionary * dict, struct dlist* np)
 
 }
 
+/*
+ * As dictionary_get_key(), for fingerprint keys the key is loaded to key
+ * (DICTIONARY_FINGERPRINT_WORDS_MAX words) so it may run concurrently. Other
+ * key types return the key in the node.
+ */
+const char*
+dictionary_load_key (struct dictionary * dict, struct dlist* np, char * key)
+{
+    if ((dict->keyspec >> 16) == DICTIONARY_KEYTYPE_FINGERPRINT) {
+        if (!dict->key_load) return 0 ;
+        return dict->key_load (dict, np, key, dict->key_parm) ;
+    }
+
+    return dict->key->key (dict, np) ;
+}
+
 unsigned int
 dictionary_get_key_size (struct dictionary * dict, struct dlist* np)
 {
-	if (!(dict->keyspec & 0xFFFF)) {
-		return strlen (dictionary_get_key (dict, np)) + 1 ;
-	}
-	if (dict->keyspec == DICTIONARY_KEYTYPE_USHORT) {
+	if (dict->keyspec == DICTIONARY_KEYSPEC_USHORT) {
 		return sizeof (uint16_t) ;
 	}
+	if (!(dict->keyspec & 0xFFFF)) {
+		return DICT_STR_KEYVAL(np)->length + 1 ;
+	}
 
 	return (dict->keyspec & 0xFFFF) * sizeof (uint32_t) ;
 }
@@ -604,12 +1223,35 @@ dictionary_get_value (struct dictionary * dict, struct dlist* np)
 
 }
 
+/*
+ * Move np to the end of the iteration order, e.g. when the entry was
+ * rewritten and should be visited after all older entries.
+ */
+void
+dictionary_move_last (struct dictionary * dict, struct dlist* np)
+{
+    if (dict->tail != np) {
+        dict_list_unlink (dict, np) ;
+        dict_list_append (dict, np) ;
+    }
+}
+
 unsigned int
 dictionary_count (struct dictionary * dict)
 {
     return dict->count ;
 }
 
+/*
+ * Full hash of the key before it is reduced to the hash table size. For
+ * binary keys this is the sum of the key words.
+ */
+unsigned int
+dictionary_hash (struct dictionary * dict, const char *key)
+{
+    return dict->key->hash (dict, key) ;
+}
+
 unsigned int
 dictionary_hashtab_size (struct dictionary * dict)
 {
@@ -627,19 +1269,24 @@ dictionary_hashtab_cnt (struct dictionary * dict, unsigned int idx)
     return cnt ;
 }
 
+unsigned int
+dictionary_slab_bytes (struct dictionary * dict)
+{
+    struct dictionary_slab_block * block ;
+    unsigned int bytes = 0 ;
+    for (block = dict->slab.blocks; block != 0; block = block->next) {
+        bytes += sizeof(struct dictionary_slab_block) +
+                    dict->slab.size * DICTIONARY_SLAB_BLOCK_NODES ;
+    }
+    return bytes ;
+}
+
 void
 dictionary_it_remove (struct dictionary * dict, struct dictionary_it* it)
 {
     struct dlist *np = it->np ;
-    struct dlist *prev = it->prev ;
     if (np) {
-        dict->count-- ;
-        if (prev) {
-            prev->next = np->next ;
-        }
-        else {
-            dict->hashtab[it->idx] = np->next ;
-        }
+        dict_unlink (dict, np) ;
         dict->key->free (dict, np) ;
 
     }
@@ -651,8 +1298,7 @@ dictionary_it_move (struct dictionary * dict, struct dictionary_it* it,
                     struct dictionary * dest)
 {
     struct dlist *np = it->np ;
-    struct dlist *prev = it->prev ;
-    unsigned int hashval = it->idx ;
+    unsigned int hashval ;
     struct dlist* res = dictionary_it_next (dict, it) ;
 
     if (!np || (dict->keyspec != dest->keyspec)) return res ;
@@ -661,18 +1307,31 @@ dictionary_it_move (struct dictionary * dict, struct dictionary_it* it,
 
     if (dict_lookup(dest, key)) return res ;
 
-    dict->count-- ;
-    it->prev = prev ;
-    if (prev) {
-        prev->next = np->next ;
+    struct dlist *from = np ;
+    if (dict->slab.size || dest->slab.size) {
+        /* slab nodes can not change owner, move a copy instead */
+        if (dict->slab.size != dest->slab.size) return res ;
+        np = dict_node_alloc (dest, dest->slab.size) ;
+        if (!np) return res ;
+        memcpy (np, from, dest->slab.size) ;
+        if ((dict->keyspec >> 16) == DICTIONARY_KEYTYPE_STRING) {
+            /* inline key */
+            DICT_STR_KEYVAL(np)->key = (char*)np +
+                    (DICT_STR_KEYVAL(from)->key - (char*)from) ;
+        }
     }
-    else {
-        dict->hashtab[hashval] = np->next ;
+
+    dict_unlink (dict, from) ;
+    if (from != np) {
+        dict_node_free (dict, from) ;
     }
 
-    hashval = dest->key->hash(dest, key);
+    /* same keyspec, the hash of the node is valid for dest */
+    dict_filter_add (dest, dict_node_hash (dest, np)) ;
+    hashval = dict_bucket(dest, dict_node_hash (dest, np)) ;
     np->next = dest->hashtab[hashval];
     dest->hashtab[hashval] = np;
+    dict_list_append (dest, np) ;
     dest->count++ ;
 
     return res ;
@@ -33,21 +33,28 @@ struct dictionary ;
 struct dlist ;
 
 typedef int  (*DLIST_COMPARE_T)(struct dictionary * /* dict */, uintptr_t parm, struct dlist * /* first */, struct dlist * /* second */) ;
+typedef const char * (*DICTIONARY_KEY_LOAD_T)(struct dictionary * /* dict */, struct dlist * /* np */, char * /* key */, uintptr_t parm) ;
 
 struct dlist { /* table entry: */
     struct dlist *          next; /* next entry in chain */
+    struct dlist *          succ; /* next entry in insertion order */
+    struct dlist *          pred; /* previous entry in insertion order */
     uintptr_t               keyval[]; /* handle to key */
 };
 
 struct dictionary_it {
     struct dlist *          np; /* this entry */
-    struct dlist *          prev; /* previous entry */
-    int                     idx ;
+    struct dlist *          prev; /* previous entry in chain (dictionary_it_at) */
+    int                     idx ; /* -1 before the first entry */
     DLIST_COMPARE_T         cmp ;
     uintptr_t               parm ;
 };
 
 
+#ifndef DICTIONARY_SLAB_BLOCK_NODES
+#define DICTIONARY_SLAB_BLOCK_NODES             16      /**< @brief nodes carved from one slab block */
+#endif
+
 #define DICTIONARY_MALLOC(heap, size)           heap_malloc (heap, size)
 #define DICTIONARY_FREE(heap, mem)              heap_free (heap, mem)
 
@@ -56,8 +63,10 @@ struct dictionary_it {
 //#define DICTIONARY_KEYTYPE_UCHAR              2
 #define DICTIONARY_KEYTYPE_USHORT               3
 #define DICTIONARY_KEYTYPE_BINARY               4
+#define DICTIONARY_KEYTYPE_FINGERPRINT          5
 
 #define DICTIONARY_MKKEY(keytype,spec)          (((uint32_t)(keytype)<<16) | ((uint32_t)(spec)))
+#define DICTIONARY_KEY_SIZE(keyspec)            ((keyspec) & 0xFFFF)
 #define DICTIONARY_KEYSPEC_STRING               DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_STRING, 0)
 #define DICTIONARY_KEYSPEC_CONST_STRING         DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_CONST_STRING, 0)
 #define DICTIONARY_KEYSPEC_USHORT               DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_USHORT, 0)
@@ -66,23 +75,35 @@ struct dictionary_it {
 #define DICTIONARY_KEYSPEC_BINARY_3             DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_BINARY, 3)
 #define DICTIONARY_KEYSPEC_BINARY_4             DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_BINARY, 4)
 #define DICTIONARY_KEYSPEC_BINARY(n)            DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_BINARY, n)
+/*
+ * Keys of n words as DICTIONARY_KEYSPEC_BINARY(n) with only their hash kept
+ * in the node. Keys with the same hash are told apart by the key load
+ * function of the dictionary, see dictionary_set_key_load().
+ */
+#define DICTIONARY_KEYSPEC_FINGERPRINT(n)       DICTIONARY_MKKEY(DICTIONARY_KEYTYPE_FINGERPRINT, n)
+#define DICTIONARY_FINGERPRINT_WORDS_MAX        8
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
     struct dictionary *     dictionary_init (heapspace heap, unsigned int keyspec, unsigned int hashsize) ;
+    struct dictionary *     dictionary_init_slab (heapspace heap, unsigned int keyspec, unsigned int hashsize, unsigned int keysize, unsigned int valuesize) ;
     struct dlist*           dictionary_install_size(struct dictionary * dict, const char *key, unsigned int valuesize) ;
     struct dlist*           dictionary_replace(struct dictionary * dict, const char *key, const char *value, unsigned int valuesize) ;
     struct dlist*           dictionary_lookup(struct dictionary * dict, const char *key, const char *value, unsigned int valuesize) ;
     struct dlist*           dictionary_get(struct dictionary * dict, const char *key) ;
+    struct dlist*           dictionary_get_concurrent(struct dictionary * dict, const char *key) ;
+    struct dlist*           dictionary_get_concurrent_hashed(struct dictionary * dict, const char *key, unsigned int hash) ;
     const char*             dictionary_get_key (struct dictionary * dict, struct dlist* np) ;
     unsigned int            dictionary_get_key_size (struct dictionary * dict, struct dlist* np) ;
     char*                   dictionary_get_value (struct dictionary * dict, struct dlist* np) ;
+    const char*             dictionary_load_key (struct dictionary * dict, struct dlist* np, char * key) ;
     unsigned int            dictionary_remove(struct dictionary * dict, const char *key) ;
     void                    dictionary_remove_all(struct dictionary * dict, void (*cb)(struct dictionary *, struct dlist*, uintptr_t), uintptr_t parm) ;
     void                    dictionary_destroy (struct dictionary * dict) ;
     unsigned int            dictionary_count (struct dictionary * dict) ;
+    void                    dictionary_move_last (struct dictionary * dict, struct dlist* np) ;
 
     struct dlist*           dictionary_it_first (struct dictionary * dict, struct dictionary_it* it, DLIST_COMPARE_T cmp, uintptr_t parm) ;
     struct dlist*           dictionary_it_next (struct dictionary * dict, struct dictionary_it* it) ;
@@ -91,8 +112,17 @@ extern "C" {
     void                    dictionary_it_remove (struct dictionary * dict, struct dictionary_it* it) ;
     struct dlist*           dictionary_it_move (struct dictionary * dict, struct dictionary_it* it, struct dictionary * dest) ;
 
+    unsigned int            dictionary_hash (struct dictionary * dict, const char *key) ;
     unsigned int            dictionary_hashtab_size (struct dictionary * dict) ;
     unsigned int            dictionary_hashtab_cnt (struct dictionary * dict, unsigned int idx) ;
+    unsigned int            dictionary_slab_bytes (struct dictionary * dict) ;
+
+    void                    dictionary_set_key_load (struct dictionary * dict, DICTIONARY_KEY_LOAD_T load, uintptr_t parm) ;
+    unsigned int            dictionary_set_filter (struct dictionary * dict, unsigned int bits) ;
+    void                    dictionary_filter_rebuild (struct dictionary * dict) ;
+    void                    dictionary_set_concurrent (struct dictionary * dict) ;
+    unsigned int            dictionary_retired (struct dictionary * dict) ;
+    void                    dictionary_reclaim (struct dictionary * dict) ;
 
 #ifdef __cplusplus
 }
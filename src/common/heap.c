@@ -22,12 +22,303 @@
  */
 
 
+
+/*
+ * Every heapspace is either backed by the system heap (malloc) or, after
+ * heap_space_init(), by its own bounded arena on a caller supplied region.
+ *
+ * The arenas use a two level segregated fit allocator (TLSF): free blocks are
+ * kept in lists indexed by the most significant bit of their size (first
+ * level) and the next HEAP_SL_INDEX_COUNT_LOG2 bits (second level). A bitmap
+ * for every level makes a search for a fitting free list a constant time
+ * find first set operation, so malloc and free are O(1). Physical neighbours
+ * are merged when a block is freed.
+ */
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "system_config.h"
 #include "heap.h"
 
+#if CFG_PORT_POSIX
+#include <pthread.h>
+static pthread_mutex_t      _heap_mutex = PTHREAD_MUTEX_INITIALIZER ;
+#define HEAP_LOCK()         pthread_mutex_lock (&_heap_mutex)
+#define HEAP_UNLOCK()       pthread_mutex_unlock (&_heap_mutex)
+#else
+#define HEAP_LOCK()
+#define HEAP_UNLOCK()
+#endif
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+#define HEAP_ALIGN_SIZE_LOG2        3
+#define HEAP_ALIGN_SIZE             (1 << HEAP_ALIGN_SIZE_LOG2)
+#define HEAP_SL_INDEX_COUNT_LOG2    4
+#define HEAP_SL_INDEX_COUNT         (1 << HEAP_SL_INDEX_COUNT_LOG2)
+#define HEAP_FL_INDEX_SHIFT         (HEAP_SL_INDEX_COUNT_LOG2 + HEAP_ALIGN_SIZE_LOG2)
+#define HEAP_FL_INDEX_MAX           31
+#define HEAP_FL_INDEX_COUNT         (HEAP_FL_INDEX_MAX - HEAP_FL_INDEX_SHIFT + 1)
+#define HEAP_SMALL_BLOCK_SIZE       (1 << HEAP_FL_INDEX_SHIFT)
+
+#define HEAP_BLOCK_FREE             0x1
+#define HEAP_BLOCK_PREV_FREE        0x2
+#define HEAP_BLOCK_FLAGS            (HEAP_BLOCK_FREE | HEAP_BLOCK_PREV_FREE)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+typedef struct HEAP_BLOCK_S {
+    struct HEAP_BLOCK_S *   prev_phys ;         /* block before this one in the arena */
+    uintptr_t               size ;              /* payload size and HEAP_BLOCK_FLAGS */
+    /* free blocks only, overlaps the payload */
+    struct HEAP_BLOCK_S *   next_free ;
+    struct HEAP_BLOCK_S *   prev_free ;
+} HEAP_BLOCK_T ;
+
+#define HEAP_BLOCK_HEADER           offsetof(HEAP_BLOCK_T, next_free)
+#define HEAP_BLOCK_SIZE_MIN         (sizeof(HEAP_BLOCK_T) - HEAP_BLOCK_HEADER)
+
+/* header for allocations from the system heap, keeps the accounting */
+typedef union HEAP_SYSTEM_S {
+    struct {
+        uint32_t            size ;
+        uint32_t            heap ;
+    } s ;
+    uintptr_t               align[2] ;
+} HEAP_SYSTEM_T ;
+
+typedef struct HEAP_ARENA_S {
+    uint8_t *               start ;
+    uint8_t *               end ;
+    uint32_t                fl_bitmap ;
+    uint32_t                sl_bitmap[HEAP_FL_INDEX_COUNT] ;
+    HEAP_BLOCK_T *          blocks[HEAP_FL_INDEX_COUNT][HEAP_SL_INDEX_COUNT] ;
+    HEAP_STATS_T            stats ;
+} HEAP_ARENA_T ;
+
+static HEAP_ARENA_T         _heap_arena[HEAP_SPACE_LAST] ;
+
+/*===========================================================================*/
+/* Local functions.                                                          */
+/*===========================================================================*/
+
+static inline int
+heap_fls (uint32_t word)
+{
+    return word ? 31 - __builtin_clz (word) : -1 ;
+}
+
+static inline int
+heap_ffs (uint32_t word)
+{
+    return word ? __builtin_ctz (word) : -1 ;
+}
+
+static inline uint32_t
+block_size (const HEAP_BLOCK_T * block)
+{
+    return (uint32_t)(block->size & ~(uintptr_t)HEAP_BLOCK_FLAGS) ;
+}
+
+static inline HEAP_BLOCK_T *
+block_next (const HEAP_BLOCK_T * block)
+{
+    return (HEAP_BLOCK_T *)((uint8_t*)block + HEAP_BLOCK_HEADER +
+                block_size (block)) ;
+}
+
+static inline void *
+block_to_ptr (const HEAP_BLOCK_T * block)
+{
+    return (uint8_t*)block + HEAP_BLOCK_HEADER ;
+}
+
+static inline HEAP_BLOCK_T *
+block_from_ptr (const void * ptr)
+{
+    return (HEAP_BLOCK_T *)((uint8_t*)ptr - HEAP_BLOCK_HEADER) ;
+}
+
+static void
+mapping_insert (uint32_t size, int * fl, int * sl)
+{
+    if (size < HEAP_SMALL_BLOCK_SIZE) {
+        *fl = 0 ;
+        *sl = size / (HEAP_SMALL_BLOCK_SIZE / HEAP_SL_INDEX_COUNT) ;
+    } else {
+        int f = heap_fls (size) ;
+        *sl = (int)(size >> (f - HEAP_SL_INDEX_COUNT_LOG2)) ^
+                    HEAP_SL_INDEX_COUNT ;
+        *fl = f - (HEAP_FL_INDEX_SHIFT - 1) ;
+    }
+}
+
+/* round up to the next list so any block found is large enough */
+static void
+mapping_search (uint32_t size, int * fl, int * sl)
+{
+    if (size >= HEAP_SMALL_BLOCK_SIZE) {
+        size += (1 << (heap_fls (size) - HEAP_SL_INDEX_COUNT_LOG2)) - 1 ;
+    }
+    mapping_insert (size, fl, sl) ;
+}
+
+static void
+free_list_remove (HEAP_ARENA_T * arena, HEAP_BLOCK_T * block)
+{
+    int fl, sl ;
+    mapping_insert (block_size (block), &fl, &sl) ;
+
+    if (block->next_free) block->next_free->prev_free = block->prev_free ;
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free ;
+    } else {
+        arena->blocks[fl][sl] = block->next_free ;
+        if (!block->next_free) {
+            arena->sl_bitmap[fl] &= ~(1U << sl) ;
+            if (!arena->sl_bitmap[fl]) arena->fl_bitmap &= ~(1U << fl) ;
+        }
+    }
+}
+
+static void
+free_list_insert (HEAP_ARENA_T * arena, HEAP_BLOCK_T * block)
+{
+    int fl, sl ;
+    mapping_insert (block_size (block), &fl, &sl) ;
+
+    block->prev_free = 0 ;
+    block->next_free = arena->blocks[fl][sl] ;
+    if (block->next_free) block->next_free->prev_free = block ;
+    arena->blocks[fl][sl] = block ;
+    arena->fl_bitmap |= 1U << fl ;
+    arena->sl_bitmap[fl] |= 1U << sl ;
+}
+
+static HEAP_BLOCK_T *
+free_list_search (HEAP_ARENA_T * arena, uint32_t size)
+{
+    int fl, sl ;
+    uint32_t sl_map ;
+
+    mapping_search (size, &fl, &sl) ;
+    if (fl >= HEAP_FL_INDEX_COUNT) return 0 ;
+
+    sl_map = arena->sl_bitmap[fl] & (~0U << sl) ;
+    if (!sl_map) {
+        uint32_t fl_map = arena->fl_bitmap & (~0U << (fl + 1)) ;
+        if (!fl_map) return 0 ;
+        fl = heap_ffs (fl_map) ;
+        sl_map = arena->sl_bitmap[fl] ;
+    }
+    sl = heap_ffs (sl_map) ;
+
+    return arena->blocks[fl][sl] ;
+}
+
+static HEAP_ARENA_T *
+arena_from_ptr (const void * mem)
+{
+    unsigned int i ;
+    for (i=0; i<HEAP_SPACE_LAST; i++) {
+        if (((const uint8_t*)mem >= _heap_arena[i].start) &&
+                ((const uint8_t*)mem < _heap_arena[i].end)) {
+            return &_heap_arena[i] ;
+        }
+    }
+    return 0 ;
+}
+
+static void
+stats_alloc (HEAP_STATS_T * stats, uint32_t size)
+{
+    stats->used += size ;
+    if (stats->used > stats->peak) stats->peak = stats->used ;
+    stats->count++ ;
+    stats->allocs++ ;
+}
+
+static void
+stats_free (HEAP_STATS_T * stats, uint32_t size)
+{
+    stats->used -= size ;
+    stats->count-- ;
+}
+
+static void *
+arena_malloc (HEAP_ARENA_T * arena, uint32_t bytes)
+{
+    HEAP_BLOCK_T * block ;
+    uint32_t size = (bytes + HEAP_ALIGN_SIZE - 1) & ~(HEAP_ALIGN_SIZE - 1) ;
+    if (size < HEAP_BLOCK_SIZE_MIN) size = HEAP_BLOCK_SIZE_MIN ;
+
+    block = free_list_search (arena, size) ;
+    if (!block) {
+        arena->stats.failures++ ;
+        return 0 ;
+    }
+    free_list_remove (arena, block) ;
+
+    if (block_size (block) >= size + HEAP_BLOCK_HEADER + HEAP_BLOCK_SIZE_MIN) {
+        /* split off the remainder as a new free block */
+        HEAP_BLOCK_T * remain = (HEAP_BLOCK_T *)((uint8_t*)block_to_ptr (block) +
+                                size) ;
+        remain->size = (block_size (block) - size - HEAP_BLOCK_HEADER) |
+                                HEAP_BLOCK_FREE ;
+        remain->prev_phys = block ;
+        block_next (remain)->prev_phys = remain ;
+        free_list_insert (arena, remain) ;
+        block->size = size | (block->size & HEAP_BLOCK_PREV_FREE) ;
+
+    } else {
+        block->size &= ~(uintptr_t)HEAP_BLOCK_FREE ;
+        block_next (block)->size &= ~(uintptr_t)HEAP_BLOCK_PREV_FREE ;
+
+    }
+
+    stats_alloc (&arena->stats, block_size (block)) ;
+
+    return block_to_ptr (block) ;
+}
+
+static void
+arena_free (HEAP_ARENA_T * arena, void * mem)
+{
+    HEAP_BLOCK_T * block = block_from_ptr (mem) ;
+    HEAP_BLOCK_T * next ;
+
+    stats_free (&arena->stats, block_size (block)) ;
+
+    if (block->size & HEAP_BLOCK_PREV_FREE) {
+        HEAP_BLOCK_T * prev = block->prev_phys ;
+        free_list_remove (arena, prev) ;
+        prev->size += HEAP_BLOCK_HEADER + block_size (block) ;
+        block = prev ;
+    }
+
+    next = block_next (block) ;
+    if (next->size & HEAP_BLOCK_FREE) {
+        free_list_remove (arena, next) ;
+        block->size += HEAP_BLOCK_HEADER + block_size (next) ;
+        next = block_next (block) ;
+    }
+
+    block->size |= HEAP_BLOCK_FREE ;
+    next->prev_phys = block ;
+    next->size |= HEAP_BLOCK_PREV_FREE ;
+    free_list_insert (arena, block) ;
+}
+
+/*===========================================================================*/
+/* Interface Implementation.                                                 */
+/*===========================================================================*/
 
 unsigned int
 heap_init (void)
@@ -35,24 +326,170 @@ heap_init (void)
     return 0 ;
 }
 
+/**
+ * @brief   Back the heapspace with an arena on the region supplied.
+ * @note    Can only be called before the heapspace is used. Without an arena
+ *          the heapspace allocates from the system heap.
+ * @param[in] heap
+ * @param[in] region    memory for the arena, or NULL to use the system heap.
+ * @param[in] size      bytes in region.
+ * @return
+ * @retval 0            success.
+ * @retval -1           invalid heapspace or region too small.
+ */
+int32_t
+heap_space_init (heapspace heap, void * region, uint32_t size)
+{
+    HEAP_ARENA_T * arena ;
+    HEAP_BLOCK_T * block ;
+    HEAP_BLOCK_T * sentinel ;
+    uint8_t * start ;
+
+    if (heap >= HEAP_SPACE_LAST) return -1 ;
+    arena = &_heap_arena[heap] ;
+
+    HEAP_LOCK() ;
+    memset (arena, 0, sizeof (HEAP_ARENA_T)) ;
+    if (!region) {
+        HEAP_UNLOCK() ;
+        return 0 ;
+    }
+
+    start = (uint8_t*)(((uintptr_t)region + HEAP_ALIGN_SIZE - 1) &
+                ~(uintptr_t)(HEAP_ALIGN_SIZE - 1)) ;
+    size -= start - (uint8_t*)region ;
+    size &= ~(HEAP_ALIGN_SIZE - 1) ;
+    if (size < 2 * HEAP_BLOCK_HEADER + HEAP_BLOCK_SIZE_MIN) {
+        HEAP_UNLOCK() ;
+        return -1 ;
+    }
+
+    /* one free block followed by a used sentinel of size 0 */
+    block = (HEAP_BLOCK_T *)start ;
+    block->prev_phys = 0 ;
+    block->size = (size - 2 * HEAP_BLOCK_HEADER) | HEAP_BLOCK_FREE ;
+    sentinel = block_next (block) ;
+    sentinel->prev_phys = block ;
+    sentinel->size = HEAP_BLOCK_PREV_FREE ;
+    free_list_insert (arena, block) ;
+
+    arena->start = start ;
+    arena->end = start + size ;
+    arena->stats.size = size ;
+    HEAP_UNLOCK() ;
+
+    return 0 ;
+}
+
+/**
+ * @brief   Return the accounting for the heapspace.
+ * @param[in] heap
+ * @param[out] stats
+ */
+void
+heap_space_stats (heapspace heap, HEAP_STATS_T * stats)
+{
+    memset (stats, 0, sizeof (HEAP_STATS_T)) ;
+    if (heap >= HEAP_SPACE_LAST) return ;
+    HEAP_LOCK() ;
+    *stats = _heap_arena[heap].stats ;
+    HEAP_UNLOCK() ;
+}
 
 void * heap_malloc(heapspace heap, uint32_t bytes)
 {
-    return malloc (bytes) ;
+    HEAP_ARENA_T * arena ;
+    void * mem = 0 ;
+
+    if (heap >= HEAP_SPACE_LAST) return 0 ;
+    arena = &_heap_arena[heap] ;
+
+    HEAP_LOCK() ;
+    if (arena->start) {
+        mem = arena_malloc (arena, bytes) ;
+
+    } else {
+        HEAP_SYSTEM_T * sys = malloc (sizeof (HEAP_SYSTEM_T) + bytes) ;
+        if (sys) {
+            sys->s.size = bytes ;
+            sys->s.heap = heap ;
+            stats_alloc (&arena->stats, bytes) ;
+            mem = sys + 1 ;
+        } else {
+            arena->stats.failures++ ;
+        }
+
+    }
+    HEAP_UNLOCK() ;
+
+    return mem ;
 }
 
 void heap_free(heapspace heap, void* mem)
 {
-    free (mem) ;
+    HEAP_ARENA_T * arena ;
+
+    if (!mem) return ;
+
+    HEAP_LOCK() ;
+    arena = arena_from_ptr (mem) ;
+    if (arena) {
+        arena_free (arena, mem) ;
+
+    } else {
+        HEAP_SYSTEM_T * sys = (HEAP_SYSTEM_T *)mem - 1 ;
+        stats_free (&_heap_arena[sys->s.heap].stats, sys->s.size) ;
+        free (sys) ;
+
+    }
+    HEAP_UNLOCK() ;
 }
 
 void * heap_calloc(heapspace heap, uint32_t elements, uint32_t size)
 {
-    return calloc(elements, size) ;
+    void * mem = heap_malloc (heap, elements * size) ;
+    if (mem) memset (mem, 0, elements * size) ;
+    return mem ;
 }
 
 void*
 heap_realloc(heapspace heap, void * mem, uint32_t bytes)
 {
-    return realloc(mem, bytes) ;
+    void * new ;
+    uint32_t size ;
+
+    if (!mem) return heap_malloc (heap, bytes) ;
+
+    size = heap_usable_size (mem) ;
+    if (bytes <= size) return mem ;
+
+    new = heap_malloc (heap, bytes) ;
+    if (new) {
+        memcpy (new, mem, size) ;
+        heap_free (heap, mem) ;
+    }
+
+    return new ;
+}
+
+/**
+ * @brief   Return the number of bytes that can be used in an allocation.
+ * @param[in] mem   memory returned by heap_malloc().
+ */
+uint32_t
+heap_usable_size (void * mem)
+{
+    uint32_t size ;
+
+    if (!mem) return 0 ;
+
+    HEAP_LOCK() ;
+    if (arena_from_ptr (mem)) {
+        size = block_size (block_from_ptr (mem)) ;
+    } else {
+        size = ((HEAP_SYSTEM_T *)mem - 1)->s.size ;
+    }
+    HEAP_UNLOCK() ;
+
+    return size ;
 }
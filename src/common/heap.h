@@ -38,6 +38,18 @@ typedef enum  {
     HEAP_SPACE_LAST
 } heapspace ;
 
+/**
+ * @brief   accounting for one heapspace.
+ */
+typedef struct HEAP_STATS_S {
+    uint32_t            size ;                  /**< @brief  bytes in the arena, 0 if the heapspace uses the system heap */
+    uint32_t            used ;                  /**< @brief  bytes currently allocated */
+    uint32_t            peak ;                  /**< @brief  high-water mark of used */
+    uint32_t            count ;                 /**< @brief  allocations currently outstanding */
+    uint32_t            allocs ;                /**< @brief  allocations since the heapspace was initialised */
+    uint32_t            failures ;              /**< @brief  allocations that could not be served */
+} HEAP_STATS_T ;
+
 
 
 /*===========================================================================*/
@@ -49,22 +61,19 @@ extern "C" {
 #endif
 
     extern unsigned int     heap_init (void) ;
+    extern int32_t          heap_space_init (heapspace heap, void * region, uint32_t size) ;
+    extern void             heap_space_stats (heapspace heap, HEAP_STATS_T * stats) ;
 
     extern void *           heap_malloc(heapspace heap, uint32_t bytes) ;
     extern void *           heap_calloc(heapspace heap, uint32_t bytes, uint32_t size) ;
     extern void             heap_free(heapspace heap, void * mem) ;
     extern void *           heap_realloc(heapspace heap, void * mem, uint32_t bytes) ;
+    extern uint32_t         heap_usable_size(void * mem) ;
 
 
 #ifdef __cplusplus
 }
 #endif
 
-/*===========================================================================*/
-/* Module inline functions.                                                  */
-/*===========================================================================*/
-
-#define                 heap_usable_size(mem)           mspace_usable_size(mem)
-
 #endif /* __MHEAP_H__ */
 /** @} */
@@ -0,0 +1,292 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+#include <string.h>
+#include <common/errordef.h>
+#include "kvline.h"
+
+static int
+kvline_hex (char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0' ;
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10 ;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10 ;
+    return -1 ;
+}
+
+static char *
+kvline_skip (char * p)
+{
+    while ((*p == ' ') || (*p == '\t')) p++ ;
+    return p ;
+}
+
+/*
+ * Decode the string quoted at *s in place and NUL terminate it.
+ */
+static char *
+kvline_quoted (char ** s, uint32_t * length)
+{
+    char * p = *s + 1 ;
+    char * start = p ;
+    char * out = p ;
+    int hi, lo ;
+
+    while (*p && (*p != '"')) {
+        if ((*p != '\\') || !p[1]) {
+            *out++ = *p++ ;
+            continue ;
+        }
+        p++ ;
+        switch (*p) {
+        case 'n': *out++ = '\n' ; p++ ; break ;
+        case 't': *out++ = '\t' ; p++ ; break ;
+        case 'r': *out++ = '\r' ; p++ ; break ;
+        case 'x':
+            hi = kvline_hex (p[1]) ;
+            lo = hi < 0 ? -1 : kvline_hex (p[2]) ;
+            if (lo < 0) return 0 ;
+            *out++ = (char)((hi << 4) | lo) ;
+            p += 3 ;
+            break ;
+        default: *out++ = *p++ ; break ;
+        }
+    }
+    if (*p != '"') return 0 ;
+
+    *length = out - start ;
+    *out = '\0' ;
+    *s = p + 1 ;
+    return start ;
+}
+
+/*
+ * Decode the hex bytes between < and > at *s in place.
+ */
+static char *
+kvline_raw (char ** s, uint32_t * length)
+{
+    char * p = *s + 1 ;
+    char * start = p ;
+    char * out = p ;
+    int hi, lo ;
+
+    for (p = kvline_skip (p) ; *p && (*p != '>') ; p = kvline_skip (p)) {
+        hi = kvline_hex (p[0]) ;
+        lo = hi < 0 ? -1 : kvline_hex (p[1]) ;
+        if (lo < 0) return 0 ;
+        *out++ = (char)((hi << 4) | lo) ;
+        p += 2 ;
+    }
+    if (*p != '>') return 0 ;
+
+    *length = out - start ;
+    *s = p + 1 ;
+    return start ;
+}
+
+/**
+ * @brief Check a line read with fgets() was not cut at the end of the
+ *              buffer. A line filling it without a newline did not fit, the
+ *              buffer is sized for the longest valid line and its newline.
+ * @param[in] line
+ * @param[in] size      size of the buffer passed to fgets()
+ * @return
+ * @retval EOK          the whole line was read.
+ * @retval E_FULL       the line is too long.
+ */
+int32_t
+kvline_check (const char * line, uint32_t size)
+{
+    size_t len = strlen (line) ;
+
+    if ((len + 1 >= size) && (line[len - 1] != '\n')) {
+        return E_FULL ;
+    }
+
+    return EOK ;
+}
+
+/**
+ * @brief Parse a line of a key/value file in place.
+ * @param[in,out] line  NUL terminated, a trailing newline is ignored
+ * @param[out] kv
+ * @return
+ * @retval EOK          kv is valid.
+ * @retval E_EMPTY      blank line or comment.
+ * @retval E_FMT        not a key/value line.
+ */
+int32_t
+kvline_parse (char * line, KVLINE_T * kv)
+{
+    char * p ;
+    char * end ;
+
+    line[strcspn (line, "\r\n")] = '\0' ;
+    p = kvline_skip (line) ;
+    if (!*p || (*p == '#')) {
+        return E_EMPTY ;
+    }
+
+    if (*p == '"') {
+        kv->key = kvline_quoted (&p, &kv->key_length) ;
+        if (!kv->key || (*p && (*p != ' ') && (*p != '\t'))) {
+            return E_FMT ;
+        }
+        if (*p) p++ ;
+
+    } else {
+        kv->key = p ;
+        while (*p && (*p != ' ') && (*p != '\t')) p++ ;
+        kv->key_length = p - kv->key ;
+        if (*p) *p++ = '\0' ;
+
+    }
+    if (!kv->key_length) {
+        return E_FMT ;
+    }
+
+    p = kvline_skip (p) ;
+    if ((*p == '"') || (*p == '<')) {
+        if (*p == '"') {
+            kv->value = kvline_quoted (&p, &kv->value_length) ;
+            kv->value_length++ ;
+
+        } else {
+            kv->value = kvline_raw (&p, &kv->value_length) ;
+
+        }
+        if (!kv->value || *kvline_skip (p)) {
+            return E_FMT ;
+        }
+
+    } else {
+        kv->value = p ;
+        end = p + strlen (p) ;
+        while ((end > p) && ((end[-1] == ' ') || (end[-1] == '\t'))) end-- ;
+        *end = '\0' ;
+        kv->value_length = end - p + 1 ;
+
+    }
+
+    return EOK ;
+}
+
+static inline void
+kvline_put (char * buffer, uint32_t size, uint32_t * pos, char c)
+{
+    if (*pos < size) buffer[*pos] = c ;
+    (*pos)++ ;
+}
+
+static void
+kvline_string (char * buffer, uint32_t size, uint32_t * pos,
+                const char * str, uint32_t length)
+{
+    static const char hex[] = "0123456789abcdef" ;
+    uint32_t i ;
+    char c ;
+
+    kvline_put (buffer, size, pos, '"') ;
+    for (i = 0 ; i < length ; i++) {
+        c = str[i] ;
+        if ((c == '"') || (c == '\\')) {
+            kvline_put (buffer, size, pos, '\\') ;
+            kvline_put (buffer, size, pos, c) ;
+
+        } else if (c == '\n') {
+            kvline_put (buffer, size, pos, '\\') ;
+            kvline_put (buffer, size, pos, 'n') ;
+
+        } else if (((unsigned char)c < ' ') || ((unsigned char)c >= 0x7F)) {
+            kvline_put (buffer, size, pos, '\\') ;
+            kvline_put (buffer, size, pos, 'x') ;
+            kvline_put (buffer, size, pos, hex[(unsigned char)c >> 4]) ;
+            kvline_put (buffer, size, pos, hex[c & 0xF]) ;
+
+        } else {
+            kvline_put (buffer, size, pos, c) ;
+
+        }
+    }
+    kvline_put (buffer, size, pos, '"') ;
+}
+
+/**
+ * @brief Format a key and value as a line read back by kvline_parse(),
+ *              without the newline. Values ending with their only NUL are
+ *              written as strings, others as raw bytes.
+ * @param[out] buffer
+ * @param[in] size
+ * @param[in] key       NUL terminated
+ * @param[in] value
+ * @param[in] length
+ * @return              characters written or E_FULL if size is too small
+ */
+int32_t
+kvline_format (char * buffer, uint32_t size, const char * key,
+                const char * value, uint32_t length)
+{
+    static const char hex[] = "0123456789abcdef" ;
+    uint32_t pos = 0 ;
+    uint32_t i ;
+
+    for (i = 0 ; key[i] ; i++) {
+        if (((unsigned char)key[i] <= ' ') || ((unsigned char)key[i] >= 0x7F) ||
+                strchr ("\"#\\", key[i])) {
+            break ;
+        }
+    }
+    if (!i || key[i]) {
+        kvline_string (buffer, size, &pos, key, strlen (key)) ;
+
+    } else {
+        while (*key) kvline_put (buffer, size, &pos, *key++) ;
+
+    }
+    do {
+        kvline_put (buffer, size, &pos, ' ') ;
+    } while (pos < 24) ;
+
+    if (length && !value[length - 1] && !memchr (value, '\0', length - 1)) {
+        kvline_string (buffer, size, &pos, value, length - 1) ;
+
+    } else {
+        kvline_put (buffer, size, &pos, '<') ;
+        for (i = 0 ; i < length ; i++) {
+            if (i) kvline_put (buffer, size, &pos, ' ') ;
+            kvline_put (buffer, size, &pos, hex[(uint8_t)value[i] >> 4]) ;
+            kvline_put (buffer, size, &pos, hex[value[i] & 0xF]) ;
+        }
+        kvline_put (buffer, size, &pos, '>') ;
+
+    }
+
+    if (pos >= size) {
+        if (size) buffer[0] = '\0' ;
+        return E_FULL ;
+    }
+    buffer[pos] = '\0' ;
+
+    return pos ;
+}
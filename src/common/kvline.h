@@ -0,0 +1,88 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+
+#ifndef __KVLINE_H__
+#define __KVLINE_H__
+
+#include <stdint.h>
+
+/*
+ * One line of a key/value file, as read by tools/phashgen, tools/nvolimage
+ * and the shell import commands:
+ *
+ *      # comment
+ *      user.name       "John Smith"
+ *      user.age        30
+ *      user.address    123 Main St.
+ *      user.flags      <03 01>
+ *
+ * Keys are a word or double quoted. Values are double quoted with C escapes
+ * (\n \t \r \" \\ \xHH), raw bytes in hex between < and >, or the rest of the
+ * line. Strings are stored with their terminating NUL, as the shell does,
+ * raw bytes are stored as they are.
+ */
+
+/*===========================================================================*/
+/* Constants.                                                                */
+/*===========================================================================*/
+
+#define KVLINE_LENGTH_MAX                   1024    /* line buffer for the readers */
+
+/*
+ * Line buffer for a key and value of at most these lengths as written by
+ * kvline_format(), an escaped byte takes 4 characters.
+ */
+#define KVLINE_LENGTH(key, value)           (4 * ((key) + (value)) + 32)
+
+/*===========================================================================*/
+/* Data structures and types.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   A parsed line, pointing into the line buffer.
+ */
+typedef struct KVLINE_S {
+    char *              key ;                   /**< @brief  NUL terminated */
+    uint32_t            key_length ;            /**< @brief  excluding the NUL */
+    char *              value ;
+    uint32_t            value_length ;          /**< @brief  including the NUL of strings */
+} KVLINE_T ;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    int32_t         kvline_check (const char * line, uint32_t size) ;
+    int32_t         kvline_parse (char * line, KVLINE_T * kv) ;
+    int32_t         kvline_format (char * buffer, uint32_t size, const char * key, const char * value, uint32_t length) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __KVLINE_H__ */
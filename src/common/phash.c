@@ -0,0 +1,173 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+#include <string.h>
+#include <common/errordef.h>
+#include "phash.h"
+
+/*
+ * The offsets were validated by phash_check(), so lookups do not check
+ * bounds again.
+ */
+static inline const uint8_t *
+phash_at (const PHASH_T * table, uint32_t offset)
+{
+    return (const uint8_t *) table + offset ;
+}
+
+static inline uint32_t
+phash_value_length (const uint8_t * entry)
+{
+    return entry[1] | ((uint32_t)entry[2] << 8) ;
+}
+
+static int32_t
+phash_check_entry (const PHASH_T * table, uint32_t offset, uint32_t size)
+{
+    const uint8_t * entry ;
+    uint32_t end ;
+
+    if ((offset < PHASH_TABLE_SIZE(table->count, table->buckets)) ||
+            (offset > size - PHASH_ENTRY_HEAD)) {
+        return E_CORRUPT ;
+    }
+    entry = phash_at (table, offset) ;
+    end = offset + PHASH_ENTRY_HEAD + entry[0] + 1 + phash_value_length (entry) ;
+    if ((end > size) || entry[PHASH_ENTRY_HEAD + entry[0]]) {
+        return E_CORRUPT ;
+    }
+
+    return EOK ;
+}
+
+/**
+ * @brief Validate a table image before it is used, e.g. after programming.
+ * @param[in] table     4 byte aligned image
+ * @param[in] size      bytes available for the image
+ * @return
+ * @retval EOK          valid.
+ * @retval E_VERSION    not a table of this version.
+ * @retval E_CORRUPT    truncated or an offset out of range.
+ */
+int32_t
+phash_check (const PHASH_T * table, uint32_t size)
+{
+    uint32_t i ;
+
+    if (!table || (size < sizeof(PHASH_T)) ||
+            (table->magic != PHASH_MAGIC)) {
+        return E_CORRUPT ;
+    }
+    if (table->version != PHASH_VERSION) {
+        return E_VERSION ;
+    }
+    if ((table->size > size) || (table->count > PHASH_COUNT_MAX) ||
+            (table->count && !table->buckets) ||
+            (table->buckets > table->count) ||
+            (PHASH_TABLE_SIZE(table->count, table->buckets) > table->size)) {
+        return E_CORRUPT ;
+    }
+    for (i = 0 ; i < 2 * table->count ; i++) {
+        if (phash_check_entry (table, table->table[table->buckets + i],
+                table->size) != EOK) {
+            return E_CORRUPT ;
+        }
+    }
+
+    return EOK ;
+}
+
+/**
+ * @brief Number of keys in the table.
+ */
+uint32_t
+phash_count (const PHASH_T * table)
+{
+    return table->count ;
+}
+
+/**
+ * @brief Find the value of a key, one hash, one displacement read and one
+ *              key compare.
+ * @param[in] table     checked with phash_check()
+ * @param[in] key
+ * @param[in] length    key length
+ * @param[out] value    valid as long as the table
+ * @return              value length or E_NOTFOUND
+ */
+int32_t
+phash_lookup (const PHASH_T * table, const void * key, uint32_t length,
+                const char ** value)
+{
+    const uint8_t * entry ;
+    uint32_t h[3] ;
+    uint32_t d ;
+
+    if (!table->count || (length > PHASH_KEY_LENGTH_MAX)) {
+        return E_NOTFOUND ;
+    }
+
+    phash_hash (key, length, table->seed, h) ;
+    d = table->table[h[0] % table->buckets] ;
+    entry = phash_at (table, table->table[table->buckets +
+            (h[1] + (d >> 16) * h[2] + (d & 0xFFFF)) % table->count]) ;
+
+    if ((entry[0] != length) ||
+            memcmp (entry + PHASH_ENTRY_HEAD, key, length)) {
+        return E_NOTFOUND ;
+    }
+    if (value) {
+        *value = (const char *) entry + PHASH_ENTRY_HEAD + length + 1 ;
+    }
+
+    return phash_value_length (entry) ;
+}
+
+/**
+ * @brief Return entry i in key order, for iterating the table.
+ * @param[in] table     checked with phash_check()
+ * @param[in] i         0 to phash_count() - 1
+ * @param[out] key      NUL terminated
+ * @param[out] value
+ * @return              value length or E_EOF
+ */
+int32_t
+phash_entry (const PHASH_T * table, uint32_t i, const char ** key,
+                const char ** value)
+{
+    const uint8_t * entry ;
+
+    if (i >= table->count) {
+        return E_EOF ;
+    }
+
+    entry = phash_at (table, table->table[table->buckets + table->count + i]) ;
+    if (key) {
+        *key = (const char *) entry + PHASH_ENTRY_HEAD ;
+    }
+    if (value) {
+        *value = (const char *) entry + PHASH_ENTRY_HEAD + entry[0] + 1 ;
+    }
+
+    return phash_value_length (entry) ;
+}
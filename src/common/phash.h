@@ -0,0 +1,131 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+
+#ifndef __PHASH_H__
+#define __PHASH_H__
+
+#include <stdint.h>
+
+/*
+ * Static minimal perfect hash tables for read-only key/value data, laid out
+ * in FLASH or ROM by tools/phashgen and read in place without an index in
+ * RAM. The image is, in host byte order:
+ *
+ *      PHASH_T             header
+ *      uint32_t            disp[buckets]   displacement (d0 << 16 | d1)
+ *      uint32_t            slot[count]     entry offset for each hash slot
+ *      uint32_t            order[count]    entry offset in key order
+ *      entries                             key_length (1 byte),
+ *                                          value_length (2 bytes, LE),
+ *                                          key, '\0', value
+ *
+ * A key is hashed once, the bucket selects a displacement and the slot is
+ * (h1 + d0 * h2 + d1) % count (CHD, compress hash and displace). The key
+ * stored in the slot is compared to reject keys not in the table.
+ */
+
+/*===========================================================================*/
+/* Constants.                                                                */
+/*===========================================================================*/
+
+#define PHASH_MAGIC                         0x48534850  /* "PHSH" */
+#define PHASH_VERSION                       1
+
+#define PHASH_KEY_LENGTH_MAX                255
+#define PHASH_VALUE_LENGTH_MAX              0xFFFF
+#define PHASH_COUNT_MAX                     0xFFFF      /* d0 and d1 are 16 bits */
+
+#define PHASH_ENTRY_HEAD                    3
+
+/*===========================================================================*/
+/* Data structures and types.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Header of a table image, must be 4 byte aligned.
+ */
+typedef struct PHASH_S {
+    uint32_t            magic ;
+    uint16_t            version ;
+    uint16_t            flags ;
+    uint32_t            seed ;
+    uint32_t            count ;                 /**< @brief  keys, also the number of slots */
+    uint32_t            buckets ;
+    uint32_t            size ;                  /**< @brief  bytes in the image including the header */
+    uint32_t            table[] ;               /**< @brief  disp, slot and order */
+} PHASH_T ;
+
+/*===========================================================================*/
+/* Macros.                                                                   */
+/*===========================================================================*/
+
+#define PHASH_TABLE_SIZE(count, buckets)    (sizeof(PHASH_T) + ((buckets) + 2 * (count)) * sizeof(uint32_t))
+
+/**
+ * @brief   The key hash, shared by the lookup and the generator.
+ */
+static inline uint32_t
+phash_mix (uint32_t x)
+{
+    x ^= x >> 16 ;
+    x *= 0x85ebca6b ;
+    x ^= x >> 13 ;
+    x *= 0xc2b2ae35 ;
+    x ^= x >> 16 ;
+    return x ;
+}
+
+static inline void
+phash_hash (const void * key, uint32_t length, uint32_t seed, uint32_t h[3])
+{
+    const uint8_t * s = (const uint8_t *) key ;
+    uint32_t x = 2166136261u ^ seed ;
+
+    while (length--) {
+        x ^= *s++ ;
+        x *= 16777619u ;
+    }
+    h[0] = phash_mix (x) ;
+    h[1] = phash_mix (h[0] ^ seed) ;
+    h[2] = phash_mix (h[1] + 0x9e3779b9) ;
+}
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    int32_t         phash_check (const PHASH_T * table, uint32_t size) ;
+    uint32_t        phash_count (const PHASH_T * table) ;
+    int32_t         phash_lookup (const PHASH_T * table, const void * key, uint32_t length, const char ** value) ;
+    int32_t         phash_entry (const PHASH_T * table, uint32_t i, const char ** key, const char ** value) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PHASH_H__ */
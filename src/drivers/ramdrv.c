@@ -32,7 +32,8 @@
 #if !CFG_PLATFORM_SPIFLASH
 #define NVRAM_SIZE      (       \
         NVOL3_REGISTRY_SECTOR_SIZE*NVOL3_REGISTRY_SECTOR_COUNT + \
-        NVOL3_STRTAB_SECTOR_SIZE*NVOL3_STRTAB_SECTOR_COUNT \
+        NVOL3_STRTAB_SECTOR_SIZE*NVOL3_STRTAB_SECTOR_COUNT + \
+        NVOL3_REGINSTANCE_SECTOR_SIZE*NVOL3_REGINSTANCE_SECTOR_COUNT \
         )
 static uint8_t          _ramdrv_test[NVRAM_SIZE] PLATFORM_SECTION_NOINIT ;
 #endif
@@ -100,5 +101,14 @@ ramdrv_read (uint32_t addr, uint32_t len, uint8_t * data)
 
     return EOK ;
 }
+
+const uint8_t *
+ramdrv_map (uint32_t addr, uint32_t len)
+{
+    if (addr >= NVRAM_SIZE) return 0 ;
+    if (len > NVRAM_SIZE - addr) return 0 ;
+
+    return _ramdrv_test + addr ;
+}
 #endif
 
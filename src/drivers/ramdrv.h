@@ -47,6 +47,12 @@ extern "C" {
 	int32_t     ramdrv_read (uint32_t addr, uint32_t len, uint8_t * data) ;
 	int32_t     ramdrv_write (uint32_t addr, uint32_t len, const uint8_t * data) ;
 	int32_t     ramdrv_erase (uint32_t addr_start, uint32_t addr_end) ;
+#if !CFG_PLATFORM_SPIFLASH
+	const uint8_t * ramdrv_map (uint32_t addr, uint32_t len) ;
+#define RAMDRV_MAP  ramdrv_map
+#else
+#define RAMDRV_MAP  0           /* not memory mapped */
+#endif
 
 
 #ifdef __cplusplus
@@ -22,6 +22,7 @@
  */
 
 
+#include "system_config.h"
 #include <string.h>
 #include <common/debug.h>
 #include <common/errordef.h>
@@ -35,6 +36,13 @@
 
 #define NVOL3_INVALID_VAR_IDX     ((uint16_t)-1)
 
+/*
+ * Most records read with one FLASH read by nvol3_record_get_multi().
+ */
+#ifndef CFG_NVOL3_READ_COALESCE
+#define CFG_NVOL3_READ_COALESCE   8
+#endif
+
 /*===========================================================================*/
 /* Module macros.                                                            */
 /*===========================================================================*/
@@ -43,11 +51,47 @@
 #define FLASH_WRITE(flash, address, len, data)  flash.write (address, len, data)
 #define FLASH_ERASE(flash, start, end)          flash.erase (start, end)
 
+/*
+ * Lock free readers. A writer makes seq odd while it modifies the published
+ * lookup table and readers retry when seq changed during their lookup. Swaps
+ * build a new lookup table on the side and publish it together with the new
+ * sector. Replaced lookup tables and removed nodes are only released once
+ * all readers that could still see them have left (synchronize_readers).
+ */
+#define NVOL3_LOAD(var)                         __atomic_load_n (&(var), __ATOMIC_ACQUIRE)
+#define NVOL3_STORE(var, val)                   __atomic_store_n (&(var), (val), __ATOMIC_RELEASE)
+#define NVOL3_INC(var)                          __atomic_add_fetch (&(var), 1, __ATOMIC_SEQ_CST)
+#define NVOL3_DEC(var)                          __atomic_sub_fetch (&(var), 1, __ATOMIC_SEQ_CST)
+#define NVOL3_FENCE()                           __atomic_thread_fence (__ATOMIC_SEQ_CST)
+
+/*
+ * Readers wait for a writer in the middle of a lookup table update and a
+ * writer waits for the readers of a replaced table. The wait must let the
+ * other thread run, a busy spin livelocks a single core with priorities.
+ * Ports other than POSIX map CFG_NVOL3_YIELD() to the yield or a one tick
+ * delay of their OS, or to nothing when nvol3 is only used by one thread.
+ */
+#ifndef CFG_NVOL3_YIELD
+#if CFG_PORT_POSIX
+#include <sched.h>
+#define CFG_NVOL3_YIELD()                       sched_yield ()
+#else
+#error "CFG_NVOL3_YIELD() must be defined for this port"
+#endif
+#endif
+#define NVOL3_YIELD()                           CFG_NVOL3_YIELD ()
+
 /*===========================================================================*/
 /* Module data structures and types.                                         */
 /*===========================================================================*/
 
 #pragma pack(1)
+/* pending read of nvol3_record_get_multi() */
+typedef struct NVOL3_MULTI_READ_S {
+        uint16_t    idx ;
+        uint32_t    i ;
+} NVOL3_MULTI_READ_T;
+
 typedef struct NVOL3_SECTOR_RECORD_S {
         uint32_t    flags;               /* flags indicate sector status */
         uint32_t    reserved1 [2];
@@ -69,18 +113,27 @@ static int32_t          init_sectors (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_
 static int32_t          swap_sectors (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch) ;
 static NVOL3_ENTRY_T*   retrieve_lookup_table (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* value) ;
 static int32_t          move_sector ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch, uint32_t dst_addr) ;
-static int32_t          construct_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch) ;
-static int32_t          insert_lookup_table (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* rec, uint16_t idx) ;
+static int32_t          construct_lookup_table ( NVOL3_INSTANCE_T * instance, struct dictionary * dict, uint32_t sector, NVOL3_RECORD_T* scratch) ;
+static int32_t          rebuild_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch, uint32_t sector) ;
+static void             publish_lookup_table (NVOL3_INSTANCE_T * instance, struct dictionary * dict, uint32_t sector) ;
+static void             reclaim_lookup_table (NVOL3_INSTANCE_T * instance) ;
+static int32_t          insert_lookup_table (NVOL3_INSTANCE_T * instance, struct dictionary * dict, NVOL3_RECORD_T* rec, uint16_t idx) ;
 static int32_t          variable_record_valid (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T *rec) ;
 static int32_t          set_variable_record_flags (NVOL3_INSTANCE_T * instance, uint32_t sector_addr,  uint16_t flags, uint16_t idx ) ;
 static int32_t          write_variable_record (NVOL3_INSTANCE_T * instance,  uint32_t sector_addr,  NVOL3_RECORD_T *rec, uint16_t idx ) ;
+static int32_t          check_variable_record (const NVOL3_CONFIG_T * config, const NVOL3_RECORD_HEAD_T * head) ;
 static int32_t          read_variable_record (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T *rec, uint16_t idx, uint32_t bytes) ;
-static int32_t          read_variable_record_head (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_HEAD_T *head, uint16_t idx) ;
+static int32_t          read_variable_record_sector (NVOL3_INSTANCE_T * instance, uint32_t sector_addr, NVOL3_RECORD_T *rec, uint16_t idx, uint32_t bytes) ;
+#if TEST_ENTRY_WRITE
+static int32_t          read_variable_record_head_sector (NVOL3_INSTANCE_T * instance, uint32_t sector_addr, NVOL3_RECORD_HEAD_T *head, uint16_t idx) ;
+#endif
 static int32_t          erase_sector (const NVOL3_CONFIG_T * config, uint32_t sector_addr, uint32_t sector_size) ;
 static int32_t          set_sector_flags (const NVOL3_CONFIG_T * config, uint32_t sector_addr, uint32_t flags) ;
 static uint16_t         get_sector_version (const NVOL3_CONFIG_T * config, uint32_t sector_addr, uint32_t * flags) ;
 static int32_t          record_set (NVOL3_INSTANCE_T* instance, NVOL3_ENTRY_T* entry, NVOL3_RECORD_T *value, uint32_t key_and_data_length) ;
-static int32_t          record_get (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record, struct dlist * m) ;
+static int32_t          record_get (NVOL3_INSTANCE_T* instance, struct dictionary * dict, uint32_t sector, NVOL3_RECORD_T *record, struct dlist * m) ;
+static NVOL3_SNAPSHOT_T* snapshot_create (NVOL3_INSTANCE_T * instance, NVLOL3_IT_KEY_CMP_T cmp) ;
+static void             snapshot_release (NVOL3_SNAPSHOT_T * snapshot) ;
 
 
 /*===========================================================================*/
@@ -94,6 +147,191 @@ max_records (NVOL3_INSTANCE_T * instance) {
                     config->record_size) ;
 }
 
+/*
+ * The live bitmap marks the slots of the current sector that hold the
+ * current record of a key, so a sector can be compacted without reading the
+ * slots that were invalidated. Only writers use it. Without a bitmap (alloc
+ * failed) every slot counts as live.
+ */
+static inline void
+slot_set_live (NVOL3_INSTANCE_T * instance, uint32_t idx)
+{
+    if (instance->live) {
+        instance->live[idx >> 5] |= 1UL << (idx & 31) ;
+    }
+}
+
+static inline void
+slot_clear_live (NVOL3_INSTANCE_T * instance, uint32_t idx)
+{
+    if (instance->live) {
+        instance->live[idx >> 5] &= ~(1UL << (idx & 31)) ;
+    }
+}
+
+static void
+slot_reset_live (NVOL3_INSTANCE_T * instance, uint32_t count)
+{
+    uint32_t words = (max_records(instance) + 31) / 32 ;
+    uint32_t idx ;
+
+    if (!instance->live) {
+        instance->live = NVOL3_MALLOC (words * sizeof(uint32_t)) ;
+        if (!instance->live) return ;
+    }
+    memset (instance->live, 0, words * sizeof(uint32_t)) ;
+    for (idx = 0; idx < count; idx++) {
+        slot_set_live (instance, idx) ;
+    }
+}
+
+/*
+ * First live slot at or after idx, next_idx if there is none.
+ */
+static uint32_t
+slot_next_live (NVOL3_INSTANCE_T * instance, uint32_t idx)
+{
+    uint32_t word ;
+
+    if (!instance->live) return idx ;
+
+    while (idx < instance->next_idx) {
+        word = instance->live[idx >> 5] >> (idx & 31) ;
+        if (word) {
+            idx += __builtin_ctz (word) ;
+            break ;
+        }
+        idx = (idx | 31) + 1 ;
+    }
+
+    return idx < instance->next_idx ? idx : instance->next_idx ;
+}
+
+/*
+ * Index only lookup tables (config keyspec DICTIONARY_KEYSPEC_FINGERPRINT)
+ * keep a hash of the key and the slot. The key is read from the slot when
+ * hashes match, also by lock free readers.
+ */
+static inline int
+lookup_table_index_only (const NVOL3_CONFIG_T * config)
+{
+    return (config->keyspec >> 16) == DICTIONARY_KEYTYPE_FINGERPRINT ;
+}
+
+static const char*
+lookup_table_key_load (struct dictionary * dict, struct dlist * np,
+                        char * key, uintptr_t parm)
+{
+    NVOL3_INSTANCE_T * instance = (NVOL3_INSTANCE_T *) parm ;
+    const NVOL3_CONFIG_T * config = instance->config ;
+    NVOL3_ENTRY_T * entry = (NVOL3_ENTRY_T*)dictionary_get_value (dict, np) ;
+    uint16_t idx = entry->idx ;
+    uint32_t sector = (dict == NVOL3_LOAD (instance->dict)) ?
+            NVOL3_LOAD (instance->sector) : instance->build_sector ;
+
+    /* a lock free reader may see an entry that is being filled in */
+    if (idx >= max_records(instance)) return 0 ;
+
+    if (FLASH_READ (config->flash, sector + NVOL3_PAGE_SIZE +
+            config->record_size * idx + sizeof (NVOL3_RECORD_HEAD_T),
+            config->key_size, (uint8_t*)key) != EOK) {
+        return 0 ;
+    }
+
+    return key ;
+}
+
+/*
+ * Key of a lookup table node, for index only tables read to key
+ * (DICTIONARY_FINGERPRINT_WORDS_MAX words). Safe for lock free readers.
+ */
+static const char*
+lookup_table_key (NVOL3_INSTANCE_T * instance, struct dictionary * dict,
+                        struct dlist * m, char * key)
+{
+    const char * p = dictionary_load_key (dict, m, key) ;
+
+    if (!p) {
+        memset (key, 0, instance->config->key_size) ;
+        p = key ;
+    }
+
+    return p ;
+}
+
+/*
+ * A reader registers with the current epoch for the duration of its call.
+ * Re-checking the epoch after registering guarantees that a writer waiting
+ * on the other parity either sees the reader or the reader sees the new
+ * epoch.
+ */
+static inline uint32_t
+reader_enter (NVOL3_INSTANCE_T * instance)
+{
+    for (;;) {
+        uint32_t epoch = NVOL3_LOAD (instance->epoch) ;
+        NVOL3_INC (instance->readers[epoch & 1]) ;
+        if (NVOL3_LOAD (instance->epoch) == epoch) {
+            return epoch & 1 ;
+        }
+        NVOL3_DEC (instance->readers[epoch & 1]) ;
+    }
+}
+
+static inline void
+reader_exit (NVOL3_INSTANCE_T * instance, uint32_t slot)
+{
+    NVOL3_DEC (instance->readers[slot]) ;
+}
+
+static inline uint32_t
+read_begin (NVOL3_INSTANCE_T * instance)
+{
+    uint32_t seq ;
+
+    /* only short lookup table updates keep seq odd, never flash copies */
+    while ((seq = NVOL3_LOAD (instance->seq)) & 1) {
+        NVOL3_YIELD () ;
+    }
+
+    return seq ;
+}
+
+static inline int
+read_retry (NVOL3_INSTANCE_T * instance, uint32_t seq)
+{
+    NVOL3_FENCE () ;
+    return NVOL3_LOAD (instance->seq) != seq ;
+}
+
+static inline void
+write_begin (NVOL3_INSTANCE_T * instance)
+{
+    NVOL3_STORE (instance->seq, instance->seq + 1) ;
+    NVOL3_FENCE () ;
+}
+
+static inline void
+write_end (NVOL3_INSTANCE_T * instance)
+{
+    NVOL3_STORE (instance->seq, instance->seq + 1) ;
+}
+
+/*
+ * Wait until every reader that entered before this call has left.
+ */
+static void
+synchronize_readers (NVOL3_INSTANCE_T * instance)
+{
+    uint32_t epoch = instance->epoch ;
+
+    NVOL3_STORE (instance->epoch, epoch + 1) ;
+    NVOL3_FENCE () ;
+    while (NVOL3_LOAD (instance->readers[epoch & 1])) {
+        NVOL3_YIELD () ;
+    }
+}
+
 
 /**
  * @brief Loads the volume defined in the config of the instance parameter
@@ -113,28 +351,15 @@ nvol3_load (NVOL3_INSTANCE_T* instance)
     DBG_ASSERT_NVOL3 (config->record_size - sizeof (NVOL3_RECORD_HEAD_T) > 0,
             "nvol3_load param!") ;
 
-    instance->sector = 0 ;
     instance->next_idx = 0 ;
     instance->inuse = 0 ;
     instance->invalid = 0 ;
 
     if (scratch) {
 
-        if (instance->dict) {
-            dictionary_destroy (instance->dict) ;
-            instance->dict = 0 ;
-
-        }
-        instance->dict = dictionary_init(NVOL3_HEAP_SPACE, config->keyspec,
-                config->hashsize) ;
-
-
-        if (instance->dict) {
-            status = init_sectors (instance, scratch) ;
-
-        } else {
-            status = E_NOMEM ;
-        }
+        /* readers find nothing until init_sectors() published the table */
+        publish_lookup_table (instance, 0, 0) ;
+        status = init_sectors (instance, scratch) ;
 
         NVOL3_FREE (scratch) ;
 
@@ -210,8 +435,7 @@ int32_t
 nvol3_reset (NVOL3_INSTANCE_T* instance)
 {
     const NVOL3_CONFIG_T    *   config = instance->config ;
-    if (instance->dict) dictionary_destroy (instance->dict) ;
-    instance->dict = 0 ;
+    publish_lookup_table (instance, 0, 0) ;
 
     erase_sector(config, config->sector1_addr, config->sector_size) ;
     erase_sector(config, config->sector2_addr, config->sector_size) ;
@@ -249,12 +473,11 @@ int32_t
 nvol3_delete (NVOL3_INSTANCE_T* instance)
 {
     const NVOL3_CONFIG_T    *   config = instance->config ;
+    publish_lookup_table (instance, 0, 0) ;
+
     erase_sector(config, config->sector1_addr, config->sector_size) ;
     erase_sector(config, config->sector2_addr, config->sector_size) ;
 
-    if (instance->dict) dictionary_destroy (instance->dict) ;
-    instance->dict = 0 ;
-
     return EOK ;
 }
 
@@ -301,11 +524,11 @@ nvol3_repair (NVOL3_INSTANCE_T* instance)
             break ;
         }
 
-        /* now using destination sector */
-        instance->sector = dst_addr ;
-
-        /* regenerate lookup table */
-        construct_lookup_table(instance, scratch);
+        /* now using destination sector with a regenerated lookup table */
+        if (rebuild_lookup_table (instance, scratch, dst_addr) == E_NOMEM) {
+            status = E_NOMEM ;
+            break ;
+        }
 
         /* erase source sector */
         if ((status = erase_sector(config, src_addr, config->sector_size)) != EOK) {
@@ -323,6 +546,20 @@ nvol3_repair (NVOL3_INSTANCE_T* instance)
     return status ;
 }
 
+/**
+ * @brief Add a Bloom filter to the lookup table
+ * @note    Lookups for keys not in the volume then mostly fail without
+ *          walking the lookup table or reading FLASH. Bits of deleted keys
+ *          are dropped at every swap. Takes effect at the next load.
+ * @param[in] instance
+ * @param[in] bits      filter size in bits, 0 for no filter
+ */
+void
+nvol3_set_filter (NVOL3_INSTANCE_T* instance, uint32_t bits)
+{
+    instance->filter_bits = bits ;
+}
+
 /**
  * @brief Unload the volume and free all memory
  * @param[in] instance
@@ -331,8 +568,11 @@ void
 nvol3_unload (NVOL3_INSTANCE_T* instance)
 {
 
-    if (instance->dict) dictionary_destroy (instance->dict) ;
-    instance->dict = 0 ;
+    publish_lookup_table (instance, 0, 0) ;
+    if (instance->live) {
+        NVOL3_FREE (instance->live) ;
+        instance->live = 0 ;
+    }
 
     return  ;
 }
@@ -395,12 +635,75 @@ nvol3_record_set (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value,
 int32_t
 nvol3_record_get (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record)
 {
-    //const NVOL3_CONFIG_T    *   config = instance->config ;
-    //uint16_t idx = NVOL3_INVALID_VAR_IDX;
+    const NVOL3_CONFIG_T    *   config = instance->config ;
+    struct dictionary * dict ;
+    struct dlist * m ;
+    int32_t status ;
+    uint32_t seq ;
+    uint32_t key[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
+    uint32_t slot = reader_enter (instance) ;
 
-    struct dlist * m = dictionary_get (instance->dict,
-            (const char*)record->key_and_data) ;
-    return record_get (instance, record, m) ;
+    /* an index only table can not give the key back, keep a copy */
+    if (lookup_table_index_only (config)) {
+        memcpy (key, record->key_and_data, config->key_size) ;
+    }
+
+    for (;;) {
+        seq = read_begin (instance) ;
+        dict = NVOL3_LOAD (instance->dict) ;
+        m = dict ? dictionary_get_concurrent (dict,
+                (const char*)record->key_and_data) : 0 ;
+        status = record_get (instance, dict, NVOL3_LOAD (instance->sector),
+                record, m) ;
+        if (!read_retry (instance, seq)) break ;
+
+        /* reading a stale slot may have replaced the key, restore it */
+        if (lookup_table_index_only (config)) {
+            memcpy (record->key_and_data, key, config->key_size) ;
+        } else if (m) {
+            memcpy (record->key_and_data, dictionary_get_key (dict, m),
+                    config->key_size) ;
+        }
+    }
+
+    reader_exit (instance, slot) ;
+
+    return status ;
+}
+
+/**
+ * @brief Read a record for a key and its hash computed ahead of time.
+ * @notes   The hash is the full dictionary hash of the key, see
+ *          dictionary_hash(). key must be config->key_size bytes.
+ * @param[in] instance
+ * @param[in] key
+ * @param[in] hash
+ * @param[out] record
+ * @return              Length of the record
+ * @retval E_NOTFOUND   Not a record.
+ */
+int32_t
+nvol3_record_get_hashed (NVOL3_INSTANCE_T* instance, const char * key,
+                    uint32_t hash, NVOL3_RECORD_T *record)
+{
+    struct dictionary * dict ;
+    struct dlist * m ;
+    int32_t status ;
+    uint32_t seq ;
+    uint32_t slot = reader_enter (instance) ;
+
+    do {
+        seq = read_begin (instance) ;
+        dict = NVOL3_LOAD (instance->dict) ;
+        m = dict ? dictionary_get_concurrent_hashed (dict, key, hash) : 0 ;
+        status = record_get (instance, dict, NVOL3_LOAD (instance->sector),
+                record, m) ;
+
+    } while (read_retry (instance, seq)) ;
+
+    reader_exit (instance, slot) ;
+
+    return status ;
 }
 
 /**
@@ -429,12 +732,18 @@ nvol3_record_delete (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record)
         NVOL3_ENTRY_T* entry =
                 (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, m) ;
         uint16_t idx = entry->idx ;
+        write_begin (instance) ;
         set_variable_record_flags (instance,  instance->sector,
                 NVOL3_RECORD_FLAGS_INVALID, idx ) ;
+        slot_clear_live (instance, idx) ;
         instance->inuse-- ;
         instance->invalid++ ;
 
         dictionary_remove(instance->dict, (const char*)record->key_and_data) ;
+        instance->generation++ ;
+        instance->node_generation++ ;
+        write_end (instance) ;
+        reclaim_lookup_table (instance) ;
 
         return EOK ;
     }
@@ -452,23 +761,57 @@ nvol3_record_delete (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record)
 int32_t
 nvol3_record_key_and_data_length (NVOL3_INSTANCE_T* instance, const char * key)
 {
-    //const NVOL3_CONFIG_T    *   config = instance->config ;
-    NVOL3_RECORD_HEAD_T head ;
+    NVOL3_RECORD_INFO_T info ;
 
-    struct dlist * m = dictionary_get (instance->dict, key) ;
-      if (m) {
-          //NVOL3_ENTRY_T* entry = (NVOL3_ENTRY_T*) m->value ;
-          NVOL3_ENTRY_T* entry =
-                  (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, m) ;
+    if (nvol3_record_info (instance, key, &info) != EOK) {
+        return EFAIL ;
+    }
 
-          if (read_variable_record_head (instance, &head, entry->idx) == EOK) {
-              return head.length ;
+    return info.length + instance->config->key_size ;
+}
 
-          }
+/**
+ * @brief Return the metadata of a record from the lookup table.
+ * @param[in] instance
+ * @param[in] key
+ * @param[out] info
+ * @return
+ * @retval EOK          Record exist.
+ * @retval E_NOTFOUND   Not a record.
+ */
+int32_t
+nvol3_record_info (NVOL3_INSTANCE_T* instance, const char * key,
+                    NVOL3_RECORD_INFO_T * info)
+{
+    struct dictionary * dict ;
+    struct dlist * m ;
+    int32_t status ;
+    uint32_t seq ;
+    uint32_t slot = reader_enter (instance) ;
 
-      }
+    do {
+        seq = read_begin (instance) ;
+        dict = NVOL3_LOAD (instance->dict) ;
+        status = E_NOTFOUND ;
+        m = dict ? dictionary_get_concurrent (dict, key) : 0 ;
+        if (m) {
+            NVOL3_ENTRY_T* entry =
+                    (NVOL3_ENTRY_T*)dictionary_get_value(dict, m) ;
+            uint16_t next_idx = NVOL3_LOAD (instance->next_idx) ;
 
-      return EFAIL ;
+            info->length = entry->length ;
+            info->checksum = entry->checksum ;
+            info->idx = entry->idx ;
+            info->age = (next_idx > info->idx) ? next_idx - info->idx - 1 : 0 ;
+            status = EOK ;
+
+        }
+
+    } while (read_retry (instance, seq)) ;
+
+    reader_exit (instance, slot) ;
+
+    return status ;
 }
 
 /**
@@ -482,20 +825,337 @@ nvol3_record_key_and_data_length (NVOL3_INSTANCE_T* instance, const char * key)
 int32_t
 nvol3_record_status (NVOL3_INSTANCE_T* instance, const char * key)
 {
-    //const NVOL3_CONFIG_T    *   config = instance->config ;
-    struct dlist * m = dictionary_get (instance->dict, key) ;
+    struct dictionary * dict ;
+    struct dlist * m ;
+    uint32_t seq ;
+    uint32_t slot = reader_enter (instance) ;
+
+    do {
+        seq = read_begin (instance) ;
+        dict = NVOL3_LOAD (instance->dict) ;
+        m = dict ? dictionary_get_concurrent (dict, key) : 0 ;
+
+    } while (read_retry (instance, seq)) ;
+
+    reader_exit (instance, slot) ;
+
+    return m ? EOK : E_NOTFOUND ;
+}
+
+/**
+ * @brief Resolve key to a handle for nvol3_handle_get() and nvol3_handle_set().
+ * @param[in] instance
+ * @param[in] key
+ * @param[out] handle
+ * @return
+ * @retval EOK          Record exist.
+ * @retval E_NOTFOUND   Not a record, the handle is still usable to set it.
+ */
+int32_t
+nvol3_handle_resolve (NVOL3_INSTANCE_T* instance, const char * key,
+                        NVOL3_HANDLE_T * handle)
+{
+    struct dictionary * dict ;
+    struct dlist * m ;
+    uint32_t generation ;
+    uint32_t seq ;
+    uint32_t slot = reader_enter (instance) ;
+
+    do {
+        seq = read_begin (instance) ;
+        generation = NVOL3_LOAD (instance->node_generation) ;
+        dict = NVOL3_LOAD (instance->dict) ;
+        m = dict ? dictionary_get_concurrent (dict, key) : 0 ;
+
+    } while (read_retry (instance, seq)) ;
+
+    reader_exit (instance, slot) ;
+
+    handle->np = m ;
+    handle->generation = generation ;
 
     return m ? EOK : E_NOTFOUND ;
 }
 
+/**
+ * @brief Read the record of a resolved handle.
+ * @param[in] instance
+ * @param[in] handle
+ * @param[out] record
+ * @return              Length of the record
+ * @retval E_INVALID    The handle has to be resolved again.
+ */
+int32_t
+nvol3_handle_get (NVOL3_INSTANCE_T* instance, const NVOL3_HANDLE_T * handle,
+                    NVOL3_RECORD_T *record)
+{
+    int32_t status ;
+    uint32_t seq ;
+    uint32_t slot = reader_enter (instance) ;
+
+    do {
+        seq = read_begin (instance) ;
+        if (!handle->np || (handle->generation !=
+                NVOL3_LOAD (instance->node_generation))) {
+            status = E_INVALID ;
+
+        } else {
+            status = record_get (instance, NVOL3_LOAD (instance->dict),
+                    NVOL3_LOAD (instance->sector), record, handle->np) ;
+
+        }
+
+    } while (read_retry (instance, seq)) ;
+
+    reader_exit (instance, slot) ;
+
+    return status ;
+}
+
+/**
+ * @brief Write the record of a handle, the handle is resolved again if the
+ *          write changed the lookup table.
+ * @param[in] instance
+ * @param[in] handle
+ * @param[in] value
+ * @param[in] key_and_data_length
+ * @return
+ * @retval EOK          success.
+ * @retval EFAIL        read or write to FLASH failed.
+ * @retval E_NOMEM       alloc failed.
+ */
+int32_t
+nvol3_handle_set (NVOL3_INSTANCE_T* instance, NVOL3_HANDLE_T * handle,
+                    NVOL3_RECORD_T *value, uint32_t key_and_data_length)
+{
+    int32_t status ;
+
+    if (!handle->np || (handle->generation != instance->node_generation) ||
+            (instance->next_idx >= max_records(instance))) {
+        status = nvol3_record_set (instance, value, key_and_data_length) ;
+        if (status == EOK) {
+            nvol3_handle_resolve (instance,
+                    (const char*)value->key_and_data, handle) ;
+        }
+
+        return status ;
+    }
+
+    return record_set (instance,
+            (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, handle->np),
+            value, key_and_data_length) ;
+}
+
+/*
+ * Pass the data of the entry m to cb, from the local cache, the record in
+ * place in memory mapped FLASH or else read to *scratch (allocated on first
+ * use, freed by the caller).
+ */
+static int32_t
+record_visit (NVOL3_INSTANCE_T* instance, struct dlist * m,
+                NVOL3_RECORD_T ** scratch, NVLOL3_VISIT_T cb, uintptr_t ctx)
+{
+    const NVOL3_CONFIG_T    *   config = instance->config ;
+    struct dictionary * dict = instance->dict ;
+    NVOL3_ENTRY_T* entry = (NVOL3_ENTRY_T*)dictionary_get_value(dict, m) ;
+    const NVOL3_RECORD_T * rec = 0 ;
+    int32_t status ;
+
+    if (entry->length <= config->local_size) {
+        uint32_t key[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
+        return cb (lookup_table_key (instance, dict, m, (char*)key),
+                entry->local, entry->length, ctx) ;
+    }
+
+    if (config->flash.map) {
+        rec = (const NVOL3_RECORD_T *) config->flash.map (instance->sector +
+                NVOL3_PAGE_SIZE + config->record_size * entry->idx,
+                config->record_size) ;
+        if (rec && ((rec->head.flags != NVOL3_RECORD_FLAGS_VALID) ||
+                (rec->head.length != entry->length + config->key_size))) {
+            return E_UNKNOWN ;
+        }
+    }
+
+    if (!rec) {
+        if (!*scratch && !(*scratch = NVOL3_MALLOC (config->record_size))) {
+            return E_NOMEM ;
+        }
+        status = read_variable_record (instance, *scratch, entry->idx, 0) ;
+        if (status != EOK) {
+            return status ;
+        }
+        rec = *scratch ;
+    }
+
+    return cb ((const char*)rec->key_and_data,
+            &rec->key_and_data[config->key_size],
+            rec->head.length - config->key_size, ctx) ;
+}
+
+/**
+ * @brief Pass the data of a record to a callback without copying it.
+ * @param[in] instance
+ * @param[in] key
+ * @param[in] cb
+ * @param[in] ctx
+ * @return              status returned by cb
+ * @retval E_NOTFOUND   Not a record.
+ */
+int32_t
+nvol3_record_visit (NVOL3_INSTANCE_T* instance, const char * key,
+                    NVLOL3_VISIT_T cb, uintptr_t ctx)
+{
+    NVOL3_RECORD_T * scratch = 0 ;
+    struct dlist * m ;
+    int32_t status = E_NOTFOUND ;
+
+    m = instance->dict ? dictionary_get (instance->dict, key) : 0 ;
+    if (m) {
+        status = record_visit (instance, m, &scratch, cb, ctx) ;
+    }
+    if (scratch) {
+        NVOL3_FREE (scratch) ;
+    }
+
+    return status ;
+}
+
+/**
+ * @brief Pass the data of every record to a callback without copying it.
+ * @param[in] instance
+ * @param[in] cb
+ * @param[in] ctx
+ * @return              EOK or the first status other than EOK returned by cb
+ */
+int32_t
+nvol3_record_foreach (NVOL3_INSTANCE_T* instance, NVLOL3_VISIT_T cb,
+                    uintptr_t ctx)
+{
+    NVOL3_RECORD_T * scratch = 0 ;
+    struct dictionary_it it ;
+    struct dlist * m ;
+    int32_t status = EOK ;
+
+    if (!instance->dict) {
+        return EOK ;
+    }
+    for (m = dictionary_it_first (instance->dict, &it, 0, 0) ;
+            m && (status == EOK) ;
+            m = dictionary_it_next (instance->dict, &it)) {
+        status = record_visit (instance, m, &scratch, cb, ctx) ;
+    }
+    if (scratch) {
+        NVOL3_FREE (scratch) ;
+    }
+
+    return status ;
+}
+
+/**
+ * @brief Get the data of many records with as few FLASH reads as possible.
+ * @notes   The records not in the local cache are read in slot order,
+ *          adjacent slots (up to CFG_NVOL3_READ_COALESCE) with one read.
+ *          The data passed to cb is only valid during the call.
+ * @param[in] instance
+ * @param[in] keys
+ * @param[in] count
+ * @param[in] cb        called with the data length or < 0 (status) of each key
+ * @param[in] ctx
+ * @return              EOK or E_NOMEM
+ */
+int32_t
+nvol3_record_get_multi (NVOL3_INSTANCE_T* instance, const char * const * keys,
+                    uint32_t count, NVLOL3_MULTI_GET_T cb, uintptr_t ctx)
+{
+    const NVOL3_CONFIG_T    *   config = instance->config ;
+    struct dictionary * dict = instance->dict ;
+    NVOL3_MULTI_READ_T * pending ;
+    uint8_t * buffer ;
+    uint32_t i, j, k, n = 0 ;
+    int32_t status ;
+
+    if (!count) {
+        return EOK ;
+    }
+    pending = NVOL3_MALLOC (count * sizeof (NVOL3_MULTI_READ_T) +
+                CFG_NVOL3_READ_COALESCE * config->record_size) ;
+    if (!pending) {
+        return E_NOMEM ;
+    }
+    buffer = (uint8_t*)&pending[count] ;
+
+    for (i = 0 ; i < count ; i++) {
+        struct dlist * m = dict ? dictionary_get (dict, keys[i]) : 0 ;
+        NVOL3_ENTRY_T* entry ;
+
+        if (!m) {
+            cb (i, 0, E_NOTFOUND, ctx) ;
+            continue ;
+        }
+        entry = (NVOL3_ENTRY_T*)dictionary_get_value(dict, m) ;
+        if (entry->length <= config->local_size) {
+            cb (i, entry->local, entry->length, ctx) ;
+            continue ;
+        }
+        /* insertion sort on the slot, count is small */
+        for (j = n ; j && (pending[j-1].idx > entry->idx) ; j--) {
+            pending[j] = pending[j-1] ;
+        }
+        pending[j].idx = entry->idx ;
+        pending[j].i = i ;
+        n++ ;
+    }
+
+    for (j = 0 ; j < n ; j = k) {
+        uint16_t first = pending[j].idx ;
+
+        for (k = j + 1 ; (k < n) &&
+                (pending[k].idx - first < CFG_NVOL3_READ_COALESCE) &&
+                (pending[k].idx <= pending[k-1].idx + 1) ; k++) ;
+
+        status = FLASH_READ (config->flash, instance->sector +
+                NVOL3_PAGE_SIZE + config->record_size * first,
+                config->record_size * (pending[k-1].idx - first + 1),
+                buffer) ;
+
+        for (i = j ; i < k ; i++) {
+            const NVOL3_RECORD_T * rec = (const NVOL3_RECORD_T *)
+                    &buffer[config->record_size * (pending[i].idx - first)] ;
+            int32_t res = status ;
+
+            if (res == EOK) {
+                res = check_variable_record (config, &rec->head) ;
+            }
+            if ((res == EOK) && (rec->head.length < config->key_size)) {
+                res = E_UNKNOWN ;
+            }
+            if (res == EOK) {
+                cb (pending[i].i, &rec->key_and_data[config->key_size],
+                        rec->head.length - config->key_size, ctx) ;
+            } else {
+                cb (pending[i].i, 0, res, ctx) ;
+            }
+        }
+    }
+
+    NVOL3_FREE (pending) ;
+
+    return EOK ;
+}
+
 static int
 nvol3_cmp (struct dictionary *  dict, uintptr_t parm, struct dlist *  first ,
         struct dlist *  second )
 {
     NVLOL3_IT_KEY_CMP_T cmp = (NVLOL3_IT_KEY_CMP_T) parm ;
+    uint32_t key1[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
+    uint32_t key2[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
     if (cmp) {
-        return cmp (dictionary_get_key(dict, first),
-                dictionary_get_key(dict, second)) ;
+        const char * k1 = dictionary_load_key (dict, first, (char*)key1) ;
+        const char * k2 = dictionary_load_key (dict, second, (char*)key2) ;
+        if (!k1 || !k2) return 0 ;
+        return cmp (k1, k2) ;
     }
 
     return 0 ;
@@ -519,7 +1179,8 @@ nvol3_record_first (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value,
     m = dictionary_it_first (instance->dict, &it->it, cmp ? nvol3_cmp : 0,
             (uintptr_t)cmp) ;
     if (m) {
-        int32_t status = record_get (instance, value, m) ;
+        int32_t status = record_get (instance, instance->dict,
+                instance->sector, value, m) ;
         if (status < 0) {
             DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_REPORT,
                     "NVOL3 : : get record for %s not in lookup table!",
@@ -548,7 +1209,8 @@ nvol3_record_next (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value,
 {
     struct dlist * m = dictionary_it_next (instance->dict, &it->it) ;
     if (m) {
-        int32_t status = record_get (instance, value, m) ;
+        int32_t status = record_get (instance, instance->dict,
+                instance->sector, value, m) ;
         if (status < 0) {
             DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_REPORT,
                     "NVOL3 : : get record for %s not in lookup table!",
@@ -561,6 +1223,90 @@ nvol3_record_next (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value,
     return E_EOF ;
 }
 
+/**
+ * @brief Open an iterator on a snapshot of the keys in the volume.
+ * @note  The snapshot is shared with other iterators and reused until a key
+ *        is added or removed. Must be serialised with writers.
+ * @param[in] instance
+ * @param[out] it
+ * @param[in] cmp       sort order of the keys, 0 for lookup table order
+ * @return
+ * @retval EOK          Snapshot opened.
+ * @retval E_UNEXP      Volume not loaded.
+ * @retval E_NOMEM      alloc failed.
+ */
+int32_t
+nvol3_snapshot_open (NVOL3_INSTANCE_T* instance, NVOL3_ITERATOR_T * it,
+                    NVLOL3_IT_KEY_CMP_T cmp)
+{
+    NVOL3_SNAPSHOT_T * snapshot = instance->snapshot ;
+
+    it->snapshot = 0 ;
+    it->pos = 0 ;
+    if (!instance->dict) return E_UNEXP ;
+
+    if (!snapshot || (snapshot->generation != instance->generation) ||
+            (snapshot->cmp != cmp)) {
+        snapshot = snapshot_create (instance, cmp) ;
+        if (!snapshot) return E_NOMEM ;
+        if (instance->snapshot) snapshot_release (instance->snapshot) ;
+        instance->snapshot = snapshot ;
+
+    }
+
+    NVOL3_INC (snapshot->refs) ;
+    it->snapshot = snapshot ;
+
+    return EOK ;
+}
+
+/**
+ * @brief Return the next record of the snapshot that still exists.
+ * @note  Lock free, keys deleted after the snapshot was taken are skipped.
+ * @param[in] instance
+ * @param[out] value
+ * @param[in/out] it
+ * @return              Length of the record
+ * @retval E_EOF        No more records.
+ */
+int32_t
+nvol3_snapshot_next (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value,
+                    NVOL3_ITERATOR_T * it)
+{
+    const NVOL3_CONFIG_T    *   config = instance->config ;
+    NVOL3_SNAPSHOT_T * snapshot = it->snapshot ;
+    int32_t status ;
+
+    if (!snapshot) return E_EOF ;
+
+    while (it->pos < snapshot->count) {
+        memcpy (value->key_and_data, snapshot->keys[it->pos++],
+                config->key_size) ;
+        status = nvol3_record_get (instance, value) ;
+        if (status != E_NOTFOUND) {
+            return status ;
+        }
+
+    }
+
+    return E_EOF ;
+}
+
+/**
+ * @brief Release the snapshot of the iterator. Can be called more than once.
+ * @param[in] instance
+ * @param[in/out] it
+ */
+void
+nvol3_snapshot_close (NVOL3_INSTANCE_T* instance, NVOL3_ITERATOR_T * it)
+{
+    if (it->snapshot) {
+        snapshot_release (it->snapshot) ;
+        it->snapshot = 0 ;
+
+    }
+}
+
 
 /**
  * @brief Initialize the iterator and return the first record in the volume.
@@ -725,8 +1471,10 @@ nvol3_entry_delete (NVOL3_INSTANCE_T* instance, NVOL3_ITERATOR_T * it)
             (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, it->it.np) ;
 
     uint16_t idx = entry->idx ;
+    write_begin (instance) ;
     status = set_variable_record_flags (instance,  instance->sector,
             NVOL3_RECORD_FLAGS_INVALID, idx ) ;
+    slot_clear_live (instance, idx) ;
     instance->inuse-- ;
     instance->invalid++ ;
 
@@ -734,6 +1482,10 @@ nvol3_entry_delete (NVOL3_INSTANCE_T* instance, NVOL3_ITERATOR_T * it)
             dictionary_get_key (instance->dict, it->it.np)) == 0) {
         status = E_NOTFOUND ;
     }
+    instance->generation++ ;
+    instance->node_generation++ ;
+    write_end (instance) ;
+    reclaim_lookup_table (instance) ;
 
     return status ;
 
@@ -748,6 +1500,23 @@ nvol3_callback_tallie (struct NVOL3_INSTANCE_S * inst,
     return EOK ;
 }
 
+/**
+ * @brief Slot usage of the current sector.
+ * @notes   Computed from counters kept up to date by every write, the ratio
+ *          of live to invalid slots tells how much a swap would reclaim.
+ * @param[in] instance
+ * @param[out] stats
+ */
+void
+nvol3_stats (NVOL3_INSTANCE_T* instance, NVOL3_STATS_T * stats)
+{
+    stats->records = max_records(instance) ;
+    stats->live = instance->inuse ;
+    stats->invalid = instance->invalid ;
+    stats->empty = stats->records - instance->next_idx ;
+    stats->error = instance->error ;
+}
+
 void
 nvol3_entry_log_status (NVOL3_INSTANCE_T* instance, uint32_t verbose)
 {
@@ -789,23 +1558,15 @@ nvol3_entry_log_status (NVOL3_INSTANCE_T* instance, uint32_t verbose)
                 "        : %d error",
                 instance->error) ;
 
-        struct dictionary_it it ;
-        struct dlist* m = dictionary_it_first (instance->dict, &it, 0, 0) ;
-        unsigned int bytes = 0 ;
-        while (m) {
-            NVOL3_ENTRY_T* entry =
-                      (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, m) ;
-            bytes += sizeof(uint16_t) * 2 ;
-            if (entry->length <= config->local_size) bytes += entry->length ;
-
-            bytes += sizeof(struct dlist *) ;
-            if (!(instance->config->keyspec&0xFFFF)) bytes += sizeof (uintptr_t) ;
-            bytes += dictionary_get_key_size (instance->dict, m) ;
-            m = dictionary_it_next (instance->dict, &it) ;
+        DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_REPORT,
+                "        : %d lookup table slab bytes",
+                dictionary_slab_bytes (instance->dict)) ;
 
-        }
+        HEAP_STATS_T stats ;
+        heap_space_stats (NVOL3_HEAP_SPACE, &stats) ;
         DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_REPORT,
-                "        : %d lookup table bytes", bytes) ;
+                "        : %d heap used, %d peak, %d size, %d failures",
+                stats.used, stats.peak, stats.size, stats.failures) ;
 
         unsigned int s = dictionary_hashtab_size (instance->dict) ;
         unsigned int i ;
@@ -966,6 +1727,11 @@ record_set (NVOL3_INSTANCE_T* instance, NVOL3_ENTRY_T* entry,
       }
       instance->inuse++ ;
 
+      // point the lookup table to the new record before the previous one
+      // is invalidated, readers retry until both are done
+      write_begin (instance) ;
+      status = insert_lookup_table(instance, instance->dict, value,
+              instance->next_idx-1 ) ;
 
       if (idx != NVOL3_INVALID_VAR_IDX) {
            // mark previous record as invalid
@@ -975,10 +1741,10 @@ record_set (NVOL3_INSTANCE_T* instance, NVOL3_ENTRY_T* entry,
            instance->invalid++ ;
 
        }
+      write_end (instance) ;
+      reclaim_lookup_table (instance) ;
 
-      // get offset of next free location
-      if ((status = insert_lookup_table(instance, value, instance->next_idx-1 ))
-              != EOK) {
+      if (status != EOK) {
           DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_ERROR,
                   "nvol :E: '%s' failed insert %d", config->name, status) ;
 
@@ -990,8 +1756,8 @@ record_set (NVOL3_INSTANCE_T* instance, NVOL3_ENTRY_T* entry,
 }
 
 static int32_t
-record_get (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record,
-                struct dlist * m)
+record_get (NVOL3_INSTANCE_T* instance, struct dictionary * dict,
+                uint32_t sector, NVOL3_RECORD_T *record, struct dlist * m)
 {
     const NVOL3_CONFIG_T    *   config = instance->config ;
     uint16_t idx = NVOL3_INVALID_VAR_IDX;
@@ -1001,15 +1767,20 @@ record_get (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record,
     memset (&record->head, 0, sizeof (NVOL3_RECORD_HEAD_T)) ;
     if (m) {
         NVOL3_ENTRY_T* entry =
-                (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, m) ;
-        if (entry->length <= config->local_size) {
+                (NVOL3_ENTRY_T*)dictionary_get_value(dict, m) ;
+        uint16_t length = entry->length ;
+        if (length <= config->local_size) {
+            uint32_t key[DICTIONARY_FINGERPRINT_WORDS_MAX] ;
             memcpy (record->key_and_data,
-                    dictionary_get_key (instance->dict, m), config->key_size) ;
+                    lookup_table_key (instance, dict, m, (char*)key),
+                    config->key_size) ;
             memcpy (&record->key_and_data[config->key_size],
-                    entry->local, entry->length) ;
-            return entry->length + config->key_size;
+                    entry->local, length) ;
+            return length + config->key_size;
         }
         idx = entry->idx ;
+        /* a lock free reader may see an entry that is being filled in */
+        if (idx >= max_records(instance)) idx = NVOL3_INVALID_VAR_IDX ;
 
     }
 
@@ -1021,7 +1792,7 @@ record_get (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record,
     }
 
     // get variable record
-    status = read_variable_record (instance, record, idx, 0) ;
+    status = read_variable_record_sector (instance, sector, record, idx, 0) ;
 
     if (status < 0) return status ;
     return record->head.length ;
@@ -1086,6 +1857,7 @@ erase_sector (const NVOL3_CONFIG_T * config, uint32_t sector_addr,
 }
 
 
+#if TEST_ENTRY_WRITE
 static int32_t
 read_variable_record_head_sector (NVOL3_INSTANCE_T * instance,
                 uint32_t sector_addr, NVOL3_RECORD_HEAD_T *head, uint16_t idx)
@@ -1119,18 +1891,38 @@ read_variable_record_head_sector (NVOL3_INSTANCE_T * instance,
 
     return EOK ;
 }
+#endif
 
 static int32_t
-read_variable_record_head (NVOL3_INSTANCE_T * instance,
-                            NVOL3_RECORD_HEAD_T *head, uint16_t idx)
+read_variable_record (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T *rec,
+                        uint16_t idx, uint32_t bytes)
 {
-    return read_variable_record_head_sector (instance, instance->sector,
-                                head, idx) ;
+    return read_variable_record_sector (instance, instance->sector, rec,
+                                idx, bytes) ;
 }
 
 static int32_t
-read_variable_record (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T *rec,
-                        uint16_t idx, uint32_t bytes)
+check_variable_record (const NVOL3_CONFIG_T * config,
+                        const NVOL3_RECORD_HEAD_T * head)
+{
+    if (head->flags == NVOL3_RECORD_FLAGS_EMPTY) {
+        return E_EMPTY ;
+    }
+    if (head->flags != NVOL3_RECORD_FLAGS_VALID) {
+        return head->flags == NVOL3_RECORD_FLAGS_INVALID ?
+                                    E_INVALID : E_UNKNOWN ;
+    }
+    if ((head->length >
+            (config->record_size - sizeof (NVOL3_RECORD_HEAD_T))) ) {
+        return E_UNKNOWN ;
+    }
+
+    return EOK ;
+}
+
+static int32_t
+read_variable_record_sector (NVOL3_INSTANCE_T * instance, uint32_t sector_addr,
+                        NVOL3_RECORD_T *rec, uint16_t idx, uint32_t bytes)
 {
     int32_t status = EFAIL ;
     uint32_t offset ;
@@ -1140,29 +1932,22 @@ read_variable_record (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T *rec,
                 "NVOL3 :E: read_variable_record idx %d", idx) ;
 
     offset = NVOL3_PAGE_SIZE + config->record_size * idx ;
-    status = FLASH_READ (config->flash, instance->sector + offset,
+    status = FLASH_READ (config->flash, sector_addr + offset,
                     sizeof (NVOL3_RECORD_HEAD_T), (uint8_t*)rec) ;
     if (status != EOK) {
           DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_ERROR,
                   "NVOL3 :E: read_variable_record read %d!", status) ;
           return status;
     }
-    if (rec->head.flags == NVOL3_RECORD_FLAGS_EMPTY) {
-        return E_EMPTY ;
-    }
-    if (rec->head.flags != NVOL3_RECORD_FLAGS_VALID) {
-        return rec->head.flags == NVOL3_RECORD_FLAGS_INVALID ?
-                                    E_INVALID : E_UNKNOWN ;
-    }
-    if ((rec->head.length >
-            (config->record_size - sizeof (NVOL3_RECORD_HEAD_T))) ) {
-        return E_UNKNOWN ;
+    status = check_variable_record (config, &rec->head) ;
+    if (status != EOK) {
+        return status ;
     }
     if (rec->head.length) {
         offset += sizeof (NVOL3_RECORD_HEAD_T) ;
         if (bytes == 0) bytes = rec->head.length ;
         else if (bytes > rec->head.length) bytes = rec->head.length ;
-        status = FLASH_READ (config->flash, instance->sector + offset, bytes,
+        status = FLASH_READ (config->flash, sector_addr + offset, bytes,
                         (uint8_t*)rec->key_and_data) ;
     }
 
@@ -1230,23 +2015,39 @@ variable_record_valid (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T *rec)
 
 
 static int32_t
-insert_lookup_table (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* rec,
-                        uint16_t idx)
+insert_lookup_table (NVOL3_INSTANCE_T * instance, struct dictionary * dict,
+                        NVOL3_RECORD_T* rec, uint16_t idx)
 {
     const NVOL3_CONFIG_T    *   config = instance->config ;
     struct dlist * m ;
+    unsigned int count = dictionary_count (dict) ;
     unsigned int localsize = rec->head.length - config->key_size ;
     if (localsize > config->local_size) localsize = 0 ;
 
-    dictionary_remove (instance->dict, (char*)&rec->key_and_data) ;
-    m = dictionary_install_size(instance->dict, (char*)&rec->key_and_data,
-            sizeof(NVOL3_ENTRY_T) + localsize) ;
+    /*
+     * Lookup table nodes are sized for local_size, an existing entry is
+     * updated in place so handles to it stay valid. It is moved last so the
+     * lookup table iterates in slot order, a swap reads the sector ascending.
+     * The key is hashed and its chain walked once, whether it is new or not.
+     */
+    m = dictionary_install_size(dict, (char*)&rec->key_and_data,
+            sizeof(NVOL3_ENTRY_T) + config->local_size) ;
+    if (m && (dictionary_count (dict) != count)) {
+        instance->generation++ ;
+    } else if (m) {
+        NVOL3_ENTRY_T * entry =
+                (NVOL3_ENTRY_T*)dictionary_get_value(dict, m) ;
+        slot_clear_live (instance, entry->idx) ;
+        dictionary_move_last (dict, m) ;
+    }
 
     if (m) {
         NVOL3_ENTRY_T * entry =
-                (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, m) ;
+                (NVOL3_ENTRY_T*)dictionary_get_value(dict, m) ;
+        slot_set_live (instance, idx) ;
         entry->idx = idx ;
         entry->length = rec->head.length - config->key_size;
+        entry->checksum = rec->head.checksum ;
         if (localsize) {
             memcpy (entry->local, &rec->key_and_data[config->key_size],
                 localsize) ;
@@ -1259,21 +2060,25 @@ insert_lookup_table (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* rec,
 }
 
 
+/*
+ * Fill an unpublished lookup table with the valid records of sector.
+ */
 static int32_t
-construct_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
+construct_lookup_table ( NVOL3_INSTANCE_T * instance, struct dictionary * dict,
+                        uint32_t sector, NVOL3_RECORD_T* scratch)
 {
     uint16_t idx   = 0 ;
     int32_t status ;
     const NVOL3_CONFIG_T    *   config = instance->config ;
 
-    dictionary_remove_all (instance->dict, 0, 0) ;
     instance->inuse = 0 ;
     instance->invalid = 0 ;
     instance->error = 0 ;
+    slot_reset_live (instance, 0) ;
 
     while (idx < max_records(instance)) {
-        if ((status = read_variable_record (instance, scratch,  idx, 0))
-                == E_EMPTY) {
+        if ((status = read_variable_record_sector (instance, sector, scratch,
+                idx, 0)) == E_EMPTY) {
           /* last record */
           status = EOK ;
           break ;
@@ -1301,14 +2106,20 @@ construct_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
 
         /* if variable record is valid then add to lookup table */
         if (variable_record_valid(instance, scratch) == EOK) {
-            status = insert_lookup_table (instance, scratch, idx);
+            uint32_t count = dictionary_count (dict) ;
+            status = insert_lookup_table (instance, dict, scratch, idx);
             if (status != EOK) {
                 DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_ASSERT,
                     "NVOL3 :E: construct_lookup_table out of memory!!!") ;
                 break ;
             }
 
-            instance->inuse++ ;
+            /* a later record for the same key makes the earlier one stale */
+            if (dictionary_count (dict) != count) {
+                instance->inuse++ ;
+            } else {
+                instance->invalid++ ;
+            }
 
         } else {
             DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_ERROR,
@@ -1316,7 +2127,7 @@ construct_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
                     "flags 0x%.2x len %d!",
                     (uint32_t)scratch->head.flags,
                     (uint32_t)scratch->head.length) ;
-            set_variable_record_flags (instance,  instance->sector,
+            set_variable_record_flags (instance,  sector,
                     NVOL3_RECORD_FLAGS_INVALID, idx ) ;
             instance->error++ ;
             instance->invalid++ ;
@@ -1327,7 +2138,7 @@ construct_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
     }
 
     instance->next_idx = idx ;
-    instance->version = get_sector_version (config, instance->sector, 0) ;
+    instance->version = get_sector_version (config, sector, 0) ;
     if (instance->version != config->version) {
         return E_VERSION ;
     }
@@ -1336,6 +2147,157 @@ construct_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
 
 }
 
+/*
+ * Build a new lookup table for sector on the side and switch readers to it
+ * together with the sector.
+ */
+static int32_t
+rebuild_lookup_table ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch,
+                        uint32_t sector)
+{
+    const NVOL3_CONFIG_T    *   config = instance->config ;
+    struct dictionary * dict ;
+    int32_t status ;
+
+    /* index only tables cache nothing, the key fills the key words */
+    DBG_CHECK_NVOL3 (!lookup_table_index_only (config) ||
+                ((config->local_size == 0) && (config->key_size ==
+                DICTIONARY_KEY_SIZE(config->keyspec) * sizeof(uint32_t))),
+                E_PARM, "NVOL3 :E: '%s' index only config!", config->name) ;
+
+    dict = dictionary_init_slab(NVOL3_HEAP_SPACE,
+                config->keyspec, config->hashsize, config->key_size + 1,
+                sizeof(NVOL3_ENTRY_T) + config->local_size) ;
+    if (!dict) {
+        return E_NOMEM ;
+    }
+    dictionary_set_concurrent (dict) ;
+    if (instance->filter_bits) {
+        /* without the filter lookups only lose the shortcut for misses */
+        dictionary_set_filter (dict, instance->filter_bits) ;
+    }
+
+    if (lookup_table_index_only (config)) {
+        dictionary_set_key_load (dict, lookup_table_key_load,
+                    (uintptr_t)instance) ;
+        instance->build_sector = sector ;
+    }
+
+    status = construct_lookup_table (instance, dict, sector, scratch) ;
+    publish_lookup_table (instance, dict, sector) ;
+
+    return status ;
+}
+
+/*
+ * Replace the lookup table and sector seen by readers. The previous table is
+ * destroyed once no reader can reference it anymore.
+ */
+static void
+publish_lookup_table (NVOL3_INSTANCE_T * instance, struct dictionary * dict,
+                        uint32_t sector)
+{
+    struct dictionary * old = instance->dict ;
+
+    write_begin (instance) ;
+    NVOL3_STORE (instance->dict, dict) ;
+    NVOL3_STORE (instance->sector, sector) ;
+    instance->node_generation++ ;
+    write_end (instance) ;
+
+    /* open iterators keep their own reference to the cached snapshot */
+    instance->generation++ ;
+    if (instance->snapshot) {
+        snapshot_release (instance->snapshot) ;
+        instance->snapshot = 0 ;
+
+    }
+
+    if (old) {
+        synchronize_readers (instance) ;
+        dictionary_destroy (old) ;
+    }
+}
+
+/*
+ * Nodes removed from the published lookup table are released in batches,
+ * once the readers that could still be walking them have left.
+ */
+static void
+reclaim_lookup_table (NVOL3_INSTANCE_T * instance)
+{
+    if (dictionary_retired (instance->dict) >= NVOL3_RECLAIM_NODES) {
+        synchronize_readers (instance) ;
+        dictionary_reclaim (instance->dict) ;
+    }
+}
+
+static void
+snapshot_sort (NVOL3_SNAPSHOT_T * snapshot)
+{
+    static const uint16_t gaps[] = {701, 301, 132, 57, 23, 10, 4, 1} ;
+    uint32_t g, i, j ;
+
+    for (g = 0; g < sizeof(gaps)/sizeof(gaps[0]); g++) {
+        uint32_t gap = gaps[g] ;
+        for (i = gap; i < snapshot->count; i++) {
+            const char * key = snapshot->keys[i] ;
+            for (j = i; (j >= gap) &&
+                    (snapshot->cmp (snapshot->keys[j - gap], key) > 0);
+                    j -= gap) {
+                snapshot->keys[j] = snapshot->keys[j - gap] ;
+            }
+            snapshot->keys[j] = key ;
+        }
+    }
+}
+
+static NVOL3_SNAPSHOT_T *
+snapshot_create (NVOL3_INSTANCE_T * instance, NVLOL3_IT_KEY_CMP_T cmp)
+{
+    const NVOL3_CONFIG_T    *   config = instance->config ;
+    uint32_t count = dictionary_count (instance->dict) ;
+    uint32_t stride = config->key_size + 1 ;
+    NVOL3_SNAPSHOT_T * snapshot ;
+    struct dictionary_it it ;
+    struct dlist * m ;
+    char * key ;
+
+    snapshot = NVOL3_MALLOC (sizeof(NVOL3_SNAPSHOT_T) +
+                    count * (sizeof(const char*) + stride)) ;
+    if (!snapshot) return 0 ;
+
+    snapshot->refs = 1 ;
+    snapshot->generation = instance->generation ;
+    snapshot->cmp = cmp ;
+    snapshot->count = 0 ;
+
+    key = (char*)&snapshot->keys[count] ;
+    memset (key, 0, count * stride) ;
+    for (m = dictionary_it_first (instance->dict, &it, 0, 0) ;
+            m && (snapshot->count < count) ;
+            m = dictionary_it_next (instance->dict, &it)) {
+        unsigned int keysize = dictionary_get_key_size (instance->dict, m) ;
+        if (keysize > config->key_size) keysize = config->key_size ;
+        memcpy (key, dictionary_get_key (instance->dict, m), keysize) ;
+        snapshot->keys[snapshot->count++] = key ;
+        key += stride ;
+    }
+
+    if (cmp) snapshot_sort (snapshot) ;
+
+    return snapshot ;
+}
+
+static void
+snapshot_release (NVOL3_SNAPSHOT_T * snapshot)
+{
+    if (NVOL3_DEC (snapshot->refs) == 0) {
+        NVOL3_FREE (snapshot) ;
+
+    }
+}
+
 
 static int32_t
 move_sector ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch,
@@ -1374,6 +2336,14 @@ move_sector ( NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch,
     }
 
     while (idx < max_records(instance)) {
+        /* invalidated slots need not be read, stop after the last live one */
+        if (instance->live) {
+            idx = slot_next_live (instance, idx) ;
+            if (idx >= instance->next_idx) {
+                status = EOK ;
+                break ;
+            }
+        }
         if ((status = read_variable_record (instance, scratch,  idx, 0))
                   == E_EMPTY) {
           /* last record */
@@ -1520,12 +2490,11 @@ swap_sectors (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
                     config->name) ;
                 break ;
             }
-            entry->idx = dst_idx ;
 
 #if TEST_ENTRY_WRITE
             NVOL3_RECORD_HEAD_T h ;
             status = read_variable_record_head_sector (instance, dst_addr, &h,
-                            entry->idx) ;
+                            dst_idx) ;
             if (status != EOK) {
                 DBG_MESSAGE_NVOL3 (DBG_MESSAGE_SEVERITY_ERROR,
                     "NVOL3 :E: '%s' swap error %d %.4x %.4x %.4x",
@@ -1554,6 +2523,15 @@ swap_sectors (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
             return EFAIL ;
         }
 
+        /*
+         * Readers kept using the source sector and its lookup table until
+         * now. The move skipped records we could not copy, switch them to
+         * the destination sector with a regenerated lookup table.
+         */
+        if (rebuild_lookup_table (instance, scratch, dst_addr) == E_NOMEM) {
+            return E_NOMEM ;
+        }
+
     } else {
         if ((status = set_sector_flags(config, dst_addr, NVOL3_SECTOR_VALID))
                         != EOK) {
@@ -1562,13 +2540,31 @@ swap_sectors (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
                 config->name) ;
             return status;
         }
-    }
 
-    /* now using destination sector */
-    instance->sector = dst_addr ;
-
-    /* regenerate lookup table */
-    construct_lookup_table(instance, scratch);
+        /*
+         * Readers kept using the source sector and its lookup table until
+         * now. Entries were copied in the order of the lookup table, so
+         * switch them to the destination sector by renumbering the entries
+         * in place. Nodes and keys are unchanged, handles stay valid.
+         */
+        dst_idx = 0 ;
+        write_begin (instance) ;
+        for (m = dictionary_it_first (instance->dict, &it, 0, 0) ; m;
+                m = dictionary_it_next (instance->dict, &it)) {
+            NVOL3_ENTRY_T* entry =
+                (NVOL3_ENTRY_T*)dictionary_get_value(instance->dict, m) ;
+            entry->idx = dst_idx++ ;
+        }
+        NVOL3_STORE (instance->sector, dst_addr) ;
+        dictionary_filter_rebuild (instance->dict) ;
+        instance->next_idx = dst_idx ;
+        instance->inuse = dst_idx ;
+        instance->invalid = 0 ;
+        instance->error = 0 ;
+        write_end (instance) ;
+        slot_reset_live (instance, dst_idx) ;
+        instance->version = get_sector_version (config, dst_addr, 0) ;
+    }
 
     /* erase source sector */
     if ((status = erase_sector(config, src_addr, config->sector_size)) != EOK) {
@@ -1741,5 +2737,5 @@ init_sectors (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T* scratch)
       break;
   }
 
-  return construct_lookup_table (instance, scratch) ;
+  return rebuild_lookup_table (instance, scratch, instance->sector) ;
 }
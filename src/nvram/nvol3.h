@@ -50,6 +50,7 @@
 
 #define NVOL3_PAGE_SIZE                         0x20            /**< @brief one page used at the start of the sector */
 #define NVOL3_HEADROOM                          0x04            /**< @brief min available slots before volume is full */
+#define NVOL3_RECLAIM_NODES                     8               /**< @brief removed lookup table nodes collected before waiting for readers to release them */
 #define NVOL3_HEAP_SPACE                        HEAP_SPACE      /**< @brief heap handle to allocate memory for nvol3 */
 #define NVOL3_MALLOC(size)                      heap_malloc (HEAP_SPACE, size)
 #define NVOL3_FREE(mem)                         heap_free (HEAP_SPACE, mem)
@@ -106,11 +107,13 @@ typedef struct NVOL3_ENTRY_S
 {
   uint16_t              idx;                    /**< @brief  offset (number of records) into current FLASH sector */
   uint16_t              length;                 /**< @brief  length of record cached in local */
+  uint16_t              checksum;               /**< @brief  checksum of the record in FLASH */
   uint8_t               local[] ;               /**< @brief  local cache of record data (excluding the key)*/
 } NVOL3_ENTRY_T;
 #pragma pack()
 
 struct NVOL3_INSTANCE_S ;
+struct NVOL3_SNAPSHOT_S ;
 /*
  * Callback interface
  */
@@ -122,16 +125,26 @@ typedef int32_t (*NVLOL3_TRANSACTION_CALLBACK_T)(struct NVOL3_INSTANCE_S * /*ins
 typedef int32_t (*NVLOL3_NVRAM_READ_T)(uint32_t /*addr*/, uint32_t /*len*/, uint8_t * /*data*/) ;
 typedef int32_t (*NVLOL3_NVRAM_WRITE_T)(uint32_t /*addr*/, uint32_t /*len*/, const uint8_t * /*data*/) ;
 typedef int32_t (*NVLOL3_NVRAM_ERASE_T)(uint32_t /*addr_start*/, uint32_t /*addr_end*/) ;
+typedef const uint8_t * (*NVLOL3_NVRAM_MAP_T)(uint32_t /*addr*/, uint32_t /*len*/) ;
 /*
  * Iterator callback
  */
 typedef int32_t (*NVLOL3_IT_KEY_CMP_T)(const char * /* first*/, const char * /*second*/) ;
+/*
+ * Visitor callback, data points to the record in RAM or mapped FLASH
+ */
+typedef int32_t (*NVLOL3_VISIT_T)(const char * /*key*/, const uint8_t * /*data*/, uint32_t /*length*/, uintptr_t /*ctx*/) ;
+/*
+ * Multi get callback for the i'th key, length of the data or < 0 (status)
+ */
+typedef void (*NVLOL3_MULTI_GET_T)(uint32_t /*i*/, const uint8_t * /*data*/, int32_t /*length*/, uintptr_t /*ctx*/) ;
 
 
 typedef struct NVOL3_FLASH_IF_S {
     NVLOL3_NVRAM_READ_T     read ;
     NVLOL3_NVRAM_WRITE_T    write ;
     NVLOL3_NVRAM_ERASE_T    erase ;
+    NVLOL3_NVRAM_MAP_T      map ;               /**< @brief  optional, pointer to memory mapped FLASH or 0 */
 } NVOL3_FLASH_IF_T ;
 
 /*
@@ -179,22 +192,79 @@ typedef struct NVOL3_INSTANCE_S {
     uint32_t            inuse ;                 /**< @brief  current records in use */
     uint32_t            invalid ;               /**< @brief  current records invalid */
     uint32_t            error ;                 /**< @brief  current record errors */
+    uint32_t            seq ;                   /**< @brief  odd while the published lookup table is modified */
+    uint32_t            epoch ;                 /**< @brief  advanced by a writer waiting for lock free readers */
+    uint32_t            readers[2] ;            /**< @brief  lock free readers active per epoch parity */
+    uint32_t            generation ;            /**< @brief  incremented when a key is added or removed */
+    uint32_t            node_generation ;       /**< @brief  incremented when lookup table nodes are released, invalidates handles */
+    struct NVOL3_SNAPSHOT_S * snapshot ;        /**< @brief  last snapshot taken, reused while generation matches */
+    uint32_t *          live ;                  /**< @brief  bitmap of the slots below next_idx holding the current record of a key */
+    uint32_t            build_sector ;          /**< @brief  sector of a lookup table being constructed, keys of index only tables are read from it */
+    uint32_t            filter_bits ;           /**< @brief  size of the lookup table Bloom filter, 0 for none */
 
 } NVOL3_INSTANCE_T ;
 
+/**
+ * @brief   slot usage of the current sector, see nvol3_stats().
+ */
+typedef struct NVOL3_STATS_S {
+    uint32_t            records ;               /**< @brief  slots in a sector */
+    uint32_t            live ;                  /**< @brief  slots holding the current record of a key */
+    uint32_t            invalid ;               /**< @brief  slots written and no longer live, reclaimed by a swap */
+    uint32_t            empty ;                 /**< @brief  slots not written yet */
+    uint32_t            error ;                 /**< @brief  slots that failed to write or verify */
+} NVOL3_STATS_T ;
+
+/**
+ * @brief   record metadata kept in the lookup table, see nvol3_record_info().
+ */
+typedef struct NVOL3_RECORD_INFO_S {
+    uint16_t            length ;                /**< @brief  length of the data, excluding the key */
+    uint16_t            checksum ;              /**< @brief  checksum of the record in FLASH */
+    uint16_t            idx ;                   /**< @brief  slot in the current sector */
+    uint16_t            age ;                   /**< @brief  records written to the sector after this one */
+} NVOL3_RECORD_INFO_T ;
+
+/**
+ * @brief   reference counted copy of the keys in the volume, sorted when
+ *          taken with a compare function.
+ */
+typedef struct NVOL3_SNAPSHOT_S {
+    uint32_t            refs ;                  /**< @brief  cached instance and open iterators */
+    uint32_t            generation ;            /**< @brief  instance generation the keys were copied at */
+    NVLOL3_IT_KEY_CMP_T cmp ;                   /**< @brief  sort order */
+    uint32_t            count ;
+    const char *        keys[] ;                /**< @brief  key copies follow the array, \0 terminated */
+} NVOL3_SNAPSHOT_T ;
+
 /**
  * @brief   iterator for entries in the volume.
  */
 typedef struct NVOL3_ITERATOR_S {
     struct dictionary_it    it ;
+    NVOL3_SNAPSHOT_T *      snapshot ;          /**< @brief  keys iterated by nvol3_snapshot_next() */
+    uint32_t                pos ;
 } NVOL3_ITERATOR_T ;
 
+/**
+ * @brief   key resolved to its lookup table node. Valid while the instance
+ *          node_generation matches, existing keys are updated in place.
+ */
+typedef struct NVOL3_HANDLE_S {
+    struct dlist *          np ;                /**< @brief  lookup table node, 0 if the key was not found */
+    uint32_t                generation ;        /**< @brief  node_generation when resolved */
+} NVOL3_HANDLE_T ;
+
 /**
  * @brief   macros to declare instances of nvol. "name" to be used as NVOL3_INSTANCE_T instance parameter to the API
  */
 #define NVOL3_INSTANCE_DECL(name, read, write, erase, sector1, sector2, sector_size, key_size, keyspec, hashsize, data_size, local_size, tallie, version)  \
+        NVOL3_MAPPED_INSTANCE_DECL(name, read, write, erase, 0, sector1, sector2, sector_size, key_size, keyspec, hashsize, data_size, \
+        local_size, tallie, version)
+
+#define NVOL3_MAPPED_INSTANCE_DECL(name, read, write, erase, map, sector1, sector2, sector_size, key_size, keyspec, hashsize, data_size, local_size, tallie, version)  \
         const NVOL3_CONFIG_T name ## _config = { #name, \
-                        {read, write, erase}, \
+                        {read, write, erase, map}, \
                         sector1, \
                         sector2, \
                         sector_size, \
@@ -236,18 +306,64 @@ extern "C" {
     int32_t         nvol3_delete (NVOL3_INSTANCE_T* instance) ;
     int32_t         nvol3_repair (NVOL3_INSTANCE_T* instance) ;
     void            nvol3_unload (NVOL3_INSTANCE_T* instance) ;
+    void            nvol3_set_filter (NVOL3_INSTANCE_T* instance, uint32_t bits) ;
 
     /*
      * API for writing to FLASH immediately.
+     * nvol3_record_get(), nvol3_record_get_hashed(), nvol3_record_status(),
+     * nvol3_record_key_and_data_length() and nvol3_record_info() are lock
+     * free and may run concurrently with one writer. The last three are
+     * answered from the lookup table without reading FLASH. All other calls
+     * must be serialised by the caller. Readers and the writer wait for each
+     * other with CFG_NVOL3_YIELD(), which a port without POSIX threads must
+     * define to yield to the other threads, e.g. for a lower priority one.
      */
     int32_t         nvol3_record_set (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value, uint32_t key_and_data_length) ;
     int32_t         nvol3_record_get (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value) ;
+    int32_t         nvol3_record_get_hashed (NVOL3_INSTANCE_T* instance, const char * key, uint32_t hash, NVOL3_RECORD_T *value) ;
     int32_t         nvol3_record_delete (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *record) ;
     int32_t         nvol3_record_status (NVOL3_INSTANCE_T* instance, const char * key) ;
     int32_t         nvol3_record_key_and_data_length (NVOL3_INSTANCE_T* instance, const char * key) ;
+    int32_t         nvol3_record_info (NVOL3_INSTANCE_T* instance, const char * key, NVOL3_RECORD_INFO_T * info) ;
     int32_t         nvol3_record_first (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value, NVOL3_ITERATOR_T * it, NVLOL3_IT_KEY_CMP_T cmp) ;
     int32_t         nvol3_record_next (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value, NVOL3_ITERATOR_T * it) ;
 
+    /*
+     * Pass the data of records to a callback without copying it, from the
+     * local cache or memory mapped FLASH if possible. Must be serialised with
+     * writers (e.g. a shared lock), the callback must not change the volume.
+     * nvol3_record_foreach() visits in slot order and stops at the first
+     * callback not returning EOK.
+     */
+    int32_t         nvol3_record_visit (NVOL3_INSTANCE_T* instance, const char * key, NVLOL3_VISIT_T cb, uintptr_t ctx) ;
+    int32_t         nvol3_record_foreach (NVOL3_INSTANCE_T* instance, NVLOL3_VISIT_T cb, uintptr_t ctx) ;
+    /*
+     * Get the data of count keys, reading the records in slot order with
+     * adjacent slots coalesced into one FLASH read. Must be serialised with
+     * writers, cb is called once for every key.
+     */
+    int32_t         nvol3_record_get_multi (NVOL3_INSTANCE_T* instance, const char * const * keys, uint32_t count, NVLOL3_MULTI_GET_T cb, uintptr_t ctx) ;
+
+    /*
+     * Iterate the keys present when the snapshot was opened, with their
+     * current values. Open must be serialised with writers, next is lock free
+     * and any number of iterators may be open at the same time.
+     */
+    int32_t         nvol3_snapshot_open (NVOL3_INSTANCE_T* instance, NVOL3_ITERATOR_T * it, NVLOL3_IT_KEY_CMP_T cmp) ;
+    int32_t         nvol3_snapshot_next (NVOL3_INSTANCE_T* instance, NVOL3_RECORD_T *value, NVOL3_ITERATOR_T * it) ;
+    void            nvol3_snapshot_close (NVOL3_INSTANCE_T* instance, NVOL3_ITERATOR_T * it) ;
+
+    /*
+     * Access a record through a handle resolved once, skipping the key lookup.
+     * Resolve and get are lock free, set must be serialised with other writers.
+     * nvol3_handle_get() returns E_INVALID when the handle has to be resolved
+     * again. The key in the record passed to nvol3_handle_set() must be the
+     * resolved key.
+     */
+    int32_t         nvol3_handle_resolve (NVOL3_INSTANCE_T* instance, const char * key, NVOL3_HANDLE_T * handle) ;
+    int32_t         nvol3_handle_get (NVOL3_INSTANCE_T* instance, const NVOL3_HANDLE_T * handle, NVOL3_RECORD_T *record) ;
+    int32_t         nvol3_handle_set (NVOL3_INSTANCE_T* instance, NVOL3_HANDLE_T * handle, NVOL3_RECORD_T *value, uint32_t key_and_data_length) ;
+
     /*
      * API to access records from RAM and persist only on demand. locel_size should be same as data_size!
      */
@@ -264,6 +380,11 @@ extern "C" {
      */
     void            nvol3_entry_log_status (NVOL3_INSTANCE_T* instance, uint32_t verbose) ;
 
+    /*
+     * slot usage of the current sector, kept up to date by every write.
+     */
+    void            nvol3_stats (NVOL3_INSTANCE_T* instance, NVOL3_STATS_T * stats) ;
+
     /*
      * can be implemented to keep count of reads and writes to the nvol
      */
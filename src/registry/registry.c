@@ -29,32 +29,107 @@
 #include <nvram/nvol3.h>
 #include <drivers/ramdrv.h>
 #include <shell/corshell.h>
+#include <common/heap.h>
+#include <stdio.h>
+#include <stdlib.h>
 #if CFG_STRSUB_USE
 #include <common/strsub.h>
 #endif
 
 
-NVOL3_INSTANCE_DECL(_regdef_nvol3_entry,
-        ramdrv_read, ramdrv_write, ramdrv_erase,
+/*
+ * Bits of the Bloom filter answering lookups of absent keys, e.g. strsub
+ * tokens that are not registry keys. 0 for no filter.
+ */
+#ifndef CFG_REGISTRY_FILTER_BITS
+#define CFG_REGISTRY_FILTER_BITS            0
+#endif
+
+/*
+ * Keys registry_values_get() looks up per pass, the keys are copied to the
+ * stack.
+ */
+#ifndef CFG_REGISTRY_VALUES_BATCH
+#define CFG_REGISTRY_VALUES_BATCH           32
+#endif
+
+/*
+ * Watchers are called after a change was committed, outside the registry
+ * lock. Between registry_watch_hold() and registry_watch_release() the changed
+ * keys are collected and delivered once, when more than
+ * CFG_REGISTRY_WATCH_QUEUE keys changed (or on erase) watchers are called
+ * with key 0 instead.
+ */
+#ifndef CFG_REGISTRY_WATCH_MAX
+#define CFG_REGISTRY_WATCH_MAX              8
+#endif
+#ifndef CFG_REGISTRY_WATCH_QUEUE
+#define CFG_REGISTRY_WATCH_QUEUE            16
+#endif
+
+/*
+ * The default registry used by the functions without a REGISTRY_T.
+ */
+REGISTRY_VOLUME_DECL(_regdef_nvol3_entry,
+        ramdrv_read, ramdrv_write, ramdrv_erase, RAMDRV_MAP,
         NVOL3_REGISTRY_START,
         NVOL3_REGISTRY_START + NVOL3_REGISTRY_SECTOR_SIZE,
-        NVOL3_REGISTRY_SECTOR_SIZE,
-        REGISTRY_KEY_LENGTH,            /* key_size (should work with key_spec)*/
-		DICTIONARY_KEYSPEC_BINARY(6),      /* dictionary key_type can use
-										   DICTIONARY_KEYSPEC_STRING or
-		 	 	 	 	 	 	 	 	   DICTIONARY_KEYSPEC_BINARY(6) */
-        53,                             /* hashsize*/
-        REGISTRY_VALUE_LENGT_MAX,       /* data_size*/
-        0,                              /* local_size (no cache in RAM)*/
-        0,                              /* tallie*/
-        NVOL3_SECTOR_VERSION            /* version*/
-        ) ;
-
+        NVOL3_REGISTRY_SECTOR_SIZE) ;
 
+/*
+ * Value lookups and iteration take no lock, nvol3 reads are lock free.
+ * Anything that changes the registry or takes an iterator snapshot takes the
+ * lock exclusive, status logging and visitors walk the lookup table and take
+ * it shared. The defaults can be replaced at any time, a lookup that falls
+ * through to them takes the lock shared. Every registry has its own lock.
+ */
+#if CFG_PORT_POSIX
+#include <pthread.h>
+#define REGISTRY_LOCK_DECL                  pthread_rwlock_t lock ;
+#define REGISTRY_LOCK_INITIALIZER           PTHREAD_RWLOCK_INITIALIZER
+#define REGISTRY_LOCK_INIT(registry)        pthread_rwlock_init (&(registry)->lock, 0)
+#define REGISTRY_LOCK_DESTROY(registry)     pthread_rwlock_destroy (&(registry)->lock)
+#define REGISTRY_LOCK(registry)             pthread_rwlock_wrlock (&(registry)->lock)
+#define REGISTRY_LOCK_SHARED(registry)      pthread_rwlock_rdlock (&(registry)->lock)
+#define REGISTRY_UNLOCK(registry)           pthread_rwlock_unlock (&(registry)->lock)
+#else
+#define REGISTRY_LOCK_DECL
+#define REGISTRY_LOCK_INITIALIZER           0
+#define REGISTRY_LOCK_INIT(registry)
+#define REGISTRY_LOCK_DESTROY(registry)
+#define REGISTRY_LOCK(registry)
+#define REGISTRY_LOCK_SHARED(registry)
+#define REGISTRY_UNLOCK(registry)
+#endif
 
-#define REGISTRY_LOCK_INIT()
-#define REGISTRY_LOCK()
-#define REGISTRY_UNLOCK()
+#define REGISTRY_MALLOC(size)               heap_malloc (HEAP_SPACE, size)
+#define REGISTRY_FREE(mem)                  heap_free (HEAP_SPACE, mem)
+
+typedef struct REGISTRY_WATCHER_S {
+    REGISTRY_WATCH_T        cb ;
+    uintptr_t               ctx ;
+    unsigned int            len ;
+    char                    prefix[REGISTRY_KEY_LENGTH] ;
+} REGISTRY_WATCHER_T ;
+
+struct REGISTRY_S {
+    NVOL3_INSTANCE_T *      volume ;
+    REGISTRY_LOCK_DECL
+    REGISTRY_WATCHER_T      watchers[CFG_REGISTRY_WATCH_MAX] ;
+    unsigned int            watch_count ;
+    unsigned int            watch_hold ;
+    unsigned int            watch_queued ;  /* > CFG_REGISTRY_WATCH_QUEUE on overflow */
+    char                    watch_queue[CFG_REGISTRY_WATCH_QUEUE][REGISTRY_KEY_LENGTH] ;
+    const REGISTRY_DEFAULT_T * defaults ;   /* read only layer under the volume */
+    const PHASH_T *         default_image ; /* or the same as a phashgen table */
+    unsigned int            default_count ;
+} ;
+
+static REGISTRY_T           _registry = { &_regdef_nvol3_entry,
+#if CFG_PORT_POSIX
+        REGISTRY_LOCK_INITIALIZER
+#endif
+        } ;
 
 typedef struct NVOL3_REGISTRY_S {
     NVOL3_RECORD_HEAD_T     head ; /* 8 bytes */
@@ -65,7 +140,11 @@ typedef struct NVOL3_REGISTRY_S {
 
 #define REGISTRY_KEY_TYPE_LEN       ((int32_t)(REGISTRY_KEY_LENGTH))
 
-NVOL3_REGISTRY_T _registry_value ;
+typedef struct REGISTRY_VISIT_S {
+    REGISTRY_VISIT_T        cb ;
+    uintptr_t               ctx ;
+    bool                    skip_empty ;
+} REGISTRY_VISIT_CTX_T ;
 
 
 #if CFG_STRSUB_USE
@@ -80,6 +159,242 @@ _setkey (NVOL3_REGISTRY_T* entry, REGISTRY_KEY_T key)
     strncpy (entry->key, key, REGISTRY_KEY_LENGTH) ;
 }
 
+static inline int32_t
+_getvalue (NVOL3_REGISTRY_T* entry, int32_t res, char* value,
+            unsigned int length)
+{
+    if (res > REGISTRY_KEY_TYPE_LEN) {
+        res -= REGISTRY_KEY_TYPE_LEN ;
+        if (value && (length > 0)) {
+            res = (int)length <= res ? (int)length : res ;
+            memcpy(value, entry->value, res) ;
+        }
+
+    } else if (res >= 0) {
+        res = E_INVAL ;
+
+    }
+
+    return res ;
+}
+
+/*
+ * The defaults are a sorted table or a perfect hash table image, usually in
+ * ROM, for keys not in the volume. Only changed keys are written to the
+ * volume. Called with the lock held, shared or exclusive.
+ */
+static bool
+_finddefault (REGISTRY_T* registry, const char* key, REGISTRY_DEFAULT_T* def)
+{
+    const REGISTRY_DEFAULT_T * defaults = registry->defaults ;
+    unsigned int lo = 0 ;
+    unsigned int hi = registry->default_count ;
+    unsigned int mid ;
+    int32_t res ;
+    int cmp ;
+
+    if (registry->default_image) {
+        res = phash_lookup (registry->default_image, key,
+                strnlen (key, REGISTRY_KEY_LENGTH), &def->value) ;
+        if (res < 0) {
+            return false ;
+        }
+        def->id = key ;
+        def->length = res ;
+        return true ;
+
+    }
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2 ;
+        cmp = strncmp (key, defaults[mid].id, REGISTRY_KEY_LENGTH) ;
+        if (cmp == 0) {
+            *def = defaults[mid] ;
+            return true ;
+
+        }
+        if (cmp < 0) {
+            hi = mid ;
+
+        } else {
+            lo = mid + 1 ;
+
+        }
+    }
+
+    return false ;
+}
+
+/* called with the lock held, shared or exclusive */
+static bool
+_defaultat (REGISTRY_T* registry, unsigned int i, REGISTRY_DEFAULT_T* def)
+{
+    int32_t res ;
+
+    if (i >= registry->default_count) {
+        return false ;
+
+    }
+    if (registry->default_image) {
+        res = phash_entry (registry->default_image, i, &def->id,
+                &def->value) ;
+        def->length = res ;
+        return res >= 0 ;
+
+    }
+    *def = registry->defaults[i] ;
+
+    return true ;
+}
+
+/*
+ * For the lock free lookups, takes the lock shared.
+ */
+static int32_t
+_getdefault (REGISTRY_T* registry, NVOL3_REGISTRY_T* entry)
+{
+    REGISTRY_DEFAULT_T def ;
+    int32_t res = E_NOTFOUND ;
+
+    REGISTRY_LOCK_SHARED(registry);
+    if (_finddefault (registry, entry->key, &def)) {
+        memcpy (entry->value, def.value, def.length) ;
+        res = def.length + REGISTRY_KEY_TYPE_LEN ;
+    }
+    REGISTRY_UNLOCK(registry);
+
+    return res ;
+}
+
+static bool
+_checkdefaults (const REGISTRY_DEFAULT_T* defaults, unsigned int count)
+{
+    unsigned int i ;
+
+    for (i = 0 ; i < count ; i++) {
+        if (!defaults[i].id || !defaults[i].value ||
+                (strlen (defaults[i].id) > REGISTRY_KEY_LENGTH) ||
+                !defaults[i].length ||
+                (defaults[i].length > REGISTRY_VALUE_LENGT_MAX)) {
+            return false ;
+        }
+        if (i && (strncmp (defaults[i-1].id, defaults[i].id,
+                REGISTRY_KEY_LENGTH) >= 0)) {
+            DBG_MESSAGE_REGISTRY (DBG_MESSAGE_SEVERITY_ERROR,
+                    "REG   : : defaults not sorted at '%s'", defaults[i].id) ;
+            return false ;
+        }
+    }
+
+    return true ;
+}
+
+static bool
+_checkimage (const PHASH_T* image)
+{
+    const char * key ;
+    int32_t res ;
+    uint32_t i ;
+
+    if (phash_check (image, image->size) != EOK) {
+        return false ;
+    }
+    for (i = 0 ; i < phash_count (image) ; i++) {
+        res = phash_entry (image, i, &key, 0) ;
+        if ((res <= 0) || (res > REGISTRY_VALUE_LENGT_MAX) ||
+                (strlen (key) > REGISTRY_KEY_LENGTH)) {
+            return false ;
+        }
+    }
+
+    return true ;
+}
+
+/*
+ * Setting a key to its default removes it from the volume instead, so the
+ * default shows through and nothing is written if it was not there. Called
+ * with the lock held exclusive, res is E_NOTFOUND if nothing changed.
+ */
+static bool
+_setdefault (REGISTRY_T* registry, NVOL3_REGISTRY_T* entry, const char* value,
+            unsigned int length, int32_t* res)
+{
+    REGISTRY_DEFAULT_T def ;
+
+    if (!_finddefault (registry, entry->key, &def) ||
+            (def.length != length) || memcmp (def.value, value, length)) {
+        return false ;
+    }
+    *res = nvol3_record_delete (registry->volume, (NVOL3_RECORD_T*)entry) ;
+
+    return true ;
+}
+
+/*
+ * Called with the lock held exclusive after key (0 for all keys) changed.
+ * Returns true if the watchers should be called now.
+ */
+static bool
+_watch_changed (REGISTRY_T* registry, const char* key)
+{
+    unsigned int i ;
+
+    if (!registry->watch_count) {
+        return false ;
+    }
+    if (!registry->watch_hold) {
+        return true ;
+    }
+    if (!key) {
+        registry->watch_queued = CFG_REGISTRY_WATCH_QUEUE + 1 ;
+        return false ;
+    }
+    for (i = 0 ; (i < registry->watch_queued) &&
+            (i < CFG_REGISTRY_WATCH_QUEUE) ; i++) {
+        if (!memcmp (registry->watch_queue[i], key, REGISTRY_KEY_LENGTH)) {
+            return false ;
+        }
+    }
+    if (registry->watch_queued < CFG_REGISTRY_WATCH_QUEUE) {
+        memcpy (registry->watch_queue[registry->watch_queued], key,
+                REGISTRY_KEY_LENGTH) ;
+    }
+    if (registry->watch_queued <= CFG_REGISTRY_WATCH_QUEUE) {
+        registry->watch_queued++ ;
+    }
+
+    return false ;
+}
+
+/*
+ * Call the watchers of key (0 for all keys), without the lock held.
+ */
+static void
+_watch_notify (REGISTRY_T* registry, const char* key)
+{
+    REGISTRY_WATCHER_T watchers[CFG_REGISTRY_WATCH_MAX] ;
+    char id[REGISTRY_KEY_LENGTH+1] ;
+    unsigned int i, n = 0 ;
+
+    REGISTRY_LOCK_SHARED(registry);
+    for (i = 0 ; i < CFG_REGISTRY_WATCH_MAX ; i++) {
+        if (registry->watchers[i].cb && (!key ||
+                !memcmp (key, registry->watchers[i].prefix,
+                        registry->watchers[i].len))) {
+            watchers[n++] = registry->watchers[i] ;
+        }
+    }
+    REGISTRY_UNLOCK(registry);
+
+    if (key) {
+        memcpy (id, key, REGISTRY_KEY_LENGTH) ;
+        id[REGISTRY_KEY_LENGTH] = '\0' ;
+    }
+    for (i = 0 ; i < n ; i++) {
+        watchers[i].cb (key ? id : 0, watchers[i].ctx) ;
+    }
+}
+
 /**
  * @brief       One time initialisation
  * @return      status
@@ -87,10 +402,26 @@ _setkey (NVOL3_REGISTRY_T* entry, REGISTRY_KEY_T key)
 int32_t
 registry_init (void)
 {
-    REGISTRY_LOCK_INIT();
     return EOK ;
 }
 
+/*
+ * Load the lookup table of a registry, resetting the volume if it is not a
+ * valid registry.
+ */
+static int32_t
+_load (REGISTRY_T* registry, uint32_t filter_bits)
+{
+    nvol3_set_filter (registry->volume, filter_bits) ;
+    if (nvol3_validate(registry->volume) != EOK) {
+        DBG_MESSAGE_REGISTRY( DBG_MESSAGE_SEVERITY_REPORT,
+                "REG   : : resetting %s", registry->volume->config->name)
+        return nvol3_reset (registry->volume) ;
+    }
+
+    return nvol3_load (registry->volume) ;
+}
+
 /**
  * @brief       Start and load the registry lookup table.
  * @note        If it is not a valid registry the registry will be reset.
@@ -101,14 +432,8 @@ registry_start (void)
 {
     int32_t status = 0 ;
 
-    REGISTRY_LOCK();
-    if (nvol3_validate(&_regdef_nvol3_entry) != EOK) {
-        DBG_MESSAGE_REGISTRY( DBG_MESSAGE_SEVERITY_REPORT,
-                "REG   : : resetting _regdef_nvol3_entry")
-        status = nvol3_reset (&_regdef_nvol3_entry) ;
-    } else {
-        status = nvol3_load (&_regdef_nvol3_entry) ;
-    }
+    REGISTRY_LOCK(&_registry);
+    status = _load (&_registry, CFG_REGISTRY_FILTER_BITS) ;
 #if CFG_STRSUB_USE
     /*
      * This Strsub handler  will try to replace text betwee '[' and ']' 
@@ -118,7 +443,7 @@ registry_start (void)
             registry_strsub_cb) ;
 #endif
     CORSHELL_CMD_LIST_INSTALL(registry) ;
-    REGISTRY_UNLOCK();
+    REGISTRY_UNLOCK(&_registry);
 
     return status ;
 }
@@ -132,48 +457,182 @@ registry_stop (void)
 {
     int32_t status = 0 ;
 
-    REGISTRY_LOCK();
+    REGISTRY_LOCK(&_registry);
 #if CFG_STRSUB_USE
     strsub_uninstall_handler(0, StrsubToken1, &_registry_strsub) ;
 #endif
     CORSHELL_CMD_LIST_UNINSTALL(registry) ;
-    nvol3_unload(&_regdef_nvol3_entry) ;
-    REGISTRY_UNLOCK();
+    nvol3_unload(_registry.volume) ;
+    REGISTRY_UNLOCK(&_registry);
 
     return status ;
 }
 
+/**
+ * @brief       Open a registry on its own volume, independent of the default
+ *              registry and of other registries.
+ * @note        If it is not a valid registry the volume will be reset.
+ * @param[in]   config
+ * @return      registry or 0
+ */
+REGISTRY_T*
+registry_open (const REGISTRY_CONFIG_T* config)
+{
+    REGISTRY_T* registry ;
+    DBG_CHECK_T(config && config->volume, 0, "registry_open config") ;
+
+    registry = REGISTRY_MALLOC (sizeof(REGISTRY_T)) ;
+    if (!registry) {
+        return 0 ;
+    }
+    memset (registry, 0, sizeof(REGISTRY_T)) ;
+    if (!_checkdefaults (config->defaults, config->default_count) ||
+            (config->default_image && !_checkimage (config->default_image))) {
+        REGISTRY_FREE (registry) ;
+        return 0 ;
+    }
+    registry->volume = config->volume ;
+    if (config->default_image) {
+        registry->default_image = config->default_image ;
+        registry->default_count = phash_count (config->default_image) ;
+
+    } else if (config->defaults) {
+        registry->defaults = config->defaults ;
+        registry->default_count = config->default_count ;
+
+    }
+    REGISTRY_LOCK_INIT(registry) ;
+    if (_load (registry, config->filter_bits) != EOK) {
+        nvol3_unload (registry->volume) ;
+        REGISTRY_LOCK_DESTROY(registry) ;
+        REGISTRY_FREE (registry) ;
+        return 0 ;
+    }
+
+    return registry ;
+}
+
+/**
+ * @brief       Unload a registry opened with registry_open() and free it.
+ * @param[in]   registry
+ */
+void
+registry_close (REGISTRY_T* registry)
+{
+    if (!registry || (registry == &_registry)) return ;
+
+    REGISTRY_LOCK(registry);
+    nvol3_unload (registry->volume) ;
+    REGISTRY_UNLOCK(registry);
+    REGISTRY_LOCK_DESTROY(registry) ;
+    REGISTRY_FREE (registry) ;
+}
+
+/**
+ * @brief       The default registry, e.g. for registry_watch_r().
+ * @return      registry
+ */
+REGISTRY_T*
+registry_default (void)
+{
+    return &_registry ;
+}
+
 /**
  * @brief       Reset the registry.
  * @return      status
  */
 int32_t
-registry_erase (void)
+registry_erase_r (REGISTRY_T* registry)
 {
     int32_t status = 0 ;
-    REGISTRY_LOCK();
-    status = nvol3_reset (&_regdef_nvol3_entry) ;
-    REGISTRY_UNLOCK();
+    bool notify ;
+    REGISTRY_LOCK(registry);
+    status = nvol3_reset (registry->volume) ;
+    notify = _watch_changed (registry, 0) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, 0) ;
+    }
 
     return status ;
 }
 
 /**
- * @brief      Delete the entry for id from the registry.
+ * @brief       Set the factory defaults for keys not in the registry. The
+ *              table is not copied and must stay valid, it is never written.
+ * @param[in]   defaults    sorted by key, 0 for none
+ * @param[in]   count
+ * @return      EOK or E_PARM
+ */
+int32_t
+registry_set_defaults_r (REGISTRY_T* registry, const REGISTRY_DEFAULT_T* defaults,
+                        unsigned int count)
+{
+    bool notify ;
+    if (!_checkdefaults (defaults, count)) return E_PARM ;
+
+    REGISTRY_LOCK(registry);
+    registry->defaults = defaults ;
+    registry->default_image = 0 ;
+    registry->default_count = defaults ? count : 0 ;
+    notify = _watch_changed (registry, 0) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, 0) ;
+    }
+
+    return EOK ;
+}
+
+/**
+ * @brief       Set the factory defaults from a table built by phashgen,
+ *              instead of a REGISTRY_DEFAULT_T table. Lookups read the image
+ *              in place.
+ * @param[in]   image   4 byte aligned, 0 for none
+ * @return      EOK or E_PARM
+ */
+int32_t
+registry_set_default_image_r (REGISTRY_T* registry, const PHASH_T* image)
+{
+    bool notify ;
+    if (image && !_checkimage (image)) return E_PARM ;
+
+    REGISTRY_LOCK(registry);
+    registry->defaults = 0 ;
+    registry->default_image = image ;
+    registry->default_count = image ? phash_count (image) : 0 ;
+    notify = _watch_changed (registry, 0) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, 0) ;
+    }
+
+    return EOK ;
+}
+
+/**
+ * @brief      Delete the entry for id from the registry, a default for id
+ *              is used again.
  * @param[in]   id
  * @return      status
  */
 int32_t
-registry_value_delete (REGISTRY_KEY_T id)
+registry_value_delete_r (REGISTRY_T* registry, REGISTRY_KEY_T id)
 {
     int32_t res = EFAIL;
+    NVOL3_REGISTRY_T reg ;
+    bool notify ;
     DBG_CHECK_T(id, E_PARM, "registry_value_delete id") ;
 
-    REGISTRY_LOCK();
-    _setkey (&_registry_value, id) ;
-    res = nvol3_record_delete(&_regdef_nvol3_entry,
-            (NVOL3_RECORD_T*)&_registry_value) ;
-    REGISTRY_UNLOCK();
+    REGISTRY_LOCK(registry);
+    _setkey (&reg, id) ;
+    res = nvol3_record_delete(registry->volume, (NVOL3_RECORD_T*)&reg) ;
+    notify = (res == EOK) && _watch_changed (registry, reg.key) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, reg.key) ;
+    }
 
     return res ;
 }
@@ -184,17 +643,27 @@ registry_value_delete (REGISTRY_KEY_T id)
  * @return      true or false
  */
 bool
-registry_value_valid (REGISTRY_KEY_T id)
+registry_value_valid_r (REGISTRY_T* registry, REGISTRY_KEY_T id)
 {
     bool res = false ;
+    int32_t length ;
+    NVOL3_REGISTRY_T reg ;
+    REGISTRY_DEFAULT_T def ;
     DBG_CHECK_T(id, E_PARM, "registry_value_valid id") ;
 
-    REGISTRY_LOCK();
-    _setkey (&_registry_value, id) ;
-    if (nvol3_record_get(&_regdef_nvol3_entry, (NVOL3_RECORD_T*)&_registry_value) > REGISTRY_KEY_TYPE_LEN) {
+    _setkey (&reg, id) ;
+    length = nvol3_record_key_and_data_length (registry->volume,
+            (const char*)reg.key) ;
+    if (length > REGISTRY_KEY_TYPE_LEN) {
         res = true ;
+
+    } else if (length < 0) {
+        /* only without a record, an empty one hides the default as in get */
+        REGISTRY_LOCK_SHARED(registry);
+        res = _finddefault (registry, reg.key, &def) ;
+        REGISTRY_UNLOCK(registry);
+
     }
-    REGISTRY_UNLOCK();
 
     return res ;
 
@@ -206,14 +675,23 @@ registry_value_valid (REGISTRY_KEY_T id)
  * @return      length or < 0 (status)
  */
 int32_t
-registry_value_length (REGISTRY_KEY_T id)
+registry_value_length_r (REGISTRY_T* registry, REGISTRY_KEY_T id)
 {
     int32_t res ;
+    NVOL3_REGISTRY_T reg ;
     DBG_CHECK_T(id, E_PARM, "registry_value_length id") ;
 
-    REGISTRY_LOCK();
-    _setkey (&_registry_value, id) ;
-    res = nvol3_record_key_and_data_length  (&_regdef_nvol3_entry, (const char*)_registry_value.key) ;
+    _setkey (&reg, id) ;
+    res = nvol3_record_key_and_data_length  (registry->volume, (const char*)reg.key) ;
+    if (res < 0) {
+        REGISTRY_DEFAULT_T def ;
+        REGISTRY_LOCK_SHARED(registry);
+        if (_finddefault (registry, reg.key, &def)) {
+            res = def.length + REGISTRY_KEY_TYPE_LEN ;
+        }
+        REGISTRY_UNLOCK(registry);
+
+    }
     if (res > REGISTRY_KEY_TYPE_LEN) {
         res -= REGISTRY_KEY_TYPE_LEN ;
 	    
@@ -221,11 +699,28 @@ registry_value_length (REGISTRY_KEY_T id)
         res = 0 ;
 
     }
-    REGISTRY_UNLOCK();
 
     return res ;
 }
 
+/**
+ * @brief      get the value length, checksum and slot without reading FLASH.
+ *              Defaults have no slot and return E_NOTFOUND.
+ * @param[in]   id
+ * @param[out]  info
+ * @return      EOK or E_NOTFOUND
+ */
+int32_t
+registry_value_info_r (REGISTRY_T* registry, REGISTRY_KEY_T id, NVOL3_RECORD_INFO_T* info)
+{
+    NVOL3_REGISTRY_T reg ;
+    DBG_CHECK_T(id && info, E_PARM, "registry_value_info id") ;
+
+    _setkey (&reg, id) ;
+    return nvol3_record_info (registry->volume, (const char*)reg.key,
+            info) ;
+}
+
 /**
  * @brief      get the value
  * @param[in]   id
@@ -234,163 +729,1111 @@ registry_value_length (REGISTRY_KEY_T id)
  * @return      length or < 0 (status)
  */
 int32_t
-registry_value_get (REGISTRY_KEY_T id, char* value, unsigned int length)
+registry_value_get_r (REGISTRY_T* registry, REGISTRY_KEY_T id, char* value, unsigned int length)
 {
     int32_t res ;
+    NVOL3_REGISTRY_T reg ;
     DBG_CHECK_T(id, E_PARM, "registry_value_get id") ;
 
-    REGISTRY_LOCK();
-    _setkey (&_registry_value, id) ;
+    _setkey (&reg, id) ;
     memset(value, 0, length) ;
-    if ((res = nvol3_record_get(&_regdef_nvol3_entry,
-            (NVOL3_RECORD_T*)&_registry_value)) > REGISTRY_KEY_TYPE_LEN) {
-        res -= REGISTRY_KEY_TYPE_LEN ;
-        if (value && (length > 0)) {
-            res = (int)length <= res ? (int)length : res ;
-            memcpy(value, _registry_value.value, res) ;
-        }
-	    
-    } else if (res >= 0) {
-        res = E_INVAL ;
+    res = nvol3_record_get(registry->volume, (NVOL3_RECORD_T*)&reg) ;
+    if (res == E_NOTFOUND) {
+        res = _getdefault (registry, &reg) ;
+    }
+
+    return _getvalue (&reg, res, value, length) ;
+}
+
+static int32_t
+registry_visit_cb (const char * key, const uint8_t * data, uint32_t length,
+                    uintptr_t ctx)
+{
+    REGISTRY_VISIT_CTX_T * visit = (REGISTRY_VISIT_CTX_T *) ctx ;
+    char id[REGISTRY_KEY_LENGTH+1] ;
 
+    if (!length) {
+        return visit->skip_empty ? EOK : E_INVAL ;
     }
-    REGISTRY_UNLOCK();
+    memcpy (id, key, REGISTRY_KEY_LENGTH) ;
+    id[REGISTRY_KEY_LENGTH] = '\0' ;
 
-    return res ;
+    return visit->cb (id, (const char*)data, length, visit->ctx) ;
 }
 
 /**
- * @brief      set the value
+ * @brief      pass the value to cb without copying it. The value is valid
+ *              only for the duration of the callback, which must not change
+ *              the registry.
  * @param[in]   id
- * @param[in]   value
- * @param[in]   length
- * @return      length or < 0 (status)
+ * @param[in]   cb
+ * @param[in]   ctx
+ * @return      status returned by cb, E_NOTFOUND or E_INVAL (empty value)
  */
 int32_t
-registry_value_set (REGISTRY_KEY_T id, const char* value, unsigned int length)
+registry_value_visit_r (REGISTRY_T* registry, REGISTRY_KEY_T id, REGISTRY_VISIT_T cb, uintptr_t ctx)
 {
     int32_t res ;
-    DBG_CHECK_T(value, E_PARM, "registry_value_set val") ;
-    DBG_CHECK_T(id, E_PARM, "registry_value_set id") ;
-    if (length > REGISTRY_VALUE_LENGT_MAX) return E_PARM ;
-
-    REGISTRY_LOCK();
-    _setkey (&_registry_value, id) ;
-    memcpy(_registry_value.value, value, length) ;
+    NVOL3_REGISTRY_T reg ;
+    REGISTRY_VISIT_CTX_T visit = { cb, ctx, false } ;
+    DBG_CHECK_T(id && cb, E_PARM, "registry_value_visit id") ;
+
+    _setkey (&reg, id) ;
+    REGISTRY_LOCK_SHARED(registry);
+    res = nvol3_record_visit (registry->volume, (const char*)reg.key,
+            registry_visit_cb, (uintptr_t)&visit) ;
+    if (res == E_NOTFOUND) {
+        REGISTRY_DEFAULT_T def ;
+        if (_finddefault (registry, reg.key, &def)) {
+            res = registry_visit_cb (reg.key, (const uint8_t*)def.value,
+                    def.length, (uintptr_t)&visit) ;
+        }
 
-    res =  nvol3_record_set (&_regdef_nvol3_entry,
-            (NVOL3_RECORD_T*)&_registry_value, length + REGISTRY_KEY_TYPE_LEN) ;
-    REGISTRY_UNLOCK();
+    }
+    REGISTRY_UNLOCK(registry);
 
     return res ;
-
 }
 
-/*
- * Simple iterator. Should only be used by one client at a time!
+/**
+ * @brief      pass every value to cb without copying it, in no particular
+ *              order, followed by the defaults not in the volume. Stops at
+ *              the first callback not returning EOK.
+ * @param[in]   cb
+ * @param[in]   ctx
+ * @return      EOK or status returned by cb
  */
-static NVOL3_ITERATOR_T     _registry_it ;
-static char                 _registry_key[REGISTRY_KEY_LENGTH+1] ;
-
-static int32_t
-reg_cmp (REGISTRY_KEY_T first, REGISTRY_KEY_T second)
-{
-	return strcmp (first, second) ;
-}
-
 int32_t
-registry_first (REGISTRY_KEY_T* key, char* value, int length)
+registry_foreach_r (REGISTRY_T* registry, REGISTRY_VISIT_T cb, uintptr_t ctx)
 {
     int32_t res ;
-    DBG_CHECK_T(value, E_PARM, "registry_first val") ;
-    DBG_CHECK_T(key, E_PARM, "registry_first id") ;
-
-    REGISTRY_LOCK();
-    if ((res = nvol3_record_first (&_regdef_nvol3_entry,
-            (NVOL3_RECORD_T*)&_registry_value, &_registry_it, reg_cmp)) >
-            REGISTRY_KEY_TYPE_LEN) {
-        res -= REGISTRY_KEY_TYPE_LEN ;
-        if (res < length) {
-            length = res ;
-		
+    unsigned int i ;
+    NVOL3_REGISTRY_T reg ;
+    REGISTRY_DEFAULT_T def ;
+    REGISTRY_VISIT_CTX_T visit = { cb, ctx, true } ;
+    DBG_CHECK_T(cb, E_PARM, "registry_foreach cb") ;
+
+    REGISTRY_LOCK_SHARED(registry);
+    res = nvol3_record_foreach (registry->volume, registry_visit_cb,
+            (uintptr_t)&visit) ;
+    for (i = 0 ; (res == EOK) && _defaultat (registry, i, &def) ; i++) {
+        _setkey (&reg, def.id) ;
+        if (nvol3_record_status (registry->volume, reg.key) == E_NOTFOUND) {
+            res = registry_visit_cb (reg.key, (const uint8_t*)def.value,
+                    def.length, (uintptr_t)&visit) ;
         }
-        memcpy(value, (char*)_registry_value.value, length) ;
-        strncpy(_registry_key, _registry_value.key, REGISTRY_KEY_LENGTH) ;
-        _registry_key[REGISTRY_KEY_LENGTH] = '\0' ;
-        *key = _registry_key  ;
-
-    } else if (res >= 0) {
-        res = E_INVAL ;
 
     }
-    REGISTRY_UNLOCK();
+    REGISTRY_UNLOCK(registry);
 
     return res ;
 }
 
-int32_t
-registry_next (REGISTRY_KEY_T* key, char* value, int length)
+typedef struct REGISTRY_VALUES_CTX_S {
+    REGISTRY_T *            registry ;
+    REGISTRY_VALUE_T *      values ;
+} REGISTRY_VALUES_CTX_T ;
+
+static void
+registry_values_cb (uint32_t i, const uint8_t * data, int32_t length,
+                    uintptr_t ctx)
 {
-    int32_t res ;
-    DBG_CHECK_T(value, E_PARM, "registry_next val") ;
-    DBG_CHECK_T(key, E_PARM, "registry_next id") ;
+    REGISTRY_VALUES_CTX_T * values = (REGISTRY_VALUES_CTX_T *) ctx ;
+    REGISTRY_VALUE_T * v = &values->values[i] ;
+
+    if (length == E_NOTFOUND) {
+        REGISTRY_DEFAULT_T def ;
+        char key[REGISTRY_KEY_LENGTH] ;
+        strncpy (key, v->id, REGISTRY_KEY_LENGTH) ;
+        if (_finddefault (values->registry, key, &def)) {
+            data = (const uint8_t*)def.value ;
+            length = def.length ;
+        }
 
-    REGISTRY_LOCK();
-    if ((res = nvol3_record_next (&_regdef_nvol3_entry,
-            (NVOL3_RECORD_T*)&_registry_value, &_registry_it)) >
-            REGISTRY_KEY_TYPE_LEN) {
-        res -= REGISTRY_KEY_TYPE_LEN ;
-        if (res < length) {
-            length = res ;
-		
+    }
+    if (length > 0) {
+        if (v->value && (v->length > 0)) {
+            length = (int)v->length <= length ? (int)v->length : length ;
+            memcpy (v->value, data, length) ;
         }
-        memcpy(value, (char*)_registry_value.value, length) ;
-        strncpy(_registry_key, _registry_value.key, REGISTRY_KEY_LENGTH) ;
-        _registry_key[REGISTRY_KEY_LENGTH] = '\0' ;
-        *key = _registry_key  ;
 
-    } else if (res >= 0) {
-        res = E_INVAL ;
+    } else if (length == 0) {
+        length = E_INVAL ;
 
     }
-    REGISTRY_UNLOCK();
-
-    return res ;
+    v->res = length ;
 }
 
-
-
+/**
+ * @brief      get many values with one pass over the registry. Each res is
+ *              set like the return of registry_value_get().
+ * @param[in,out]   values
+ * @param[in]   count
+ * @return      EOK or < 0 (status)
+ */
+int32_t
+registry_values_get_r (REGISTRY_T* registry, REGISTRY_VALUE_T* values, unsigned int count)
+{
+    char keys[CFG_REGISTRY_VALUES_BATCH][REGISTRY_KEY_LENGTH] ;
+    const char * ids[CFG_REGISTRY_VALUES_BATCH] ;
+    REGISTRY_VALUES_CTX_T ctx = { registry, values } ;
+    int32_t res = EOK ;
+    unsigned int i, n ;
+    DBG_CHECK_T(values || !count, E_PARM, "registry_values_get values") ;
+
+    REGISTRY_LOCK_SHARED(registry);
+    for ( ; count && (res == EOK) ; values += n, count -= n) {
+        ctx.values = values ;
+        n = count < CFG_REGISTRY_VALUES_BATCH ?
+                count : CFG_REGISTRY_VALUES_BATCH ;
+        for (i = 0 ; i < n ; i++) {
+            strncpy (keys[i], values[i].id, REGISTRY_KEY_LENGTH) ;
+            ids[i] = keys[i] ;
+            if (values[i].value) {
+                memset (values[i].value, 0, values[i].length) ;
+            }
+        }
+        res = nvol3_record_get_multi (registry->volume, ids, n,
+                registry_values_cb, (uintptr_t)&ctx) ;
+    }
+    REGISTRY_UNLOCK(registry);
+
+    return res ;
+}
+
+/**
+ * @brief      set the value
+ * @param[in]   id
+ * @param[in]   value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_value_set_r (REGISTRY_T* registry, REGISTRY_KEY_T id, const char* value, unsigned int length)
+{
+    int32_t res ;
+    bool notify ;
+    bool deflt ;
+    NVOL3_REGISTRY_T reg ;
+    DBG_CHECK_T(value, E_PARM, "registry_value_set val") ;
+    DBG_CHECK_T(id, E_PARM, "registry_value_set id") ;
+    if (length > REGISTRY_VALUE_LENGT_MAX) return E_PARM ;
+
+    REGISTRY_LOCK(registry);
+    _setkey (&reg, id) ;
+    deflt = _setdefault (registry, &reg, value, length, &res) ;
+    if (!deflt) {
+        memcpy(reg.value, value, length) ;
+        res =  nvol3_record_set (registry->volume,
+                (NVOL3_RECORD_T*)&reg, length + REGISTRY_KEY_TYPE_LEN) ;
+    }
+    notify = (res == EOK) && _watch_changed (registry, reg.key) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, reg.key) ;
+    }
+
+    return deflt && (res == E_NOTFOUND) ? EOK : res ;
+
+}
+
+/**
+ * @brief      Resolve the key for registry_value_get_h() and
+ *              registry_value_set_h().
+ * @param[in]   id
+ * @param[out]  handle
+ * @return      EOK or E_NOTFOUND, the handle can be used in both cases
+ */
+int32_t
+registry_key_resolve_r (REGISTRY_T* registry, REGISTRY_KEY_T id, REGISTRY_HANDLE_T* handle)
+{
+    DBG_CHECK_T(id, E_PARM, "registry_key_resolve id") ;
+    DBG_CHECK_T(handle, E_PARM, "registry_key_resolve handle") ;
+
+    strncpy (handle->key, id, REGISTRY_KEY_LENGTH) ;
+    handle->registry = registry ;
+
+    return nvol3_handle_resolve (registry->volume, handle->key,
+            &handle->h) ;
+}
+
+/**
+ * @brief      get the value through a resolved handle
+ * @param[in]   handle
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_value_get_h (REGISTRY_HANDLE_T* handle, char* value,
+                        unsigned int length)
+{
+    int32_t res ;
+    NVOL3_REGISTRY_T reg ;
+    REGISTRY_T* registry ;
+    DBG_CHECK_T(handle, E_PARM, "registry_value_get_h handle") ;
+    registry = handle->registry ;
+
+    memset(value, 0, length) ;
+    res = nvol3_handle_get (registry->volume, &handle->h,
+            (NVOL3_RECORD_T*)&reg) ;
+    if (res == E_INVALID) {
+        /* deleted, recreated or moved by a sector swap */
+        nvol3_handle_resolve (registry->volume, handle->key, &handle->h) ;
+        res = nvol3_handle_get (registry->volume, &handle->h,
+                (NVOL3_RECORD_T*)&reg) ;
+        if (res == E_INVALID) {
+            res = E_NOTFOUND ;
+        }
+
+    }
+    if (res == E_NOTFOUND) {
+        memcpy (reg.key, handle->key, REGISTRY_KEY_LENGTH) ;
+        res = _getdefault (registry, &reg) ;
+    }
+
+    return _getvalue (&reg, res, value, length) ;
+}
+
+/**
+ * @brief      set the value through a resolved handle
+ * @param[in]   handle
+ * @param[in]   value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_value_set_h (REGISTRY_HANDLE_T* handle, const char* value,
+                        unsigned int length)
+{
+    int32_t res ;
+    bool notify ;
+    bool deflt ;
+    NVOL3_REGISTRY_T reg ;
+    REGISTRY_T* registry ;
+    DBG_CHECK_T(value, E_PARM, "registry_value_set_h val") ;
+    DBG_CHECK_T(handle, E_PARM, "registry_value_set_h handle") ;
+    if (length > REGISTRY_VALUE_LENGT_MAX) return E_PARM ;
+    registry = handle->registry ;
+
+    REGISTRY_LOCK(registry);
+    memcpy(reg.key, handle->key, REGISTRY_KEY_LENGTH) ;
+    deflt = _setdefault (registry, &reg, value, length, &res) ;
+    if (!deflt) {
+        memcpy(reg.value, value, length) ;
+        res =  nvol3_handle_set (registry->volume, &handle->h,
+                (NVOL3_RECORD_T*)&reg, length + REGISTRY_KEY_TYPE_LEN) ;
+    }
+    notify = (res == EOK) && _watch_changed (registry, reg.key) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, reg.key) ;
+    }
+
+    return deflt && (res == E_NOTFOUND) ? EOK : res ;
+
+}
+
+/**
+ * @brief      get the value for a key with its hash computed at compile time
+ * @param[in]   key     see REGISTRY_CKEY()
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_value_get_k_r (REGISTRY_T* registry, const REGISTRY_CKEY_T* key, char* value,
+                        unsigned int length)
+{
+    int32_t res ;
+    NVOL3_REGISTRY_T reg ;
+    DBG_CHECK_T(key, E_PARM, "registry_value_get_k key") ;
+
+    memset(value, 0, length) ;
+    res = nvol3_record_get_hashed (registry->volume, key->key.str,
+            key->hash, (NVOL3_RECORD_T*)&reg) ;
+    if (res == E_NOTFOUND) {
+        memcpy (reg.key, key->key.str, REGISTRY_KEY_LENGTH) ;
+        res = _getdefault (registry, &reg) ;
+    }
+
+    return _getvalue (&reg, res, value, length) ;
+}
+
+/**
+ * @brief      set the value for a key with its hash computed at compile time
+ * @param[in]   key     see REGISTRY_CKEY()
+ * @param[in]   value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_value_set_k_r (REGISTRY_T* registry, const REGISTRY_CKEY_T* key, const char* value,
+                        unsigned int length)
+{
+    int32_t res ;
+    bool notify ;
+    bool deflt ;
+    NVOL3_REGISTRY_T reg ;
+    DBG_CHECK_T(value, E_PARM, "registry_value_set_k val") ;
+    DBG_CHECK_T(key, E_PARM, "registry_value_set_k key") ;
+    if (length > REGISTRY_VALUE_LENGT_MAX) return E_PARM ;
+
+    REGISTRY_LOCK(registry);
+    memcpy(reg.key, key->key.str, REGISTRY_KEY_LENGTH) ;
+    deflt = _setdefault (registry, &reg, value, length, &res) ;
+    if (!deflt) {
+        memcpy(reg.value, value, length) ;
+        res =  nvol3_record_set (registry->volume,
+                (NVOL3_RECORD_T*)&reg, length + REGISTRY_KEY_TYPE_LEN) ;
+    }
+    notify = (res == EOK) && _watch_changed (registry, reg.key) ;
+    REGISTRY_UNLOCK(registry);
+    if (notify) {
+        _watch_notify (registry, reg.key) ;
+    }
+
+    return deflt && (res == E_NOTFOUND) ? EOK : res ;
+
+}
+
+/*
+ * Typed values are a type tag byte followed by the binary value in host byte
+ * order. String values are text, so a leading tag can not be confused with
+ * them.
+ */
+static const uint8_t _registry_type_size[] = {
+    0,                      /* REGISTRY_TYPE_STRING */
+    sizeof(uint32_t),       /* REGISTRY_TYPE_U32 */
+    sizeof(int32_t),        /* REGISTRY_TYPE_I32 */
+    sizeof(uint8_t),        /* REGISTRY_TYPE_BOOL */
+    sizeof(float),          /* REGISTRY_TYPE_FLOAT */
+    0                       /* REGISTRY_TYPE_BLOB */
+} ;
+
+static inline uint8_t
+_gettype (const char* value, int32_t length)
+{
+    if ((length > 0) && ((uint8_t)value[0] > REGISTRY_TYPE_STRING) &&
+            ((uint8_t)value[0] <= REGISTRY_TYPE_BLOB)) {
+        return (uint8_t)value[0] ;
+    }
+
+    return REGISTRY_TYPE_STRING ;
+}
+
+static int32_t
+_settyped (REGISTRY_T* registry, REGISTRY_KEY_T id, uint8_t type, const void* data,
+            unsigned int length)
+{
+    char value[REGISTRY_VALUE_LENGT_MAX] ;
+
+    if (length + 1 > REGISTRY_VALUE_LENGT_MAX) return E_PARM ;
+    value[0] = (char)type ;
+    if (length) {
+        memcpy (&value[1], data, length) ;
+    }
+
+    return registry_value_set_r (registry, id, value, length + 1) ;
+}
+
+/*
+ * Get a fixed size value. Values set as strings, e.g. by older firmware or
+ * with "reg <key> <value>", are parsed.
+ */
+static int32_t
+_getnumber (REGISTRY_T* registry, REGISTRY_KEY_T id, uint8_t type, void* number)
+{
+    char value[REGISTRY_VALUE_LENGT_MAX] ;
+    char* end = value ;
+    int32_t res ;
+
+    res = registry_value_get_r (registry, id, value, REGISTRY_VALUE_LENGT_MAX - 1) ;
+    if (res < 0) {
+        return res ;
+    }
+    if (_gettype (value, res) == type) {
+        if (res != _registry_type_size[type] + 1) return E_FMT ;
+        memcpy (number, &value[1], _registry_type_size[type]) ;
+        return EOK ;
+
+    } else if (_gettype (value, res) != REGISTRY_TYPE_STRING) {
+        return E_FMT ;
+
+    }
+
+    value[res] = '\0' ;
+    switch (type) {
+    case REGISTRY_TYPE_U32:
+        *(uint32_t*)number = strtoul (value, &end, 0) ;
+        break ;
+    case REGISTRY_TYPE_I32:
+        *(int32_t*)number = strtol (value, &end, 0) ;
+        break ;
+    case REGISTRY_TYPE_FLOAT:
+        *(float*)number = strtof (value, &end) ;
+        break ;
+    case REGISTRY_TYPE_BOOL:
+        if (!strcmp (value, "true")) {
+            *(uint8_t*)number = 1 ;
+            end++ ;
+        } else if (!strcmp (value, "false")) {
+            *(uint8_t*)number = 0 ;
+            end++ ;
+        } else {
+            *(uint8_t*)number = strtol (value, &end, 0) ? 1 : 0 ;
+        }
+        break ;
+    }
+
+    return end == value ? E_FMT : EOK ;
+}
+
+/**
+ * @brief      get the type of the value
+ * @param[in]   id
+ * @return      REGISTRY_TYPE_* or < 0 (status)
+ */
+int32_t
+registry_value_type_r (REGISTRY_T* registry, REGISTRY_KEY_T id)
+{
+    char value[1] ;
+    int32_t res = registry_value_get_r (registry, id, value, sizeof(value)) ;
+
+    return res < 0 ? res : _gettype (value, res) ;
+}
+
+int32_t
+registry_get_u32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, uint32_t* value)
+{
+    DBG_CHECK_T(value, E_PARM, "registry_get_u32 val") ;
+    return _getnumber (registry, id, REGISTRY_TYPE_U32, value) ;
+}
+
+int32_t
+registry_set_u32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, uint32_t value)
+{
+    return _settyped (registry, id, REGISTRY_TYPE_U32, &value, sizeof(value)) ;
+}
+
+int32_t
+registry_get_i32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, int32_t* value)
+{
+    DBG_CHECK_T(value, E_PARM, "registry_get_i32 val") ;
+    return _getnumber (registry, id, REGISTRY_TYPE_I32, value) ;
+}
+
+int32_t
+registry_set_i32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, int32_t value)
+{
+    return _settyped (registry, id, REGISTRY_TYPE_I32, &value, sizeof(value)) ;
+}
+
+int32_t
+registry_get_bool_r (REGISTRY_T* registry, REGISTRY_KEY_T id, bool* value)
+{
+    uint8_t b ;
+    int32_t res ;
+    DBG_CHECK_T(value, E_PARM, "registry_get_bool val") ;
+
+    res = _getnumber (registry, id, REGISTRY_TYPE_BOOL, &b) ;
+    if (res == EOK) {
+        *value = b ? true : false ;
+    }
+
+    return res ;
+}
+
+int32_t
+registry_set_bool_r (REGISTRY_T* registry, REGISTRY_KEY_T id, bool value)
+{
+    uint8_t b = value ? 1 : 0 ;
+    return _settyped (registry, id, REGISTRY_TYPE_BOOL, &b, sizeof(b)) ;
+}
+
+int32_t
+registry_get_float_r (REGISTRY_T* registry, REGISTRY_KEY_T id, float* value)
+{
+    DBG_CHECK_T(value, E_PARM, "registry_get_float val") ;
+    return _getnumber (registry, id, REGISTRY_TYPE_FLOAT, value) ;
+}
+
+int32_t
+registry_set_float_r (REGISTRY_T* registry, REGISTRY_KEY_T id, float value)
+{
+    return _settyped (registry, id, REGISTRY_TYPE_FLOAT, &value, sizeof(value)) ;
+}
+
+/**
+ * @brief      get a blob
+ * @param[in]   id
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length of the blob or < 0 (status)
+ */
+int32_t
+registry_get_blob_r (REGISTRY_T* registry, REGISTRY_KEY_T id, void* value, unsigned int length)
+{
+    char blob[REGISTRY_VALUE_LENGT_MAX] ;
+    int32_t res ;
+
+    res = registry_value_get_r (registry, id, blob, REGISTRY_VALUE_LENGT_MAX) ;
+    if (res < 0) {
+        return res ;
+    }
+    if (_gettype (blob, res) != REGISTRY_TYPE_BLOB) {
+        return E_FMT ;
+    }
+    res-- ;
+    if (value) {
+        memcpy (value, &blob[1], (int)length < res ? (int)length : res) ;
+    }
+
+    return res ;
+}
+
+int32_t
+registry_set_blob_r (REGISTRY_T* registry, REGISTRY_KEY_T id, const void* value, unsigned int length)
+{
+    DBG_CHECK_T(value || !length, E_PARM, "registry_set_blob val") ;
+    return _settyped (registry, id, REGISTRY_TYPE_BLOB, value, length) ;
+}
+
+/**
+ * @brief      format a value as returned by registry_value_get() as text,
+ *              blobs as hex
+ * @param[in]   value
+ * @param[in]   length
+ * @param[out]  str
+ * @param[in]   size
+ * @return      length of the text or < 0 (status)
+ */
+int32_t
+registry_value_format (const char* value, int32_t length, char* str,
+                        unsigned int size)
+{
+    uint8_t type = _gettype (value, length) ;
+    union {
+        uint32_t u ;
+        int32_t i ;
+        float f ;
+    } number ;
+    int32_t res = 0 ;
+    int32_t i ;
+
+    if (!size) return E_PARM ;
+    if ((type != REGISTRY_TYPE_STRING) && (type != REGISTRY_TYPE_BLOB) &&
+            (length != _registry_type_size[type] + 1)) {
+        return E_FMT ;
+    }
+    if (_registry_type_size[type]) {
+        memcpy (&number, &value[1], _registry_type_size[type]) ;
+    }
+
+    switch (type) {
+    case REGISTRY_TYPE_STRING:
+        res = snprintf (str, size, "%.*s", (int)length, value) ;
+        break ;
+    case REGISTRY_TYPE_U32:
+        res = snprintf (str, size, "%u", (unsigned int)number.u) ;
+        break ;
+    case REGISTRY_TYPE_I32:
+        res = snprintf (str, size, "%d", (int)number.i) ;
+        break ;
+    case REGISTRY_TYPE_BOOL:
+        res = snprintf (str, size, "%s", value[1] ? "true" : "false") ;
+        break ;
+    case REGISTRY_TYPE_FLOAT:
+        res = snprintf (str, size, "%g", (double)number.f) ;
+        break ;
+    case REGISTRY_TYPE_BLOB:
+        str[0] = '\0' ;
+        for (i = 1 ; (i < length) && ((unsigned int)res + 2 < size) ; i++) {
+            res += snprintf (&str[res], size - res, "%.2x",
+                    (uint8_t)value[i]) ;
+        }
+        break ;
+    }
+    if (res < 0) {
+        return E_FMT ;
+    }
+
+    return (unsigned int)res < size ? res : (int32_t)size - 1 ;
+}
+
+static int32_t
+reg_cmp (REGISTRY_KEY_T first, REGISTRY_KEY_T second)
+{
+	return strcmp (first, second) ;
+}
+
+/**
+ * @brief       Open the iterator and return the first entry.
+ * @note        The iterator is released when the last entry was returned,
+ *              call registry_it_close() when stopping before that.
+ * @param[out]  it
+ * @param[out]  key     valid until the next call with this iterator
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_first_r (REGISTRY_T* registry, REGISTRY_IT_T* it, REGISTRY_KEY_T* key, char* value, int length)
+{
+    int32_t res ;
+    DBG_CHECK_T(it, E_PARM, "registry_first it") ;
+
+    it->registry = registry ;
+    it->def = 0 ;
+    it->next[0] = '\0' ;
+    REGISTRY_LOCK(registry);
+    res = nvol3_snapshot_open (registry->volume, &it->it, reg_cmp) ;
+    REGISTRY_UNLOCK(registry);
+    if (res != EOK) {
+        return res ;
+    }
+
+    return registry_next (it, key, value, length) ;
+}
+
+/**
+ * @brief       Return the next entry of the iterator.
+ * @param[in/out] it
+ * @param[out]  key     valid until the next call with this iterator
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
+int32_t
+registry_next (REGISTRY_IT_T* it, REGISTRY_KEY_T* key, char* value, int length)
+{
+    int32_t res = E_NOTFOUND ;
+    NVOL3_REGISTRY_T reg ;
+    REGISTRY_T* registry ;
+    REGISTRY_DEFAULT_T def ;
+    bool found = false ;
+    DBG_CHECK_T(value, E_PARM, "registry_next val") ;
+    DBG_CHECK_T(key, E_PARM, "registry_next id") ;
+    registry = it->registry ;
+
+    if (it->next[0]) {
+        /* read again, defaults before it were returned meanwhile */
+        memcpy (reg.key, it->next, REGISTRY_KEY_LENGTH) ;
+        it->next[0] = '\0' ;
+        res = nvol3_record_get (registry->volume, (NVOL3_RECORD_T*)&reg) ;
+
+    }
+    if (res == E_NOTFOUND) {
+        res = nvol3_snapshot_next (registry->volume,
+                (NVOL3_RECORD_T*)&reg, &it->it) ;
+
+    }
+
+    /*
+     * Merge the sorted defaults, a key in the volume hides its default.
+     */
+    if ((res >= 0) || (res == E_EOF)) {
+        REGISTRY_LOCK_SHARED(registry);
+        found = _defaultat (registry, it->def, &def) ;
+        REGISTRY_UNLOCK(registry);
+
+    }
+    if (found) {
+        int cmp = -1 ;
+        if (res >= 0) {
+            cmp = strncmp (def.id, reg.key, REGISTRY_KEY_LENGTH) ;
+        }
+        if (cmp <= 0) {
+            it->def++ ;
+        }
+        if (cmp < 0) {
+            if (res >= 0) {
+                memcpy (it->next, reg.key, REGISTRY_KEY_LENGTH) ;
+                it->next[REGISTRY_KEY_LENGTH] = '\0' ;
+            }
+            memcpy (value, def.value, (int)def.length < length ?
+                    (int)def.length : length) ;
+            strncpy (it->key, def.id, REGISTRY_KEY_LENGTH) ;
+            it->key[REGISTRY_KEY_LENGTH] = '\0' ;
+            *key = it->key ;
+            return def.length ;
+        }
+
+    }
+
+    if (res > REGISTRY_KEY_TYPE_LEN) {
+        res -= REGISTRY_KEY_TYPE_LEN ;
+        if (res < length) {
+            length = res ;
+		
+        }
+        memcpy(value, (char*)reg.value, length) ;
+        strncpy(it->key, reg.key, REGISTRY_KEY_LENGTH) ;
+        it->key[REGISTRY_KEY_LENGTH] = '\0' ;
+        *key = it->key  ;
+
+    } else {
+        registry_it_close (it) ;
+        if (res >= 0) {
+            res = E_INVAL ;
+
+        }
+
+    }
+
+    return res ;
+}
+
+/**
+ * @brief       Release the iterator, can be called more than once.
+ * @param[in/out] it
+ */
 void
-registry_log_status (void)
+registry_it_close (REGISTRY_IT_T* it)
 {
-    REGISTRY_LOCK();
-    nvol3_entry_log_status (&_regdef_nvol3_entry, 1) ;
-    REGISTRY_UNLOCK();
+    nvol3_snapshot_close (it->registry->volume, &it->it) ;
 }
 
 
 
+/**
+ * @brief       Call cb after a value with a key starting with prefix was set
+ *              or deleted. The registry may be used from the callback.
+ * @param[in]   prefix  key or prefix, 0 or "" for all keys
+ * @param[in]   cb      called with the key, or 0 if any key may have changed
+ * @param[in]   ctx
+ * @return      watch id for registry_unwatch() or < 0 (status)
+ */
+int32_t
+registry_watch_r (REGISTRY_T* registry, REGISTRY_KEY_T prefix, REGISTRY_WATCH_T cb, uintptr_t ctx)
+{
+    int32_t res = E_FULL ;
+    unsigned int i ;
+    DBG_CHECK_T(cb, E_PARM, "registry_watch cb") ;
+    if (prefix && (strlen (prefix) > REGISTRY_KEY_LENGTH)) return E_PARM ;
+
+    REGISTRY_LOCK(registry);
+    for (i = 0 ; i < CFG_REGISTRY_WATCH_MAX ; i++) {
+        if (!registry->watchers[i].cb) {
+            memset (registry->watchers[i].prefix, 0, REGISTRY_KEY_LENGTH) ;
+            registry->watchers[i].len = 0 ;
+            if (prefix) {
+                registry->watchers[i].len = strlen (prefix) ;
+                memcpy (registry->watchers[i].prefix, prefix,
+                        registry->watchers[i].len) ;
+            }
+            registry->watchers[i].cb = cb ;
+            registry->watchers[i].ctx = ctx ;
+            registry->watch_count++ ;
+            res = i ;
+            break ;
+        }
+    }
+    REGISTRY_UNLOCK(registry);
+
+    return res ;
+}
+
+/**
+ * @brief       Remove a watch. A notification already being delivered may
+ *              still call it once.
+ * @param[in]   id      returned by registry_watch()
+ */
+void
+registry_unwatch_r (REGISTRY_T* registry, int32_t id)
+{
+    if ((id < 0) || (id >= CFG_REGISTRY_WATCH_MAX)) return ;
+
+    REGISTRY_LOCK(registry);
+    if (registry->watchers[id].cb) {
+        registry->watchers[id].cb = 0 ;
+        registry->watch_count-- ;
+    }
+    REGISTRY_UNLOCK(registry);
+}
+
+/**
+ * @brief       Collect notifications for a bulk update until
+ *              registry_watch_release(), calls can be nested.
+ */
+void
+registry_watch_hold_r (REGISTRY_T* registry)
+{
+    REGISTRY_LOCK(registry);
+    registry->watch_hold++ ;
+    REGISTRY_UNLOCK(registry);
+}
+
+/**
+ * @brief       Deliver the notifications collected since registry_watch_hold(),
+ *              each changed key once.
+ */
+void
+registry_watch_release_r (REGISTRY_T* registry)
+{
+    char queue[CFG_REGISTRY_WATCH_QUEUE][REGISTRY_KEY_LENGTH] ;
+    unsigned int i, n = 0 ;
+
+    REGISTRY_LOCK(registry);
+    if (registry->watch_hold && !--registry->watch_hold) {
+        n = registry->watch_queued ;
+        if (n <= CFG_REGISTRY_WATCH_QUEUE) {
+            memcpy (queue, registry->watch_queue, n * REGISTRY_KEY_LENGTH) ;
+        }
+        registry->watch_queued = 0 ;
+    }
+    REGISTRY_UNLOCK(registry);
+
+    if (n > CFG_REGISTRY_WATCH_QUEUE) {
+        _watch_notify (registry, 0) ;
+    } else {
+        for (i = 0 ; i < n ; i++) {
+            _watch_notify (registry, queue[i]) ;
+        }
+    }
+}
+
+void
+registry_log_status_r (REGISTRY_T* registry)
+{
+    REGISTRY_LOCK_SHARED(registry);
+    nvol3_entry_log_status (registry->volume, 1) ;
+    REGISTRY_UNLOCK(registry);
+}
+
+
+
+/*
+ * The default registry.
+ */
+int32_t
+registry_erase (void)
+{
+    return registry_erase_r (&_registry) ;
+}
+
+int32_t
+registry_set_defaults (const REGISTRY_DEFAULT_T* defaults, unsigned int count)
+{
+    return registry_set_defaults_r (&_registry, defaults, count) ;
+}
+
+int32_t
+registry_set_default_image (const PHASH_T* image)
+{
+    return registry_set_default_image_r (&_registry, image) ;
+}
+
+bool
+registry_value_valid (REGISTRY_KEY_T id)
+{
+    return registry_value_valid_r (&_registry, id) ;
+}
+
+int32_t
+registry_value_length (REGISTRY_KEY_T id)
+{
+    return registry_value_length_r (&_registry, id) ;
+}
+
+int32_t
+registry_value_info (REGISTRY_KEY_T id, NVOL3_RECORD_INFO_T* info)
+{
+    return registry_value_info_r (&_registry, id, info) ;
+}
+
+int32_t
+registry_value_get (REGISTRY_KEY_T id, char* value, unsigned int length)
+{
+    return registry_value_get_r (&_registry, id, value, length) ;
+}
+
+int32_t
+registry_value_set (REGISTRY_KEY_T id, const char* value, unsigned int length)
+{
+    return registry_value_set_r (&_registry, id, value, length) ;
+}
+
+int32_t
+registry_value_delete (REGISTRY_KEY_T id)
+{
+    return registry_value_delete_r (&_registry, id) ;
+}
+
+int32_t
+registry_values_get (REGISTRY_VALUE_T* values, unsigned int count)
+{
+    return registry_values_get_r (&_registry, values, count) ;
+}
+
+int32_t
+registry_value_visit (REGISTRY_KEY_T id, REGISTRY_VISIT_T cb, uintptr_t ctx)
+{
+    return registry_value_visit_r (&_registry, id, cb, ctx) ;
+}
+
+int32_t
+registry_foreach (REGISTRY_VISIT_T cb, uintptr_t ctx)
+{
+    return registry_foreach_r (&_registry, cb, ctx) ;
+}
+
+int32_t
+registry_key_resolve (REGISTRY_KEY_T id, REGISTRY_HANDLE_T* handle)
+{
+    return registry_key_resolve_r (&_registry, id, handle) ;
+}
+
+int32_t
+registry_value_get_k (const REGISTRY_CKEY_T* key, char* value, unsigned int length)
+{
+    return registry_value_get_k_r (&_registry, key, value, length) ;
+}
+
+int32_t
+registry_value_set_k (const REGISTRY_CKEY_T* key, const char* value, unsigned int length)
+{
+    return registry_value_set_k_r (&_registry, key, value, length) ;
+}
+
+int32_t
+registry_value_type (REGISTRY_KEY_T id)
+{
+    return registry_value_type_r (&_registry, id) ;
+}
+
+int32_t
+registry_get_u32 (REGISTRY_KEY_T id, uint32_t* value)
+{
+    return registry_get_u32_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_set_u32 (REGISTRY_KEY_T id, uint32_t value)
+{
+    return registry_set_u32_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_get_i32 (REGISTRY_KEY_T id, int32_t* value)
+{
+    return registry_get_i32_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_set_i32 (REGISTRY_KEY_T id, int32_t value)
+{
+    return registry_set_i32_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_get_bool (REGISTRY_KEY_T id, bool* value)
+{
+    return registry_get_bool_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_set_bool (REGISTRY_KEY_T id, bool value)
+{
+    return registry_set_bool_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_get_float (REGISTRY_KEY_T id, float* value)
+{
+    return registry_get_float_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_set_float (REGISTRY_KEY_T id, float value)
+{
+    return registry_set_float_r (&_registry, id, value) ;
+}
+
+int32_t
+registry_get_blob (REGISTRY_KEY_T id, void* value, unsigned int length)
+{
+    return registry_get_blob_r (&_registry, id, value, length) ;
+}
+
+int32_t
+registry_set_blob (REGISTRY_KEY_T id, const void* value, unsigned int length)
+{
+    return registry_set_blob_r (&_registry, id, value, length) ;
+}
+
+int32_t
+registry_first (REGISTRY_IT_T* it, REGISTRY_KEY_T* key, char* value, int length)
+{
+    return registry_first_r (&_registry, it, key, value, length) ;
+}
+
+int32_t
+registry_watch (REGISTRY_KEY_T prefix, REGISTRY_WATCH_T cb, uintptr_t ctx)
+{
+    return registry_watch_r (&_registry, prefix, cb, ctx) ;
+}
+
+void
+registry_unwatch (int32_t id)
+{
+    registry_unwatch_r (&_registry, id) ;
+}
+
+void
+registry_watch_hold (void)
+{
+    registry_watch_hold_r (&_registry) ;
+}
+
+void
+registry_watch_release (void)
+{
+    registry_watch_release_r (&_registry) ;
+}
+
+void
+registry_log_status (void)
+{
+    registry_log_status_r (&_registry) ;
+}
+
+
 #if CFG_STRSUB_USE
 int32_t
 registry_strsub_cb (STRSUB_REPLACE_CB cb, const char * str, size_t len,
                     uint32_t offset, uintptr_t arg)
 {
     int32_t res  ;
+    NVOL3_REGISTRY_T reg ;
+
+    if (len > REGISTRY_KEY_LENGTH) return E_INVAL ;
 
-    REGISTRY_LOCK();
-    memset (&_registry_value, 0, sizeof(_registry_value)) ;
-    strncpy (_registry_value.key, str, len) ;
+    memset (reg.key, 0, sizeof(reg.key)) ;
+    strncpy (reg.key, str, len) ;
 
-    if ((res = nvol3_record_get(&_regdef_nvol3_entry,
-            (NVOL3_RECORD_T*)&_registry_value)) > REGISTRY_KEY_TYPE_LEN) {
+    res = nvol3_record_get(_registry.volume, (NVOL3_RECORD_T*)&reg) ;
+    if (res == E_NOTFOUND) {
+        res = _getdefault (&_registry, &reg) ;
+    }
+    if (res > REGISTRY_KEY_TYPE_LEN) {
         res -= REGISTRY_KEY_TYPE_LEN ;
-        res = cb (_registry_value.value, res, offset, arg) ;
+        if (_gettype (reg.value, res) != REGISTRY_TYPE_STRING) {
+            char str[REGISTRY_VALUE_LENGT_MAX] ;
+            res = registry_value_format (reg.value, res, str, sizeof(str)) ;
+            if (res >= 0) {
+                res = cb (str, res, offset, arg) ;
+            }
+
+        } else {
+            res = cb (reg.value, res, offset, arg) ;
+
+        }
 
     } else if (res >= 0) {
         res = E_INVAL ;
 
     }
-    REGISTRY_UNLOCK();
 
     return res ;
 }
@@ -27,6 +27,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <nvram/nvol3.h>
+#include <common/phash.h>
+#include "registrykey.h"
 
 #define DBG_MESSAGE_REGISTRY(severity, fmt_str, ...)        DBG_MESSAGE_T_REPORT (DBG_MESSAGE_LOGGER_TYPE(severity,0), 0, fmt_str, ##__VA_ARGS__)
 #define DBG_ASSERT_REGISTRY                                 DBG_ASSERT_T
@@ -36,8 +39,29 @@
 /* Constants.                                                                */
 /*===========================================================================*/
 
-#define REGISTRY_KEY_LENGTH                 24
 #define REGISTRY_VALUE_LENGT_MAX            224
+#define REGISTRY_HASHSIZE                   53
+
+/*
+ * With CFG_REGISTRY_INDEX_ONLY the lookup table keeps a 32 bit hash of each
+ * key instead of the key, keys are confirmed by reading them from FLASH.
+ */
+#ifndef CFG_REGISTRY_INDEX_ONLY
+#define CFG_REGISTRY_INDEX_ONLY             0
+#endif
+#if CFG_REGISTRY_INDEX_ONLY
+#define REGISTRY_KEYSPEC                    DICTIONARY_KEYSPEC_FINGERPRINT(6)
+#else
+#define REGISTRY_KEYSPEC                    DICTIONARY_KEYSPEC_BINARY(6)
+#endif
+
+/**
+ * @brief   macro to declare the nvol3 volume of a registry for
+ *          REGISTRY_CONFIG_T. map can be 0 if FLASH is not memory mapped.
+ */
+#define REGISTRY_VOLUME_DECL(name, read, write, erase, map, sector1, sector2, sector_size)  \
+        NVOL3_MAPPED_INSTANCE_DECL(name, read, write, erase, map, sector1, sector2, sector_size, \
+        REGISTRY_KEY_LENGTH, REGISTRY_KEYSPEC, REGISTRY_HASHSIZE, REGISTRY_VALUE_LENGT_MAX, 0, 0, NVOL3_SECTOR_VERSION)
 
 /*===========================================================================*/
 /* Data structures and types.                                                */
@@ -45,6 +69,94 @@
 
 typedef const char* REGISTRY_KEY_T ;
 
+/**
+ * @brief   A registry opened with registry_open().
+ */
+typedef struct REGISTRY_S REGISTRY_T ;
+
+/**
+ * @brief   Factory default of a key, see registry_set_defaults(). Values are
+ *          stored the same way as with registry_value_set().
+ */
+typedef struct REGISTRY_DEFAULT_S {
+    REGISTRY_KEY_T          id ;
+    const char*             value ;
+    unsigned int            length ;
+} REGISTRY_DEFAULT_T ;
+
+/**
+ * @brief   macro for a string default in a const REGISTRY_DEFAULT_T table,
+ *          the terminating NUL is part of the value.
+ */
+#define REGISTRY_DEFAULT(id, str)           { id, str, sizeof(str) }
+
+/**
+ * @brief   Configuration for registry_open().
+ */
+typedef struct REGISTRY_CONFIG_S {
+    NVOL3_INSTANCE_T*       volume ;        /**< @brief  declared with REGISTRY_VOLUME_DECL() */
+    uint32_t                filter_bits ;   /**< @brief  Bloom filter for absent keys, 0 for none */
+    const REGISTRY_DEFAULT_T* defaults ;    /**< @brief  sorted by key, 0 for none */
+    unsigned int            default_count ;
+    const PHASH_T*          default_image ; /**< @brief  built by phashgen, used instead of defaults */
+} REGISTRY_CONFIG_T ;
+
+/*
+ * Value types, see registry_value_type(). Values set with registry_value_set()
+ * are strings.
+ */
+#define REGISTRY_TYPE_STRING                0
+#define REGISTRY_TYPE_U32                   1
+#define REGISTRY_TYPE_I32                   2
+#define REGISTRY_TYPE_BOOL                  3
+#define REGISTRY_TYPE_FLOAT                 4
+#define REGISTRY_TYPE_BLOB                  5
+
+/**
+ * @brief   One key for registry_values_get().
+ */
+typedef struct REGISTRY_VALUE_S {
+    REGISTRY_KEY_T          id ;
+    char*                   value ;
+    unsigned int            length ;
+    int32_t                 res ;           /**< @brief  length or < 0 (status) */
+} REGISTRY_VALUE_T ;
+
+/**
+ * @brief   Callback for registry_watch(), key is 0 if any key may have changed.
+ */
+typedef void (*REGISTRY_WATCH_T)(REGISTRY_KEY_T /*key*/, uintptr_t /*ctx*/) ;
+
+/**
+ * @brief   Callback for registry_value_visit() and registry_foreach(). key is
+ *          NUL terminated, value is not and is only valid during the call.
+ */
+typedef int32_t (*REGISTRY_VISIT_T)(REGISTRY_KEY_T /*key*/, const char* /*value*/, unsigned int /*length*/, uintptr_t /*ctx*/) ;
+
+/**
+ * @brief   Iterator owned by the caller. Iterates the keys present at
+ *          registry_first() and the defaults in sorted order, writes may
+ *          continue meanwhile.
+ */
+typedef struct REGISTRY_IT_S {
+    NVOL3_ITERATOR_T        it ;
+    REGISTRY_T*             registry ;
+    unsigned int            def ;                           /**< @brief  next default */
+    char                    next[REGISTRY_KEY_LENGTH+1] ;  /**< @brief  key read ahead of the defaults */
+    char                    key[REGISTRY_KEY_LENGTH+1] ;   /**< @brief  returned key */
+} REGISTRY_IT_T ;
+
+/**
+ * @brief   Key resolved with registry_key_resolve(). Repeated access through
+ *          the handle skips copying and hashing the key. A handle must not be
+ *          used by more than one thread at a time.
+ */
+typedef struct REGISTRY_HANDLE_S {
+    NVOL3_HANDLE_T          h ;
+    REGISTRY_T*             registry ;
+    char                    key[REGISTRY_KEY_LENGTH] ;     /**< @brief  key to resolve the handle again */
+} REGISTRY_HANDLE_T ;
+
 
 /*===========================================================================*/
 /* External declarations.                                                    */
@@ -58,18 +170,93 @@ extern "C" {
     int32_t     registry_start (void) ;
     int32_t     registry_stop (void) ;
     int32_t     registry_erase (void) ;
+    int32_t     registry_set_defaults (const REGISTRY_DEFAULT_T* defaults, unsigned int count) ;
+    int32_t     registry_set_default_image (const PHASH_T* image) ;
 
     bool        registry_value_valid (REGISTRY_KEY_T id) ;
     int32_t     registry_value_length (REGISTRY_KEY_T id) ;
+    int32_t     registry_value_info (REGISTRY_KEY_T id, NVOL3_RECORD_INFO_T* info) ;
     int32_t     registry_value_get (REGISTRY_KEY_T id, char* value, unsigned int length) ;
+    int32_t     registry_values_get (REGISTRY_VALUE_T* values, unsigned int count) ;
     int32_t     registry_value_set (REGISTRY_KEY_T id, const char* value,  unsigned int length) ;
     int32_t     registry_value_delete (REGISTRY_KEY_T id) ;
 
-    int32_t     registry_first (REGISTRY_KEY_T* key, char* value, int length) ;
-    int32_t     registry_next (REGISTRY_KEY_T* key, char* value, int length) ;
+    int32_t     registry_value_visit (REGISTRY_KEY_T id, REGISTRY_VISIT_T cb, uintptr_t ctx) ;
+    int32_t     registry_foreach (REGISTRY_VISIT_T cb, uintptr_t ctx) ;
+
+    int32_t     registry_key_resolve (REGISTRY_KEY_T id, REGISTRY_HANDLE_T* handle) ;
+    int32_t     registry_value_get_h (REGISTRY_HANDLE_T* handle, char* value, unsigned int length) ;
+    int32_t     registry_value_set_h (REGISTRY_HANDLE_T* handle, const char* value, unsigned int length) ;
+
+    int32_t     registry_value_get_k (const REGISTRY_CKEY_T* key, char* value, unsigned int length) ;
+    int32_t     registry_value_set_k (const REGISTRY_CKEY_T* key, const char* value, unsigned int length) ;
+
+    int32_t     registry_value_type (REGISTRY_KEY_T id) ;
+    int32_t     registry_value_format (const char* value, int32_t length, char* str, unsigned int size) ;
+    int32_t     registry_get_u32 (REGISTRY_KEY_T id, uint32_t* value) ;
+    int32_t     registry_set_u32 (REGISTRY_KEY_T id, uint32_t value) ;
+    int32_t     registry_get_i32 (REGISTRY_KEY_T id, int32_t* value) ;
+    int32_t     registry_set_i32 (REGISTRY_KEY_T id, int32_t value) ;
+    int32_t     registry_get_bool (REGISTRY_KEY_T id, bool* value) ;
+    int32_t     registry_set_bool (REGISTRY_KEY_T id, bool value) ;
+    int32_t     registry_get_float (REGISTRY_KEY_T id, float* value) ;
+    int32_t     registry_set_float (REGISTRY_KEY_T id, float value) ;
+    int32_t     registry_get_blob (REGISTRY_KEY_T id, void* value, unsigned int length) ;
+    int32_t     registry_set_blob (REGISTRY_KEY_T id, const void* value, unsigned int length) ;
+
+    int32_t     registry_first (REGISTRY_IT_T* it, REGISTRY_KEY_T* key, char* value, int length) ;
+    int32_t     registry_next (REGISTRY_IT_T* it, REGISTRY_KEY_T* key, char* value, int length) ;
+    void        registry_it_close (REGISTRY_IT_T* it) ;
+
+    int32_t     registry_watch (REGISTRY_KEY_T prefix, REGISTRY_WATCH_T cb, uintptr_t ctx) ;
+    void        registry_unwatch (int32_t id) ;
+    void        registry_watch_hold (void) ;
+    void        registry_watch_release (void) ;
 
     void        registry_log_status (void) ;
 
+    /*
+     * Independent registries, each on its own volume with its own lock. The
+     * functions above use the default registry, the _h functions and
+     * registry_next() the registry the handle or iterator was opened on.
+     */
+    REGISTRY_T* registry_open (const REGISTRY_CONFIG_T* config) ;
+    void        registry_close (REGISTRY_T* registry) ;
+    REGISTRY_T* registry_default (void) ;
+
+    int32_t     registry_erase_r (REGISTRY_T* registry) ;
+    int32_t     registry_set_defaults_r (REGISTRY_T* registry, const REGISTRY_DEFAULT_T* defaults, unsigned int count) ;
+    int32_t     registry_set_default_image_r (REGISTRY_T* registry, const PHASH_T* image) ;
+    bool        registry_value_valid_r (REGISTRY_T* registry, REGISTRY_KEY_T id) ;
+    int32_t     registry_value_length_r (REGISTRY_T* registry, REGISTRY_KEY_T id) ;
+    int32_t     registry_value_info_r (REGISTRY_T* registry, REGISTRY_KEY_T id, NVOL3_RECORD_INFO_T* info) ;
+    int32_t     registry_value_get_r (REGISTRY_T* registry, REGISTRY_KEY_T id, char* value, unsigned int length) ;
+    int32_t     registry_values_get_r (REGISTRY_T* registry, REGISTRY_VALUE_T* values, unsigned int count) ;
+    int32_t     registry_value_set_r (REGISTRY_T* registry, REGISTRY_KEY_T id, const char* value,  unsigned int length) ;
+    int32_t     registry_value_delete_r (REGISTRY_T* registry, REGISTRY_KEY_T id) ;
+    int32_t     registry_value_visit_r (REGISTRY_T* registry, REGISTRY_KEY_T id, REGISTRY_VISIT_T cb, uintptr_t ctx) ;
+    int32_t     registry_foreach_r (REGISTRY_T* registry, REGISTRY_VISIT_T cb, uintptr_t ctx) ;
+    int32_t     registry_key_resolve_r (REGISTRY_T* registry, REGISTRY_KEY_T id, REGISTRY_HANDLE_T* handle) ;
+    int32_t     registry_value_get_k_r (REGISTRY_T* registry, const REGISTRY_CKEY_T* key, char* value, unsigned int length) ;
+    int32_t     registry_value_set_k_r (REGISTRY_T* registry, const REGISTRY_CKEY_T* key, const char* value, unsigned int length) ;
+    int32_t     registry_value_type_r (REGISTRY_T* registry, REGISTRY_KEY_T id) ;
+    int32_t     registry_get_u32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, uint32_t* value) ;
+    int32_t     registry_set_u32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, uint32_t value) ;
+    int32_t     registry_get_i32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, int32_t* value) ;
+    int32_t     registry_set_i32_r (REGISTRY_T* registry, REGISTRY_KEY_T id, int32_t value) ;
+    int32_t     registry_get_bool_r (REGISTRY_T* registry, REGISTRY_KEY_T id, bool* value) ;
+    int32_t     registry_set_bool_r (REGISTRY_T* registry, REGISTRY_KEY_T id, bool value) ;
+    int32_t     registry_get_float_r (REGISTRY_T* registry, REGISTRY_KEY_T id, float* value) ;
+    int32_t     registry_set_float_r (REGISTRY_T* registry, REGISTRY_KEY_T id, float value) ;
+    int32_t     registry_get_blob_r (REGISTRY_T* registry, REGISTRY_KEY_T id, void* value, unsigned int length) ;
+    int32_t     registry_set_blob_r (REGISTRY_T* registry, REGISTRY_KEY_T id, const void* value, unsigned int length) ;
+    int32_t     registry_first_r (REGISTRY_T* registry, REGISTRY_IT_T* it, REGISTRY_KEY_T* key, char* value, int length) ;
+    int32_t     registry_watch_r (REGISTRY_T* registry, REGISTRY_KEY_T prefix, REGISTRY_WATCH_T cb, uintptr_t ctx) ;
+    void        registry_unwatch_r (REGISTRY_T* registry, int32_t id) ;
+    void        registry_watch_hold_r (REGISTRY_T* registry) ;
+    void        registry_watch_release_r (REGISTRY_T* registry) ;
+    void        registry_log_status_r (REGISTRY_T* registry) ;
+
 
 
 #ifdef __cplusplus
@@ -28,25 +28,52 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "registry.h"
 #include "shell/corshell.h"
 #include "common/errordef.h"
+#include "common/kvline.h"
+#include "drivers/ramdrv.h"
 
 static int32_t      corshell_reg (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t      corshell_regset (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t      corshell_regadd (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t      corshell_regdel (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t      corshell_regstats (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t      corshell_regerase (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t      corshell_regtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t      corshell_regwatch (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t      corshell_regvalues (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+#ifdef NVOL3_REGINSTANCE_START
+static int32_t      corshell_reginstance (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+#endif
+#if CFG_PORT_POSIX
+static int32_t      corshell_regimport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t      corshell_regexport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t      corshell_regdefaults (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t      corshell_regbench (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+#endif
 
 
 CORSHELL_CMD_LIST_START(registry, 0)
 CORSHELL_CMD_LIST("reg", corshell_reg, "[key] [value]")
+CORSHELL_CMD_LIST("regset", corshell_regset, "<key> <u32|i32|bool|float|blob> <value>")
 CORSHELL_CMD_LIST("regadd", corshell_regadd, "<key> <value>")
 CORSHELL_CMD_LIST("regdel", corshell_regdel, "<key>")
 CORSHELL_CMD_LIST("regstats", corshell_regstats, "")
 CORSHELL_CMD_LIST("regerase", corshell_regerase, "")
 CORSHELL_CMD_LIST("regtest", corshell_regtest, "[repeat]")
+CORSHELL_CMD_LIST("regwatch", corshell_regwatch, "<on [prefix]|off|hold|release|expect <calls> [key|*]>")
+CORSHELL_CMD_LIST("regvalues", corshell_regvalues, "[key] [key] ...")
+#ifdef NVOL3_REGINSTANCE_START
+CORSHELL_CMD_LIST("reginstance", corshell_reginstance, "")
+#endif
+#if CFG_PORT_POSIX
+CORSHELL_CMD_LIST("regimport", corshell_regimport, "<file>")
+CORSHELL_CMD_LIST("regexport", corshell_regexport, "<file>")
+CORSHELL_CMD_LIST("regdefaults", corshell_regdefaults, "<image>")
+CORSHELL_CMD_LIST("regbench", corshell_regbench, "[threads] [iterations] [write interval] [h]")
+#endif
 CORSHELL_CMD_LIST_END()
 
 
@@ -55,26 +82,32 @@ static void
 reg_print (void* ctx, CORSHELL_OUT_FP shell_out, REGISTRY_KEY_T key, char* value, int length)
 {
     char tmp[40] ;
+    char str[REGISTRY_VALUE_LENGT_MAX*2+1] ;
     snprintf(tmp, 40, "%s:", key) ;
+    if (registry_value_format (value, length, str, sizeof(str)) < 0) {
+        str[0] = '\0' ;
+    }
     corshell_print_table(ctx, CORSHELL_OUT_STD, shell_out,
-            tmp, 24, "%s" CORSHELL_NEWLINE, value) ;
+            tmp, 24, "%s" CORSHELL_NEWLINE, str) ;
 }
 
 static uint32_t
 reg_show (void* ctx, CORSHELL_OUT_FP shell_out, const char * search, char * value, uint32_t len)
 {
     uint32_t cnt = 0 ;
+    REGISTRY_IT_T it ;
     REGISTRY_KEY_T key ;
-    int32_t res = registry_first (&key, value, len) ;
+    int32_t res = registry_first (&it, &key, value, len) ;
     while (res >= 0) {
         if (!search || strstr(key, search)) {
-            reg_print (ctx, shell_out, key, value, len) ;
+            reg_print (ctx, shell_out, key, value, res) ;
             cnt++ ;
             
         }
-        res = registry_next (&key, value, len) ;
+        res = registry_next (&it, &key, value, len) ;
 
     }
+    registry_it_close (&it) ;
 
     return cnt ;
 }
@@ -96,7 +129,7 @@ corshell_reg (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
     else if (argc == 2) {
         res = registry_value_get (argv[1], value, REGISTRY_VALUE_LENGT_MAX) ;
         if (res > 0) {
-            reg_print (ctx, shell_out, argv[1], value, REGISTRY_VALUE_LENGT_MAX) ;
+            reg_print (ctx, shell_out, argv[1], value, res) ;
 
         } else {
             cnt = reg_show (ctx, shell_out, argv[1], value, REGISTRY_VALUE_LENGT_MAX) ;
@@ -117,6 +150,59 @@ corshell_reg (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
     return CORSHELL_CMD_E_OK ;
 }
 
+static int32_t
+corshell_regset (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    char blob[REGISTRY_VALUE_LENGT_MAX] ;
+    char* end = 0 ;
+    unsigned long u = 0 ;
+    long l = 0 ;
+    float f = 0 ;
+    unsigned int i = 0 ;
+    int32_t res ;
+
+    if (argc != 4) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    if (!strcmp (argv[2], "u32")) {
+        u = strtoul (argv[3], &end, 0) ;
+    } else if (!strcmp (argv[2], "i32") || !strcmp (argv[2], "bool")) {
+        l = strtol (argv[3], &end, 0) ;
+        if (!strcmp (argv[3], "true")) l = 1, end = argv[3] + 4 ;
+        if (!strcmp (argv[3], "false")) l = 0, end = argv[3] + 5 ;
+    } else if (!strcmp (argv[2], "float")) {
+        f = strtof (argv[3], &end) ;
+    } else if (!strcmp (argv[2], "blob")) {
+        /* hex bytes, e.g. 0a1b2c */
+        for (end = argv[3] ; isxdigit((int)end[0]) && isxdigit((int)end[1]) &&
+                (i < sizeof(blob) - 1) ; i++, end += 2) {
+            char hex[3] = { end[0], end[1], 0 } ;
+            blob[i] = (char)strtoul (hex, 0, 16) ;
+        }
+    }
+    if (!end || *end || (end == argv[3] && strcmp (argv[2], "blob"))) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    switch (argv[2][0]) {
+    case 'u': res = registry_set_u32 (argv[1], (uint32_t)u) ; break ;
+    case 'i': res = registry_set_i32 (argv[1], (int32_t)l) ; break ;
+    case 'b':
+        res = argv[2][1] == 'o' ? registry_set_bool (argv[1], l != 0) :
+                registry_set_blob (argv[1], blob, i) ;
+        break ;
+    default: res = registry_set_float (argv[1], f) ; break ;
+    }
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+        "%s" CORSHELL_NEWLINE, res == EOK ? "OK" : "ERR") ;
+
+    return CORSHELL_CMD_E_OK ;
+}
+
 static int32_t
 corshell_regadd (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
 {
@@ -175,6 +261,11 @@ corshell_regerase (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
 }
 
 
+/*
+ * The test key is created and deleted by name and updated through the
+ * compile time key, both must address the same record.
+ */
+REGISTRY_CKEY_DECL(_regtest_key, "___test___") ;
 
 int32_t
 corshell_regtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
@@ -205,7 +296,7 @@ corshell_regtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
 
     while (repeat--) {
         snprintf(writeval, 16, "%.12u", intval) ;
-        int32_t res = registry_value_set ("___test___", writeval,
+        int32_t res = registry_value_set_k (&_regtest_key, writeval,
                             strlen(writeval)+1) ;
         if (res < 0) {
             corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
@@ -213,7 +304,7 @@ corshell_regtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
             break ;
 
         }
-        res = registry_value_get ("___test___", readval, 16) ;
+        res = registry_value_get_k (&_regtest_key, readval, 16) ;
         if (res < 0) {
             corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
                      "get return %d\r\n", res) ;
@@ -247,4 +338,739 @@ corshell_regtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
 
 }
 
+/*
+ * The watcher of regwatch counts the calls and keeps the last key, "*" for a
+ * call with key 0. "regwatch expect" checks and clears them, so a script can
+ * verify which notifications a change or a hold/release batch delivered.
+ */
+static int32_t      _regwatch_id = -1 ;
+static unsigned int _regwatch_calls ;
+static char         _regwatch_key[REGISTRY_KEY_LENGTH+1] ;
+
+static void
+regwatch_cb (REGISTRY_KEY_T key, uintptr_t ctx)
+{
+    _regwatch_calls++ ;
+    snprintf(_regwatch_key, sizeof(_regwatch_key), "%s", key ? key : "*") ;
+}
+
+static int32_t
+corshell_regwatch (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    unsigned int calls ;
+    bool ok ;
+
+    if (argc < 2) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    if (!strcmp (argv[1], "on")) {
+        if (_regwatch_id >= 0) {
+            registry_unwatch (_regwatch_id) ;
+
+        }
+        _regwatch_calls = 0 ;
+        _regwatch_key[0] = '\0' ;
+        _regwatch_id = registry_watch (argc > 2 ? argv[2] : 0, regwatch_cb, 0) ;
+        if (_regwatch_id < 0) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                    "watch return %d\r\n", _regwatch_id) ;
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+
+    } else if (!strcmp (argv[1], "off")) {
+        registry_unwatch (_regwatch_id) ;
+        _regwatch_id = -1 ;
+
+    } else if (!strcmp (argv[1], "hold")) {
+        registry_watch_hold () ;
+
+    } else if (!strcmp (argv[1], "release")) {
+        registry_watch_release () ;
+
+    } else if (!strcmp (argv[1], "expect") && (argc > 2)) {
+        if (sscanf(argv[2], "%u", &calls) != 1) {
+            return CORSHELL_CMD_E_PARMS ;
+
+        }
+        ok = (calls == _regwatch_calls) &&
+                ((argc < 4) || !strcmp (argv[3], _regwatch_key)) ;
+        if (!ok) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                    "watch called %u times, last '%s', expected %u '%s'\r\n",
+                    _regwatch_calls, _regwatch_key, calls,
+                    argc > 3 ? argv[3] : "") ;
+
+        }
+        _regwatch_calls = 0 ;
+        _regwatch_key[0] = '\0' ;
+        if (!ok) {
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+
+    } else {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    return CORSHELL_CMD_E_OK ;
+}
+
+/*
+ * regvalues reads the keys with registry_values_get() and checks every result
+ * against registry_value_get() and registry_value_visit(). Without keys it
+ * reads all the keys found by registry_foreach(), more than
+ * CFG_REGISTRY_VALUES_BATCH so that several batches are read.
+ */
+#define REGVALUES_MAX           64
+
+typedef struct REGVALUES_S {
+    REGISTRY_VALUE_T        values[REGVALUES_MAX] ;
+    char                    keys[REGVALUES_MAX][REGISTRY_KEY_LENGTH+1] ;
+    char                    buffers[REGVALUES_MAX][REGISTRY_VALUE_LENGT_MAX] ;
+    unsigned int            count ;
+    unsigned int            errors ;
+} REGVALUES_T ;
+
+static REGVALUES_T          _regvalues ;
+
+static int32_t
+regvalues_add_cb (REGISTRY_KEY_T key, const char* value, unsigned int length, uintptr_t ctx)
+{
+    REGVALUES_T * rv = (REGVALUES_T *) ctx ;
+
+    if (rv->count >= REGVALUES_MAX) {
+        return E_FULL ;
+
+    }
+    snprintf(rv->keys[rv->count++], REGISTRY_KEY_LENGTH+1, "%s", key) ;
+
+    return EOK ;
+}
+
+static int32_t
+regvalues_cmp_cb (REGISTRY_KEY_T key, const char* value, unsigned int length, uintptr_t ctx)
+{
+    REGISTRY_VALUE_T * v = (REGISTRY_VALUE_T *) ctx ;
+
+    return (v->res == (int32_t)length) && !memcmp (value, v->value, length) ?
+            EOK : EFAIL ;
+}
+
+static int32_t
+regvalues_foreach_cb (REGISTRY_KEY_T key, const char* value, unsigned int length, uintptr_t ctx)
+{
+    REGVALUES_T * rv = (REGVALUES_T *) ctx ;
+    unsigned int i ;
+
+    for (i = 0 ; i < rv->count ; i++) {
+        if (!strcmp (rv->keys[i], key)) {
+            if (regvalues_cmp_cb (key, value, length,
+                    (uintptr_t)&rv->values[i]) != EOK) {
+                rv->errors++ ;
+
+            }
+            return EOK ;
+
+        }
+
+    }
+    rv->errors++ ;
+
+    return EOK ;
+}
+
+static int32_t
+corshell_regvalues (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    REGVALUES_T * rv = &_regvalues ;
+    char value[REGISTRY_VALUE_LENGT_MAX] ;
+    unsigned int i ;
+    int32_t res ;
+
+    memset (rv, 0, sizeof(REGVALUES_T)) ;
+    if (argc > REGVALUES_MAX + 1) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    } else if (argc > 1) {
+        for (i = 1 ; i < (unsigned int)argc ; i++) {
+            regvalues_add_cb (argv[i], 0, 0, (uintptr_t)rv) ;
+
+        }
+
+    } else {
+        res = registry_foreach (regvalues_add_cb, (uintptr_t)rv) ;
+        if (res != EOK) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                    "foreach return %d\r\n", res) ;
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+
+    }
+
+    for (i = 0 ; i < rv->count ; i++) {
+        rv->values[i].id = rv->keys[i] ;
+        rv->values[i].value = rv->buffers[i] ;
+        rv->values[i].length = REGISTRY_VALUE_LENGT_MAX ;
+
+    }
+    res = registry_values_get (rv->values, rv->count) ;
+    if (res != EOK) {
+        corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                "values get return %d\r\n", res) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+
+    for (i = 0 ; i < rv->count ; i++) {
+        REGISTRY_VALUE_T * v = &rv->values[i] ;
+
+        res = registry_value_get (v->id, value, REGISTRY_VALUE_LENGT_MAX) ;
+        if ((res != v->res) || ((res > 0) && memcmp (value, v->value, res))) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                    "%s: values get %d, value get %d\r\n", v->id, v->res, res) ;
+            rv->errors++ ;
+
+        }
+        res = registry_value_visit (v->id, regvalues_cmp_cb, (uintptr_t)v) ;
+        if (res != (v->res < 0 ? v->res : EOK)) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                    "%s: values get %d, visit %d\r\n", v->id, v->res, res) ;
+            rv->errors++ ;
+
+        }
+
+    }
+
+    if (argc == 1) {
+        registry_foreach (regvalues_foreach_cb, (uintptr_t)rv) ;
+
+    }
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+            "%u values, %u errors\r\n", rv->count, rv->errors) ;
+
+    return rv->errors ? CORSHELL_CMD_E_FAIL : CORSHELL_CMD_E_OK ;
+}
+
+#ifdef NVOL3_REGINSTANCE_START
+/*
+ * reginstance opens a second registry on its own volume and checks that the
+ * same key is independent in both registries, that neither sees the defaults
+ * of the other and that the values are loaded again when it is reopened.
+ */
+REGISTRY_VOLUME_DECL(_reginstance_nvol3_entry,
+        ramdrv_read, ramdrv_write, ramdrv_erase, RAMDRV_MAP,
+        NVOL3_REGINSTANCE_START,
+        NVOL3_REGINSTANCE_START + NVOL3_REGINSTANCE_SECTOR_SIZE,
+        NVOL3_REGINSTANCE_SECTOR_SIZE) ;
+
+static const REGISTRY_DEFAULT_T _reginstance_defaults[] = {
+    REGISTRY_DEFAULT("instance.default", "1"),
+} ;
+
+static const REGISTRY_CONFIG_T _reginstance_config = {
+    &_reginstance_nvol3_entry, 0, _reginstance_defaults,
+    sizeof(_reginstance_defaults) / sizeof(_reginstance_defaults[0]), 0
+} ;
+
+static int32_t
+reginstance_count_cb (REGISTRY_KEY_T key, const char* value, unsigned int length, uintptr_t ctx)
+{
+    (*(unsigned int*)ctx)++ ;
+    return EOK ;
+}
+
+static const char *
+reginstance_check (REGISTRY_T* registry)
+{
+    char value[REGISTRY_VALUE_LENGT_MAX] ;
+    unsigned int cnt = 0 ;
+
+    if ((registry_value_get ("instance.key", value, sizeof(value)) < 0) ||
+            strcmp (value, "first")) {
+        return "instance.key changed in the default registry" ;
+    }
+    if ((registry_value_get_r (registry, "instance.key", value,
+                sizeof(value)) < 0) || strcmp (value, "second")) {
+        return "instance.key changed in the second registry" ;
+    }
+    if (registry_value_get_r (registry, "test", value, sizeof(value)) >= 0) {
+        return "default registry default found" ;
+    }
+    if (registry_value_get ("instance.default", value, sizeof(value)) >= 0) {
+        return "second registry default found" ;
+    }
+    if ((registry_value_get_r (registry, "instance.default", value,
+                sizeof(value)) < 0) || strcmp (value, "1")) {
+        return "second registry default not found" ;
+    }
+    if ((registry_foreach_r (registry, reginstance_count_cb,
+                (uintptr_t)&cnt) != EOK) || (cnt != 2)) {
+        return "second registry not 2 values" ;
+    }
+
+    return 0 ;
+}
+
+static int32_t
+corshell_reginstance (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    REGISTRY_T* registry ;
+    const char * err = 0 ;
+    int32_t res ;
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+              "registry instance testing...\r\n") ;
+
+    registry = registry_open (&_reginstance_config) ;
+    if (!registry) {
+        corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                 "open failed\r\n") ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+    res = registry_erase_r (registry) ;
+    if (res == EOK) {
+        res = registry_value_set ("instance.key", "first", sizeof("first")) ;
+    }
+    if (res == EOK) {
+        res = registry_value_set_r (registry, "instance.key", "second",
+                sizeof("second")) ;
+    }
+    if (res == EOK) {
+        err = reginstance_check (registry) ;
+        registry_close (registry) ;
+        registry = registry_open (&_reginstance_config) ;
+    }
+    if ((res == EOK) && !err) {
+        err = registry ? reginstance_check (registry) : "reopen failed" ;
+    }
+    registry_value_delete ("instance.key") ;
+    registry_close (registry) ;
+
+    if (res != EOK) {
+        corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                 "set return %d\r\n", res) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+    if (err) {
+        corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                 "%s\r\n", err) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+              "done\r\n") ;
+
+    return CORSHELL_CMD_E_OK ;
+}
+#endif
+
+#if CFG_PORT_POSIX
+/**
+ * @brief       Set the registry values read from a file of key/value lines.
+ * @note        The file is read line by line, each value is set as it is
+ *              parsed. Values that do not change are not written again, a
+ *              file can be imported any number of times. Watchers are
+ *              notified once for the whole file.
+ */
+static int32_t
+corshell_regimport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static char line[KVLINE_LENGTH(REGISTRY_KEY_LENGTH, REGISTRY_VALUE_LENGT_MAX)] ;
+    unsigned int lineno = 0 ;
+    unsigned int cnt = 0 ;
+    KVLINE_T kv ;
+    int32_t res = EOK ;
+    FILE * fp ;
+
+    if (argc != 2) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    fp = fopen (argv[1], "r") ;
+    if (!fp) {
+        corshell_print(ctx, CORSHELL_OUT_ERR, shell_out,
+                "unable to open file \"%s\" for read." CORSHELL_NEWLINE, argv[1]) ;
+        return CORSHELL_CMD_E_NOT_FOUND ;
+
+    }
+
+    registry_watch_hold () ;
+    while (fgets (line, sizeof(line), fp)) {
+        lineno++ ;
+        res = kvline_check (line, sizeof(line)) ;
+        if (res != EOK) {
+            corshell_print(ctx, CORSHELL_OUT_ERR, shell_out,
+                    "%s:%u: line too long" CORSHELL_NEWLINE, argv[1], lineno) ;
+            break ;
+
+        }
+        res = kvline_parse (line, &kv) ;
+        if (res == E_EMPTY) {
+            res = EOK ;
+            continue ;
+
+        }
+        if ((res == EOK) && ((kv.key_length > REGISTRY_KEY_LENGTH) ||
+                !kv.value_length ||
+                (kv.value_length > REGISTRY_VALUE_LENGT_MAX))) {
+            res = E_PARM ;
+
+        }
+        if (res == EOK) {
+            res = registry_value_set (kv.key, kv.value, kv.value_length) ;
+
+        }
+        if (res != EOK) {
+            corshell_print(ctx, CORSHELL_OUT_ERR, shell_out,
+                    "%s:%u: error %d" CORSHELL_NEWLINE, argv[1], lineno, res) ;
+            break ;
+
+        }
+        cnt++ ;
+
+    }
+    registry_watch_release () ;
+    fclose (fp) ;
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+        "%u entries imported." CORSHELL_NEWLINE, cnt) ;
+
+    return res == EOK ? CORSHELL_CMD_E_OK : CORSHELL_CMD_E_FAIL ;
+}
+
+/**
+ * @brief       Write all registry values to a file of key/value lines,
+ *              in key order. regimport reads the file back.
+ */
+static int32_t
+corshell_regexport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static char line[KVLINE_LENGTH(REGISTRY_KEY_LENGTH, REGISTRY_VALUE_LENGT_MAX)] ;
+    char value[REGISTRY_VALUE_LENGT_MAX] ;
+    unsigned int cnt = 0 ;
+    REGISTRY_IT_T it ;
+    REGISTRY_KEY_T key ;
+    int32_t status = EOK ;
+    int32_t res ;
+    FILE * fp ;
+
+    if (argc != 2) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    fp = fopen (argv[1], "w") ;
+    if (!fp) {
+        corshell_print(ctx, CORSHELL_OUT_ERR, shell_out,
+                "unable to open file \"%s\" for write." CORSHELL_NEWLINE, argv[1]) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+
+    res = registry_first (&it, &key, value, REGISTRY_VALUE_LENGT_MAX) ;
+    while (res >= 0) {
+        if ((kvline_format (line, sizeof(line), key, value, res) < 0) ||
+                (fprintf (fp, "%s\n", line) < 0)) {
+            status = EFAIL ;
+            break ;
+
+        }
+        cnt++ ;
+        res = registry_next (&it, &key, value, REGISTRY_VALUE_LENGT_MAX) ;
+
+    }
+    registry_it_close (&it) ;
+    if (fclose (fp) != 0) {
+        status = EFAIL ;
+
+    }
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+        "%u entries exported." CORSHELL_NEWLINE, cnt) ;
+
+    return status == EOK ? CORSHELL_CMD_E_OK : CORSHELL_CMD_E_FAIL ;
+}
+
+/**
+ * @brief       Use a table image built by phashgen as the registry defaults
+ *              and look up every key of the image with registry_value_get().
+ * @note        The image replaces the defaults until the next regdefaults.
+ *              A key set in the volume hides its default and is reported.
+ */
+static int32_t
+corshell_regdefaults (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static PHASH_T * image ;
+    char value[REGISTRY_VALUE_LENGT_MAX] ;
+    unsigned int errors = 0 ;
+    const char * key ;
+    const char * def ;
+    PHASH_T * load ;
+    uint32_t i, count ;
+    int32_t res ;
+    long size ;
+    FILE * fp ;
+
+    if (argc != 2) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    fp = fopen (argv[1], "rb") ;
+    if (!fp) {
+        corshell_print(ctx, CORSHELL_OUT_ERR, shell_out,
+                "unable to open file \"%s\" for read." CORSHELL_NEWLINE, argv[1]) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+    fseek (fp, 0, SEEK_END) ;
+    size = ftell (fp) ;
+    rewind (fp) ;
+    load = size > 0 ? malloc (size) : 0 ;
+    res = load && (fread (load, 1, size, fp) == (size_t)size) ? EOK : EFAIL ;
+    fclose (fp) ;
+    if (res == EOK) {
+        res = phash_check (load, size) ;
+    }
+    if (res == EOK) {
+        res = registry_set_default_image (load) ;
+    }
+    if (res != EOK) {
+        corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                "image return %d\r\n", res) ;
+        free (load) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+    /* lookups of the defaults hold the registry lock, none uses the old image */
+    free (image) ;
+    image = load ;
+
+    count = phash_count (image) ;
+    for (i = 0 ; i < count ; i++) {
+        int32_t length = phash_entry (image, i, &key, &def) ;
+
+        res = registry_value_get (key, value, REGISTRY_VALUE_LENGT_MAX) ;
+        if ((res != length) || memcmp (value, def, length)) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                    "%s: get %d, image %d\r\n", key, res, length) ;
+            errors++ ;
+
+        }
+
+    }
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+            "%u defaults, %u errors\r\n", count, errors) ;
+
+    return errors ? CORSHELL_CMD_E_FAIL : CORSHELL_CMD_E_OK ;
+}
+
+#include <pthread.h>
+#include <time.h>
+
+#define REGBENCH_KEYS           8
+#define REGBENCH_THREADS_MAX    16
+
+typedef struct REGBENCH_THREAD_S {
+    pthread_t       thread ;
+    unsigned int    id ;
+    unsigned int    iterations ;
+    unsigned int    interval ;      /* one write every interval operations, 0 for read only */
+    unsigned int    handles ;       /* access through keys resolved once */
+    unsigned int    reads ;
+    unsigned int    writes ;
+    int32_t         status ;
+
+} REGBENCH_THREAD_T ;
+
+static void
+regbench_key (char * key, unsigned int idx)
+{
+    snprintf(key, 16, "___bench%u___", idx % REGBENCH_KEYS) ;
+}
+
+static void*
+regbench_thread (void* arg)
+{
+    REGBENCH_THREAD_T * bench = (REGBENCH_THREAD_T *) arg ;
+    REGISTRY_HANDLE_T handle[REGBENCH_KEYS] ;
+    char key[16] ;
+    char value[16] ;
+    unsigned int i ;
+    int32_t res ;
+
+    if (bench->handles) {
+        for (i = 0; i < REGBENCH_KEYS; i++) {
+            regbench_key (key, i) ;
+            registry_key_resolve (key, &handle[i]) ;
+
+        }
+
+    }
+
+    for (i = 0; i < bench->iterations; i++) {
+        if (bench->interval && ((i % bench->interval) == bench->interval - 1)) {
+            /*
+             * Every thread writes its own key, all threads read all keys.
+             */
+            snprintf(value, 16, "%.12u", i) ;
+            if (bench->handles) {
+                res = registry_value_set_h (
+                        &handle[bench->id % REGBENCH_KEYS],
+                        value, strlen(value)+1) ;
+
+            } else {
+                regbench_key (key, bench->id) ;
+                res = registry_value_set (key, value, strlen(value)+1) ;
+
+            }
+            bench->writes++ ;
+
+        } else {
+            if (bench->handles) {
+                res = registry_value_get_h (
+                        &handle[(i + bench->id) % REGBENCH_KEYS], value, 16) ;
+
+            } else {
+                regbench_key (key, i + bench->id) ;
+                res = registry_value_get (key, value, 16) ;
+
+            }
+            bench->reads++ ;
+
+        }
+        if (res < 0) {
+            bench->status = res ;
+            break ;
+
+        }
+
+    }
+
+    return 0 ;
+}
+
+static int32_t
+regbench_run (void* ctx, CORSHELL_OUT_FP shell_out, REGBENCH_THREAD_T * bench,
+        unsigned int threads, unsigned int iterations, unsigned int interval,
+        unsigned int handles)
+{
+    struct timespec start, end ;
+    unsigned int i ;
+    unsigned int reads = 0 ;
+    unsigned int writes = 0 ;
+    uint64_t usec ;
+    int32_t status = EOK ;
+
+    clock_gettime (CLOCK_MONOTONIC, &start) ;
+    for (i = 0; i < threads; i++) {
+        memset (&bench[i], 0, sizeof(REGBENCH_THREAD_T)) ;
+        bench[i].id = i ;
+        bench[i].iterations = iterations ;
+        bench[i].interval = interval ;
+        bench[i].handles = handles ;
+        if (pthread_create (&bench[i].thread, 0, regbench_thread, &bench[i])) {
+            threads = i ;
+            status = EFAIL ;
+            break ;
+
+        }
+
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join (bench[i].thread, 0) ;
+        reads += bench[i].reads ;
+        writes += bench[i].writes ;
+        if (bench[i].status < 0) status = bench[i].status ;
+
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end) ;
+
+    usec = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_nsec - start.tv_nsec) / 1000 ;
+    if (!usec) usec = 1 ;
+
+    corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+            "%2u threads: %8u reads %6u writes %6u ms %10u ops/s%s" CORSHELL_NEWLINE,
+            threads, reads, writes, (unsigned int)(usec / 1000),
+            (unsigned int)(((uint64_t)(reads + writes) * 1000000) / usec),
+            status < 0 ? " (failed)" : "") ;
+
+    return status ;
+}
+
+/**
+ * @brief       Measure concurrent registry throughput.
+ * @note        Runs the same per thread workload for 1, 2, 4 ... threads.
+ *              With a write interval of n every n-th operation is a write,
+ *              0 measures reads only. With "h" the keys are resolved to
+ *              handles once per thread.
+ */
+static int32_t
+corshell_regbench (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static REGBENCH_THREAD_T bench[REGBENCH_THREADS_MAX] ;
+    unsigned int threads = 4 ;
+    unsigned int iterations = 20000 ;
+    unsigned int interval = 100 ;
+    unsigned int handles = 0 ;
+    char key[16] ;
+    char value[16] ;
+    unsigned int i ;
+    int32_t res = EOK ;
+
+    if (argc > 1) sscanf(argv[1], "%u", &threads) ;
+    if (argc > 2) sscanf(argv[2], "%u", &iterations) ;
+    if (argc > 3) sscanf(argv[3], "%u", &interval) ;
+    if (argc > 4) handles = (argv[4][0] == 'h') ;
+    if (!threads || (threads > REGBENCH_THREADS_MAX)) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    for (i = 0; i < REGBENCH_KEYS; i++) {
+        regbench_key (key, i) ;
+        snprintf(value, 16, "%.12u", i) ;
+        if ((res = registry_value_set (key, value, strlen(value)+1)) < 0) {
+            corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                     "create return %d\r\n", res) ;
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+
+    }
+
+    for (i = 1; ; i <<= 1) {
+        if (i > threads) i = threads ;
+        if (regbench_run (ctx, shell_out, bench, i, iterations, interval,
+                handles) < 0) {
+            res = EFAIL ;
+            break ;
+
+        }
+        if (i == threads) break ;
+
+    }
+
+    for (i = 0; i < REGBENCH_KEYS; i++) {
+        regbench_key (key, i) ;
+        registry_value_delete (key) ;
+
+    }
+
+    return res == EOK ? CORSHELL_CMD_E_OK : CORSHELL_CMD_E_FAIL ;
+}
+#endif /* CFG_PORT_POSIX */
+
 #endif /* CFG_REGISTRY_USE */
@@ -0,0 +1,131 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+
+#ifndef __REGISTRY_REGISTRYKEY_H__
+#define __REGISTRY_REGISTRYKEY_H__
+
+#include <stdint.h>
+
+/*
+ * Registry keys known at compile time. A REGISTRY_CKEY_T holds the key
+ * padded to REGISTRY_KEY_LENGTH bytes exactly as it is stored in FLASH
+ * (DICTIONARY_KEYSPEC_BINARY(6)) together with its dictionary hash, the sum
+ * of the six native endian key words. Both are computed by the compiler from
+ * a string literal:
+ *
+ *      REGISTRY_CKEY_DECL(_key_user_name, "user.name") ;
+ *      registry_value_get_k (&_key_user_name, value, sizeof(value)) ;
+ *
+ * or in C, without a declaration:
+ *
+ *      registry_value_get_k (REGISTRY_CKEY("user.name"), value, sizeof(value)) ;
+ */
+
+/*===========================================================================*/
+/* Constants.                                                                */
+/*===========================================================================*/
+
+#define REGISTRY_KEY_LENGTH                 24
+#define REGISTRY_KEY_WORDS                  (REGISTRY_KEY_LENGTH / sizeof(uint32_t))
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define REGISTRY_KEY_BYTE_SHIFT(n)          ((3 - ((n) & 3)) * 8)
+#else
+#define REGISTRY_KEY_BYTE_SHIFT(n)          (((n) & 3) * 8)
+#endif
+
+/*===========================================================================*/
+/* Data structures and types.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Key with its hash, usually a compile time constant.
+ */
+typedef struct REGISTRY_CKEY_S {
+    union {
+        char                str[REGISTRY_KEY_LENGTH] ;          /**< @brief  key, \0 padded */
+        uint32_t            words[REGISTRY_KEY_WORDS] ;         /**< @brief  aligned for the dictionary */
+    } key ;
+    uint32_t                hash ;                              /**< @brief  dictionary hash of the key */
+} REGISTRY_CKEY_T ;
+
+/*===========================================================================*/
+/* Macros.                                                                   */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+
+template <unsigned int N>
+constexpr uint32_t
+registry_key_byte (const char (&s)[N], unsigned int n)
+{
+    return n < N ? (uint32_t)(uint8_t)s[n] << REGISTRY_KEY_BYTE_SHIFT(n) : 0 ;
+}
+
+template <unsigned int N>
+constexpr uint32_t
+registry_key_hash (const char (&s)[N], unsigned int n = 0)
+{
+    /* C++ needs room for the \0 when initialising the key from a literal */
+    static_assert (N <= REGISTRY_KEY_LENGTH, "registry key too long") ;
+    return n < REGISTRY_KEY_LENGTH ?
+            registry_key_byte (s, n) + registry_key_hash (s, n + 1) : 0 ;
+}
+
+#define REGISTRY_KEY_HASH(s)                registry_key_hash (s)
+#define REGISTRY_CKEY_DECL(name, s)         static constexpr REGISTRY_CKEY_T name = REGISTRY_CKEY_INIT(s)
+
+#else
+
+/*
+ * The bytes of a word are summed shifted in place, as the words do not
+ * overlap this is the same as summing the words.
+ */
+#define REGISTRY_KEY_BYTE(s, n) \
+        ((n) < sizeof(s) ? \
+            (uint32_t)(uint8_t)(s)[(n) < sizeof(s) ? (n) : 0] << \
+            REGISTRY_KEY_BYTE_SHIFT(n) : 0)
+
+#define REGISTRY_KEY_WORD(s, w) \
+        (REGISTRY_KEY_BYTE(s, 4*(w)) + REGISTRY_KEY_BYTE(s, 4*(w)+1) + \
+        REGISTRY_KEY_BYTE(s, 4*(w)+2) + REGISTRY_KEY_BYTE(s, 4*(w)+3))
+
+/* fails to compile for keys longer than REGISTRY_KEY_LENGTH */
+#define REGISTRY_KEY_CHECK(s) \
+        (0 * sizeof(char[sizeof(s) <= REGISTRY_KEY_LENGTH + 1 ? 1 : -1]))
+
+#define REGISTRY_KEY_HASH(s) \
+        ((uint32_t)(REGISTRY_KEY_WORD(s, 0) + REGISTRY_KEY_WORD(s, 1) + \
+        REGISTRY_KEY_WORD(s, 2) + REGISTRY_KEY_WORD(s, 3) + \
+        REGISTRY_KEY_WORD(s, 4) + REGISTRY_KEY_WORD(s, 5) + \
+        REGISTRY_KEY_CHECK(s)))
+
+#define REGISTRY_CKEY(s)                    (&(const REGISTRY_CKEY_T)REGISTRY_CKEY_INIT(s))
+#define REGISTRY_CKEY_DECL(name, s)         static const REGISTRY_CKEY_T name = REGISTRY_CKEY_INIT(s)
+
+#endif
+
+#define REGISTRY_CKEY_INIT(s)               { { s }, REGISTRY_KEY_HASH(s) }
+
+#endif /* __REGISTRY_REGISTRYKEY_H__ */
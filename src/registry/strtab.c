@@ -44,23 +44,44 @@ typedef struct NVOL3_STRTAB_S {
 } NVOL3_STRTAB_T ;
 
 
-NVOL3_UINT_INSTANCE_DECL(_repo3_string, \
-                            ramdrv_read, ramdrv_write, ramdrv_erase, \
+NVOL3_MAPPED_INSTANCE_DECL(_repo3_string, \
+                            ramdrv_read, ramdrv_write, ramdrv_erase, RAMDRV_MAP, \
                             NVOL3_STRTAB_START, \
                             NVOL3_STRTAB_START + NVOL3_STRTAB_SECTOR_SIZE, \
                             NVOL3_STRTAB_SECTOR_SIZE, \
+                            sizeof(uint32_t), \
+                            DICTIONARY_KEYSPEC_UINT, \
+                            STRTAB_HASHSIZE, \
                             STRTAB_LENGT_MAX, \
                             0, \
-                            17, \
                             0, \
                             NVOL3_SECTOR_VERSION) ;
 
-static NVOL3_STRTAB_T       _strtab_buffer ;
-
+/*
+ * Bits of the Bloom filter answering lookups of absent strings, 0 for none.
+ */
+#ifndef CFG_STRTAB_FILTER_BITS
+#define CFG_STRTAB_FILTER_BITS              0
+#endif
 
+/*
+ * Lookups and iteration take no lock, nvol3 reads are lock free. Updates,
+ * load/unload and iterator snapshots take the lock exclusive, status logging
+ * and visitors take it shared.
+ */
+#if CFG_PORT_POSIX
+#include <pthread.h>
+static pthread_rwlock_t     _strtab_lock = PTHREAD_RWLOCK_INITIALIZER ;
+#define STRTAB_LOCK_INIT()
+#define STRTAB_LOCK()               pthread_rwlock_wrlock (&_strtab_lock)
+#define STRTAB_LOCK_SHARED()        pthread_rwlock_rdlock (&_strtab_lock)
+#define STRTAB_UNLOCK()             pthread_rwlock_unlock (&_strtab_lock)
+#else
 #define STRTAB_LOCK_INIT()
 #define STRTAB_LOCK()
+#define STRTAB_LOCK_SHARED()
 #define STRTAB_UNLOCK()
+#endif
 
 #if CFG_STRSUB_USE
 static int32_t strtab_strsub_cb(STRSUB_REPLACE_CB cb, const char * str, size_t len, uint32_t offset, uintptr_t arg) ;
@@ -92,12 +113,14 @@ int32_t
 strtab_start(void)
 {
     int32_t status = 0 ;
+    STRTAB_LOCK() ;
+    nvol3_set_filter (&_repo3_string, CFG_STRTAB_FILTER_BITS) ;
     if (nvol3_validate(&_repo3_string) != EOK) {
         nvol3_reset (&_repo3_string) ;
     }
     status = nvol3_load (&_repo3_string) ;
     CORSHELL_CMD_LIST_INSTALL(strtab) ;
-
+    STRTAB_UNLOCK() ;
 
     return status ;
 }
@@ -110,8 +133,10 @@ void
 strtab_stop(void)
 {
     DBG_CHECKV_T(STRTAB_IS_LOADED(), "strtab not loaded") ;
+    STRTAB_LOCK() ;
     CORSHELL_CMD_LIST_UNINSTALL(strtab) ;
     nvol3_unload (&_repo3_string) ;
+    STRTAB_UNLOCK() ;
 }
 
 /**
@@ -123,7 +148,9 @@ strtab_erase(void)
 {
     int32_t status = 0 ;
     DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
+    STRTAB_LOCK() ;
     status = nvol3_reset (&_repo3_string) ;
+    STRTAB_UNLOCK() ;
     return status ;
 }
 
@@ -148,7 +175,6 @@ strtab_length(STRTAB_KEY_T key)
 {
     int32_t res ;
     DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
-    STRTAB_LOCK() ;
     res = nvol3_record_key_and_data_length  (&_repo3_string, (const char*)&key) ;
     if (res > (int)sizeof(uint16_t)*2) {
         res -= (int)sizeof(uint16_t)*2 ;
@@ -156,7 +182,6 @@ strtab_length(STRTAB_KEY_T key)
         res = 0 ;
     }
 
-    STRTAB_UNLOCK() ;
 
     return res ;
 
@@ -173,24 +198,67 @@ int32_t
 strtab_get(STRTAB_KEY_T key, char* value, int length)
 {
     int32_t res ;
+    NVOL3_STRTAB_T buffer ;
     DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
     if (!value) return E_PARM ;
-    STRTAB_LOCK() ;
-    _strtab_buffer.key = key ;
+    buffer.key = key ;
 
     if ((res = nvol3_record_get(&_repo3_string,
-              (NVOL3_RECORD_T*)&_strtab_buffer)) > (int)sizeof(uint16_t)*2) {
+              (NVOL3_RECORD_T*)&buffer)) > (int)sizeof(uint16_t)*2) {
 
         res -= sizeof(uint16_t)*2 ;
         if (res < length) {
             length = res ;
         }
-        strncpy(value, (char*)_strtab_buffer.value, length) ;
+        strncpy(value, (char*)buffer.value, length) ;
 
     } else if (res >= 0) {
         res = E_INVAL ;
 
     }
+
+    return res ;
+}
+
+typedef struct STRTAB_VISIT_S {
+    STRTAB_VISIT_T          cb ;
+    uintptr_t               ctx ;
+} STRTAB_VISIT_CTX_T ;
+
+static int32_t
+strtab_visit_cb (const char * key, const uint8_t * data, uint32_t length,
+                    uintptr_t ctx)
+{
+    STRTAB_VISIT_CTX_T * visit = (STRTAB_VISIT_CTX_T *) ctx ;
+
+    if (!length) {
+        return E_INVAL ;
+    }
+
+    return visit->cb ((STRTAB_KEY_T)*(const uint32_t*)key,
+            (const char*)data, length, visit->ctx) ;
+}
+
+/**
+ * @brief      pass the string to cb without copying it. The string is not
+ *             NUL terminated and only valid during the callback.
+ * @param[in]   key
+ * @param[in]   cb
+ * @param[in]   ctx
+ * @return      status returned by cb, E_NOTFOUND or E_INVAL (empty string)
+ */
+int32_t
+strtab_visit (STRTAB_KEY_T key, STRTAB_VISIT_T cb, uintptr_t ctx)
+{
+    int32_t res ;
+    uint32_t k = key ;
+    STRTAB_VISIT_CTX_T visit = { cb, ctx } ;
+    DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
+    if (!cb) return E_PARM ;
+
+    STRTAB_LOCK_SHARED() ;
+    res = nvol3_record_visit (&_repo3_string, (const char*)&k,
+            strtab_visit_cb, (uintptr_t)&visit) ;
     STRTAB_UNLOCK() ;
 
     return res ;
@@ -207,79 +275,97 @@ int32_t
 strtab_set(STRTAB_KEY_T key, const char* value, int length)
 {
     int32_t res ;
+    NVOL3_STRTAB_T buffer ;
     DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
     if (length > STRTAB_LENGT_MAX) {
         return E_PARM ;
     }
     STRTAB_LOCK() ;
-    _strtab_buffer.key = key ;
-    strncpy((char*)_strtab_buffer.value, value, length) ;
-    res =  nvol3_record_set (&_repo3_string, (NVOL3_RECORD_T*)&_strtab_buffer, length + sizeof(uint16_t)*2) ;
+    buffer.key = key ;
+    strncpy((char*)buffer.value, value, length) ;
+    res =  nvol3_record_set (&_repo3_string, (NVOL3_RECORD_T*)&buffer, length + sizeof(uint16_t)*2) ;
     STRTAB_UNLOCK() ;
 
     return res ;
 }
 
-/*
- * Simple iterator. Should only be used by one client at a time!
- */
-static NVOL3_ITERATOR_T _strtab_it ;
-
 static int32_t
 strtab_cmp (const char * first, const char * second)
 {
     return  *((uint16_t*)first) - *((uint16_t*)second) ;
 }
 
+/**
+ * @brief      open the iterator and get the first string
+ * @note       the iterator is released after the last string, call
+ *             strtab_it_close() when stopping before that.
+ * @param[out]  it
+ * @param[out]  key
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
 int32_t
-strtab_first (STRTAB_KEY_T* key, char* value, int length)
+strtab_first (STRTAB_IT_T* it, STRTAB_KEY_T* key, char* value, int length)
 {
     int32_t res ;
-    (void)strtab_cmp ;
     DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
     STRTAB_LOCK() ;
-    if ((res = nvol3_record_first (&_repo3_string,
-               (NVOL3_RECORD_T*)&_strtab_buffer, &_strtab_it, strtab_cmp)) >
-               (int)sizeof(uint16_t)*2) {
-        res -= sizeof(uint16_t)*2 ;
-        if (res < length) {
-            length = res ;
-        }
-        strncpy(value, (char*)_strtab_buffer.value, length) ;
-        *key = *(STRTAB_KEY_T*)dictionary_get_key(_repo3_string.dict, _strtab_it.it.np) ;
-
-
-    }
+    res = nvol3_snapshot_open (&_repo3_string, &it->it, strtab_cmp) ;
     STRTAB_UNLOCK() ;
-    return res ;
+    if (res != EOK) {
+        return res ;
+    }
+
+    return strtab_next (it, key, value, length) ;
 }
 
+/**
+ * @brief      get the next string of the iterator
+ * @param[in/out] it
+ * @param[out]  key
+ * @param[out]  value
+ * @param[in]   length
+ * @return      length or < 0 (status)
+ */
 int32_t
-strtab_next (STRTAB_KEY_T* key, char* value, int length)
+strtab_next (STRTAB_IT_T* it, STRTAB_KEY_T* key, char* value, int length)
 {
     int32_t res ;
-    DBG_CHECK_T(STRTAB_IS_LOADED(),  E_UNEXP, "strtab not loaded") ;
-    STRTAB_LOCK() ;
-    if ((res = nvol3_record_next (&_repo3_string, (NVOL3_RECORD_T*)&_strtab_buffer, &_strtab_it)) > (int)sizeof(uint16_t)*2) {
+    NVOL3_STRTAB_T buffer ;
+    if ((res = nvol3_snapshot_next (&_repo3_string, (NVOL3_RECORD_T*)&buffer, &it->it)) > (int)sizeof(uint16_t)*2) {
         res -= sizeof(uint16_t)*2 ;
         if (res < length) {
             length = res ;
         }
-        strncpy(value, (char*)_strtab_buffer.value, length) ;
-        //*key = (STRTAB_KEY_T)_strtab_it.it.np->key ;
-        *key = *(STRTAB_KEY_T*)dictionary_get_key(_repo3_string.dict, _strtab_it.it.np) ;
+        strncpy(value, (char*)buffer.value, length) ;
+        *key = (STRTAB_KEY_T)buffer.key ;
+
+    } else {
+        strtab_it_close (it) ;
 
     }
-    STRTAB_UNLOCK() ;
     return res ;
 }
 
+/**
+ * @brief      release the iterator, can be called more than once
+ * @param[in/out] it
+ */
+void
+strtab_it_close (STRTAB_IT_T* it)
+{
+    nvol3_snapshot_close (&_repo3_string, &it->it) ;
+}
+
 void
 strtab_log_status (void)
 {
+    STRTAB_LOCK_SHARED() ;
     if (STRTAB_IS_LOADED()) {
         nvol3_entry_log_status (&_repo3_string, 1) ;
     }
+    STRTAB_UNLOCK() ;
 
 }
 
@@ -288,15 +374,14 @@ int32_t
 strtab_strsub_cb(STRSUB_REPLACE_CB cb, const char * str, size_t len, uint32_t offset, uintptr_t arg)
 {
     int32_t res = E_INVAL ;
+    NVOL3_STRTAB_T buffer ;
 
-    STRTAB_LOCK() ;
-
-    if (sscanf(str, "%u", (unsigned int*)&_strtab_buffer.key)) {
+    if (sscanf(str, "%u", (unsigned int*)&buffer.key)) {
 
-        if ((res = nvol3_record_get(&_repo3_string, (NVOL3_RECORD_T*)&_strtab_buffer)) > (int)sizeof(uint16_t)*2) {
+        if ((res = nvol3_record_get(&_repo3_string, (NVOL3_RECORD_T*)&buffer)) > (int)sizeof(uint16_t)*2) {
 
             res -= sizeof(uint16_t)*2 ;
-            res = cb (_strtab_buffer.value, res, offset, arg) ;
+            res = cb (buffer.value, res, offset, arg) ;
 
         } else if (res >= 0) {
             res = E_INVAL ;
@@ -306,7 +391,6 @@ strtab_strsub_cb(STRSUB_REPLACE_CB cb, const char * str, size_t len, uint32_t of
     }
 
 
-    STRTAB_UNLOCK() ;
 
     return res ;
 }
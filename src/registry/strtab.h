@@ -27,12 +27,14 @@
 #define __STRTAB_H__
 
 #include <stdint.h>
+#include <nvram/nvol3.h>
 
 /*===========================================================================*/
 /* Module pre-compile time settings.                                         */
 /*===========================================================================*/
 
 #define STRTAB_LENGT_MAX                            500  // max length of strings saved the strtab
+#define STRTAB_HASHSIZE                             17
 
 
 /*===========================================================================*/
@@ -41,6 +43,20 @@
 
 typedef uint16_t STRTAB_KEY_T ;
 
+/**
+ * @brief   Callback for strtab_visit(), value is not NUL terminated and only
+ *          valid during the call.
+ */
+typedef int32_t (*STRTAB_VISIT_T)(STRTAB_KEY_T /*key*/, const char* /*value*/, unsigned int /*length*/, uintptr_t /*ctx*/) ;
+
+/**
+ * @brief   Iterator owned by the caller, iterates the strings present at
+ *          strtab_first() in key order.
+ */
+typedef struct STRTAB_IT_S {
+    NVOL3_ITERATOR_T        it ;
+} STRTAB_IT_T ;
+
 
 /*===========================================================================*/
 /* External declarations.                                                    */
@@ -59,9 +75,11 @@ int32_t     strtab_valid (STRTAB_KEY_T key) ;
 int32_t     strtab_length(STRTAB_KEY_T key) ;
 int32_t     strtab_get(STRTAB_KEY_T key, char* value, int length) ;
 int32_t     strtab_set(STRTAB_KEY_T key, const char* value, int length) ;
+int32_t     strtab_visit (STRTAB_KEY_T key, STRTAB_VISIT_T cb, uintptr_t ctx) ;
 
-int32_t     strtab_first (STRTAB_KEY_T* key, char* value, int length) ;
-int32_t     strtab_next (STRTAB_KEY_T* key, char* value, int length) ;
+int32_t     strtab_first (STRTAB_IT_T* it, STRTAB_KEY_T* key, char* value, int length) ;
+int32_t     strtab_next (STRTAB_IT_T* it, STRTAB_KEY_T* key, char* value, int length) ;
+void        strtab_it_close (STRTAB_IT_T* it) ;
 
 void        strtab_log_status (void) ;
 
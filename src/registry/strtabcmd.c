@@ -28,15 +28,22 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "registry.h"
 #include "shell/corshell.h"
 #include "common/errordef.h"
+#include "common/kvline.h"
 
 
 static int32_t corshell_strtab (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t corshell_strtabchk (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t corshell_strtaberase (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t corshell_strtabtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
 static int32_t corshell_strtabstats (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+#if CFG_PORT_POSIX
+static int32_t corshell_strtabimport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+static int32_t corshell_strtabexport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc) ;
+#endif
 
 
 CORSHELL_CMD_LIST_START(strtab, 0)
@@ -44,6 +51,11 @@ CORSHELL_CMD_LIST(  "strtab", corshell_strtab,  "[idx] [value]")
 CORSHELL_CMD_LIST(  "strtabchk", corshell_strtabchk,  "<idx> <value>")
 CORSHELL_CMD_LIST(  "strtaberase", corshell_strtaberase,  "")
 CORSHELL_CMD_LIST(  "strtabstats", corshell_strtabstats,  "")
+CORSHELL_CMD_LIST(  "strtabtest", corshell_strtabtest,  "")
+#if CFG_PORT_POSIX
+CORSHELL_CMD_LIST(  "strtabimport", corshell_strtabimport,  "<file>")
+CORSHELL_CMD_LIST(  "strtabexport", corshell_strtabexport,  "<file>")
+#endif
 CORSHELL_CMD_LIST_END()
 
 
@@ -94,7 +106,8 @@ int32_t corshell_strtab (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int
 
         int res ;
         uint32_t cnt = 0 ;
-        res = strtab_first (&key, (char*)value, STRTAB_LENGT_MAX) ;
+        STRTAB_IT_T it ;
+        res = strtab_first (&it, &key, (char*)value, STRTAB_LENGT_MAX) ;
 
         while (res > 0) {
 
@@ -103,9 +116,10 @@ int32_t corshell_strtab (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int
                     key, value) ;
             cnt++ ;
 
-            res = strtab_next (&key, (char*)value, STRTAB_LENGT_MAX) ;
+            res = strtab_next (&it, &key, (char*)value, STRTAB_LENGT_MAX) ;
 
         }
+        strtab_it_close (&it) ;
         corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
             "\r\n    %d entries found." CORSHELL_NEWLINE, cnt) ;
 
@@ -146,6 +160,68 @@ int32_t corshell_strtabchk (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, i
     return CORSHELL_CMD_E_OK ;
 }
 
+/*
+ * strtabtest writes short strings to this key and reads them back with
+ * strtab_visit(), the visitor must get the full length of the string.
+ */
+#define STRTAB_TEST_KEY         0xFFFF
+
+static int32_t
+strtabtest_visit_cb (STRTAB_KEY_T key, const char* value, unsigned int length,
+                    uintptr_t ctx)
+{
+    char * readval = (char *) ctx ;
+
+    if ((key != STRTAB_TEST_KEY) || (length >= STRTAB_LENGT_MAX)) {
+        return E_INVAL ;
+    }
+    memcpy (readval, value, length) ;
+    readval[length] = '\0' ;
+
+    return (int32_t) length ;
+}
+
+int32_t corshell_strtabtest (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static const char * const testval[] = { "abc", "hello", "a" } ;
+    char readval[STRTAB_LENGT_MAX] ;
+    unsigned int i ;
+    int32_t res ;
+
+    shell_out (ctx, CORSHELL_OUT_STD, "strtab testing...\r\n") ;
+
+    for (i = 0 ; i < sizeof(testval) / sizeof(testval[0]) ; i++) {
+        int length = strlen(testval[i]) + 1 ;
+
+        res = strtab_set (STRTAB_TEST_KEY, testval[i], length) ;
+        if (res < 0) {
+            corshell_print (ctx, CORSHELL_OUT_STD, shell_out,
+                    "set return %d\r\n", res) ;
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+        res = strtab_visit (STRTAB_TEST_KEY, strtabtest_visit_cb,
+                (uintptr_t)readval) ;
+        if (res != length) {
+            corshell_print (ctx, CORSHELL_OUT_STD, shell_out,
+                    "visit return %d expected %d\r\n", res, length) ;
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+        if (strcmp (readval, testval[i])) {
+            corshell_print (ctx, CORSHELL_OUT_STD, shell_out,
+                    "visit %s expected %s\r\n", readval, testval[i]) ;
+            return CORSHELL_CMD_E_FAIL ;
+
+        }
+
+    }
+
+    shell_out (ctx, CORSHELL_OUT_STD, "done\r\n") ;
+
+    return CORSHELL_CMD_E_OK ;
+}
+
 int32_t corshell_strtaberase (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
 {
     int32_t status = strtab_erase () ;
@@ -171,5 +247,137 @@ corshell_strtabstats (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int arg
     return CORSHELL_CMD_E_OK ;
 }
 
+#if CFG_PORT_POSIX
+#define STRTAB_ID_LENGTH        7       /* characters of an idx in a file */
+
+/*
+ * Set the strings read from a file of "<idx> <value>" lines, see kvline.h.
+ * Strings that do not change are not written again.
+ */
+static int32_t
+corshell_strtabimport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static char line[KVLINE_LENGTH(STRTAB_ID_LENGTH, STRTAB_LENGT_MAX)] ;
+    unsigned int lineno = 0 ;
+    unsigned int cnt = 0 ;
+    unsigned long id ;
+    char * end ;
+    KVLINE_T kv ;
+    int32_t status = EOK ;
+    FILE * fp ;
+
+    if (argc != 2) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    fp = fopen (argv[1], "r") ;
+    if (!fp) {
+        corshell_print (ctx, CORSHELL_OUT_ERR, shell_out,
+                "unable to open file \"%s\" for read.\r\n", argv[1]) ;
+        return CORSHELL_CMD_E_NOT_FOUND ;
+
+    }
+
+    while (fgets (line, sizeof(line), fp)) {
+        lineno++ ;
+        status = kvline_check (line, sizeof(line)) ;
+        if (status != EOK) {
+            corshell_print (ctx, CORSHELL_OUT_ERR, shell_out,
+                    "%s:%u: line too long\r\n", argv[1], lineno) ;
+            break ;
+
+        }
+        status = kvline_parse (line, &kv) ;
+        if (status == E_EMPTY) {
+            status = EOK ;
+            continue ;
+
+        }
+        if (status == EOK) {
+            id = strtoul (kv.key, &end, 0) ;
+            if (*end || (end == kv.key) || (id > (STRTAB_KEY_T)-1) ||
+                    !kv.value_length || (kv.value_length > STRTAB_LENGT_MAX)) {
+                status = E_PARM ;
+
+            }
+
+        }
+        if (status == EOK) {
+            status = strtab_set ((STRTAB_KEY_T)id, kv.value, kv.value_length) ;
+
+        }
+        if (status != EOK) {
+            corshell_print (ctx, CORSHELL_OUT_ERR, shell_out,
+                    "%s:%u: Error %d\r\n", argv[1], lineno, status) ;
+            break ;
+
+        }
+        cnt++ ;
+
+    }
+    fclose (fp) ;
+
+    corshell_print (ctx, CORSHELL_OUT_STD, shell_out,
+            "    %u entries imported.\r\n", cnt) ;
+
+    return status == EOK ? CORSHELL_CMD_E_OK : CORSHELL_CMD_E_FAIL ;
+}
+
+/*
+ * Write all strings to a file in the format read by strtabimport.
+ */
+static int32_t
+corshell_strtabexport (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    static char line[KVLINE_LENGTH(STRTAB_ID_LENGTH, STRTAB_LENGT_MAX)] ;
+    static char value[STRTAB_LENGT_MAX] ;
+    char id[STRTAB_ID_LENGTH + 1] ;
+    unsigned int cnt = 0 ;
+    STRTAB_KEY_T key ;
+    STRTAB_IT_T it ;
+    int32_t status = EOK ;
+    int res ;
+    FILE * fp ;
+
+    if (argc != 2) {
+        return CORSHELL_CMD_E_PARMS ;
+
+    }
+
+    fp = fopen (argv[1], "w") ;
+    if (!fp) {
+        corshell_print (ctx, CORSHELL_OUT_ERR, shell_out,
+                "unable to open file \"%s\" for write.\r\n", argv[1]) ;
+        return CORSHELL_CMD_E_FAIL ;
+
+    }
+
+    res = strtab_first (&it, &key, value, STRTAB_LENGT_MAX) ;
+    while (res > 0) {
+        snprintf (id, sizeof(id), "%u", (unsigned int)key) ;
+        if ((kvline_format (line, sizeof(line), id, value, res) < 0) ||
+                (fprintf (fp, "%s\n", line) < 0)) {
+            status = EFAIL ;
+            break ;
+
+        }
+        cnt++ ;
+        res = strtab_next (&it, &key, value, STRTAB_LENGT_MAX) ;
+
+    }
+    strtab_it_close (&it) ;
+    if (fclose (fp) != 0) {
+        status = EFAIL ;
+
+    }
+
+    corshell_print (ctx, CORSHELL_OUT_STD, shell_out,
+            "    %u entries exported.\r\n", cnt) ;
+
+    return status == EOK ? CORSHELL_CMD_E_OK : CORSHELL_CMD_E_FAIL ;
+}
+#endif /* CFG_PORT_POSIX */
+
 
 #endif /* CFG_REGISTRY_USE */
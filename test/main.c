@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <unistd.h>
 
+#include <common/heap.h>
 #include <drivers/ramdrv.h>
 #include <shell/corshell.h>
 #include <registry/registry.h>
@@ -37,6 +38,12 @@ CORSHELL_CMD_DECL("cat", corshell_cat, "<file>");
 CORSHELL_CMD_DECL("pwd", corshell_pwd, "");
 CORSHELL_CMD_DECL("echo", corshell_echo, "[string]");
 CORSHELL_CMD_DECL("exit", corshell_exit, "[string]");
+CORSHELL_CMD_DECL("heapstats", corshell_heapstats, "");
+
+/*
+ * Arena for HEAP_SPACE, used by nvol3 for the lookup tables.
+ */
+static uint8_t          _heap_arena[HEAP_SPACE_ARENA_SIZE] ;
 
 /*
  * Run until the exit flag is set.
@@ -46,10 +53,21 @@ static bool             _shell_exit = false ;
  * Controll the logging level ;
  */
 static uint32_t         _shell_log_level = CORSHELL_OUT_ERR ;
+/*
+ * Factory defaults of the registry, sorted by key. These are not written to
+ * FLASH unless they are changed.
+ */
+static const REGISTRY_DEFAULT_T _registry_defaults[] = {
+    REGISTRY_DEFAULT("test", "123"),
+} ;
 
 int
 main(int argc, char* argv[])
 {
+    /*
+     * Initialise the heap used by the registry and string table.
+     */
+    heap_space_init (HEAP_SPACE, _heap_arena, sizeof (_heap_arena)) ;
     /*
      * Initialise drivers.
      */
@@ -64,15 +82,16 @@ main(int argc, char* argv[])
      */
     registry_init () ;
     registry_start () ;
+    registry_set_defaults (_registry_defaults,
+            sizeof(_registry_defaults) / sizeof(_registry_defaults[0])) ;
     /*
      * Initialise the string table.
      */
     strtab_init () ;
     strtab_start () ;
     /*
-     * Just add one registry and strtab entry for testing purposes.
+     * Just add one strtab entry for testing purposes.
      */
-    registry_value_set ("test", "123", strlen("123") + 1) ;
     strtab_set(999, "test", strlen("test")+1) ;
     /*
      * Print startup and help text.
@@ -345,5 +364,20 @@ corshell_exit (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
     return CORSHELL_CMD_E_OK ;
 }
 
+static int32_t
+corshell_heapstats (void* ctx, CORSHELL_OUT_FP shell_out, char** argv, int argc)
+{
+    /* Print the accounting of all heapspaces. */
+    HEAP_STATS_T stats ;
+    int heap ;
 
+    for (heap = HEAP_SPACE_NONE; heap < HEAP_SPACE_LAST; heap++) {
+        heap_space_stats ((heapspace)heap, &stats) ;
+        corshell_print(ctx, CORSHELL_OUT_STD, shell_out,
+                "heap %d: size %u used %u peak %u count %u allocs %u "
+                "failures %u\r\n", heap, stats.size, stats.used, stats.peak,
+                stats.count, stats.allocs, stats.failures);
+    }
 
+    return CORSHELL_CMD_E_OK ;
+}
@@ -0,0 +1,74 @@
+# values read in one pass must match registry_value_get(), keys set one
+# after the other are in adjacent slots, "test" is read from the defaults
+reg values.a 1
+reg values.b two
+reg values.c 3
+reg values.d four
+regvalues values.a values.b values.c missing values.d test values.a
+reg values.k00 0
+reg values.k01 1
+reg values.k02 2
+reg values.k03 3
+reg values.k04 4
+reg values.k05 5
+reg values.k06 6
+reg values.k07 7
+reg values.k08 8
+reg values.k09 9
+reg values.k10 10
+reg values.k11 11
+reg values.k12 12
+reg values.k13 13
+reg values.k14 14
+reg values.k15 15
+reg values.k16 16
+reg values.k17 17
+reg values.k18 18
+reg values.k19 19
+reg values.k20 20
+reg values.k21 21
+reg values.k22 22
+reg values.k23 23
+reg values.k24 24
+reg values.k25 25
+reg values.k26 26
+reg values.k27 27
+reg values.k28 28
+reg values.k29 29
+# all keys, in more than one batch
+regvalues
+regdel values.a
+regdel values.b
+regdel values.c
+regdel values.d
+regdel values.k00
+regdel values.k01
+regdel values.k02
+regdel values.k03
+regdel values.k04
+regdel values.k05
+regdel values.k06
+regdel values.k07
+regdel values.k08
+regdel values.k09
+regdel values.k10
+regdel values.k11
+regdel values.k12
+regdel values.k13
+regdel values.k14
+regdel values.k15
+regdel values.k16
+regdel values.k17
+regdel values.k18
+regdel values.k19
+regdel values.k20
+regdel values.k21
+regdel values.k22
+regdel values.k23
+regdel values.k24
+regdel values.k25
+regdel values.k26
+regdel values.k27
+regdel values.k28
+regdel values.k29
+regvalues values.a values.b test values.k00
@@ -0,0 +1,79 @@
+# registry watchers, a prefix watcher is called once for each changed key
+regwatch on watch.
+reg watch.a 1
+reg other.a 1
+regwatch expect 1 watch.a
+
+# a batch delivers each changed key once, after the release
+regwatch hold
+reg watch.a 2
+reg watch.b 2
+reg watch.a 3
+reg other.a 2
+regwatch expect 0
+regwatch release
+regwatch expect 2 watch.b
+
+# nested batches are delivered by the outer release
+regwatch hold
+regwatch hold
+reg watch.c 1
+regwatch release
+regwatch expect 0
+regwatch release
+regwatch expect 1 watch.c
+
+# more keys than the queue holds, one call with key 0
+regwatch hold
+
+reg watch.k00 1
+reg watch.k01 1
+reg watch.k02 1
+reg watch.k03 1
+reg watch.k04 1
+reg watch.k05 1
+reg watch.k06 1
+reg watch.k07 1
+reg watch.k08 1
+reg watch.k09 1
+reg watch.k10 1
+reg watch.k11 1
+reg watch.k12 1
+reg watch.k13 1
+reg watch.k14 1
+reg watch.k15 1
+reg watch.k16 1
+regwatch release
+regwatch expect 1 *
+
+# setting the default value deletes the overlay and notifies once
+regwatch on test
+reg test 456
+regwatch expect 1 test
+reg test 123
+regwatch expect 1 test
+reg test 123
+regwatch expect 0
+regwatch off
+
+regdel watch.a
+regdel watch.b
+regdel watch.c
+regdel watch.k00
+regdel watch.k01
+regdel watch.k02
+regdel watch.k03
+regdel watch.k04
+regdel watch.k05
+regdel watch.k06
+regdel watch.k07
+regdel watch.k08
+regdel watch.k09
+regdel watch.k10
+regdel watch.k11
+regdel watch.k12
+regdel watch.k13
+regdel watch.k14
+regdel watch.k15
+regdel watch.k16
+regdel other.a
@@ -31,6 +31,8 @@
 
 
 
+#define HEAP_SPACE_ARENA_SIZE               STORAGE_32K     /* RAM budget for the nvol3 lookup tables */
+
 #define NVOL3_REGISTRY_START                0
 #define NVOL3_REGISTRY_SECTOR_SIZE          STORAGE_32K
 #define NVOL3_REGISTRY_SECTOR_COUNT         2
@@ -39,4 +41,8 @@
 #define NVOL3_STRTAB_SECTOR_SIZE                        STORAGE_32K
 #define NVOL3_STRTAB_SECTOR_COUNT                       2
 
+#define NVOL3_REGINSTANCE_START             (NVOL3_STRTAB_START + NVOL3_STRTAB_SECTOR_SIZE*NVOL3_STRTAB_SECTOR_COUNT)
+#define NVOL3_REGINSTANCE_SECTOR_SIZE       STORAGE_8K      /* registry opened by reginstance */
+#define NVOL3_REGINSTANCE_SECTOR_COUNT      2
+
 #define PLATFORM_SECTION_NOINIT                     __attribute__ ((section (".noinit")))
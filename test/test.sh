@@ -8,3 +8,8 @@ source regtest.sh
 source regtest.sh
 source regtest.sh
 source regtest.sh
+source regwatch.sh
+source regvalues.sh
+reginstance
+regdefaults ../build/test/defaults.phash
+strtabtest
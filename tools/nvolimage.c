@@ -0,0 +1,609 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+/*
+ * nvolimage - build and inspect nvol3 volume images on the host, with the
+ * same nvol3.c as the target.
+ *
+ *      nvolimage mkimage [-t type] [-s size] [-v] -o image input...
+ *      nvolimage inspect [-t type] [-s size] [-v] [-d] image
+ *
+ *      -t type     registry (default) or strtab, the volumes of the demo
+ *      -s size     sector size, default from system_config.h
+ *      -o image    both sectors of the volume, ready to program
+ *      -d          print the records as key/value lines
+ *      -v          print the nvol3 log to stderr
+ *
+ * mkimage reads key/value files (see src/common/kvline.h), the last value of
+ * a key wins. The records are written in key order to the first sector of a
+ * freshly initialised volume, so the image holds no invalid slots. inspect
+ * reports the slot usage of an image, e.g. a dump from the field, and the
+ * chain lengths of the lookup table that the target would build from it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include "system_config.h"
+#include <common/errordef.h>
+#include <common/kvline.h>
+#include <common/dictionary.h>
+#include <nvram/nvol3.h>
+#include <registry/registry.h>
+#include <registry/strtab.h>
+
+#define NVOLIMAGE_CHAIN_MAX         8       /* histogram buckets, the last counts longer chains */
+#define NVOLIMAGE_DATA_MAX          (STRTAB_LENGT_MAX > REGISTRY_VALUE_LENGT_MAX ? \
+                                        STRTAB_LENGT_MAX : REGISTRY_VALUE_LENGT_MAX)
+#define NVOLIMAGE_LINE_MAX          KVLINE_LENGTH(REGISTRY_KEY_LENGTH, NVOLIMAGE_DATA_MAX)
+
+typedef struct NVOLIMAGE_TYPE_S {
+    const char *        name ;
+    uint16_t            key_size ;
+    uint32_t            keyspec ;
+    uint16_t            hashsize ;
+    uint16_t            data_size ;
+    uint32_t            sector_size ;
+    NVLOL3_IT_KEY_CMP_T cmp ;
+} NVOLIMAGE_TYPE_T ;
+
+static int32_t          nvolimage_registry_cmp (const char * first, const char * second) ;
+static int32_t          nvolimage_strtab_cmp (const char * first, const char * second) ;
+
+static const NVOLIMAGE_TYPE_T _types[] = {
+    { "registry", REGISTRY_KEY_LENGTH, REGISTRY_KEYSPEC, REGISTRY_HASHSIZE,
+            REGISTRY_VALUE_LENGT_MAX, NVOL3_REGISTRY_SECTOR_SIZE,
+            nvolimage_registry_cmp },
+    { "strtab", sizeof(uint32_t), DICTIONARY_KEYSPEC_UINT, STRTAB_HASHSIZE,
+            STRTAB_LENGT_MAX, NVOL3_STRTAB_SECTOR_SIZE,
+            nvolimage_strtab_cmp },
+} ;
+
+static const NVOLIMAGE_TYPE_T * _type = &_types[0] ;
+static uint8_t *        _flash ;
+static uint32_t         _flash_size ;
+static bool             _verbose ;
+
+/*
+ * Debug output of nvol3 for the host, to stderr and only with -v.
+ */
+int
+dbg_vprintf (const char *format_str, va_list args)
+{
+    int count = 0 ;
+
+    if (_verbose) {
+        count = vfprintf (stderr, format_str, args) ;
+        fprintf (stderr, "\n") ;
+    }
+
+    return count ;
+}
+
+int
+dbg_printf (const char *format, ...)
+{
+    va_list args ;
+    int count ;
+
+    va_start (args, format) ;
+    count = dbg_vprintf (format, args) ;
+    va_end (args) ;
+
+    return count ;
+}
+
+void
+dbg_assert (const char *format, ...)
+{
+    va_list args ;
+
+    va_start (args, format) ;
+    vfprintf (stderr, format, args) ;
+    va_end (args) ;
+    fprintf (stderr, "\n") ;
+    abort () ;
+}
+
+/*
+ * FLASH in RAM, the target volume at 0 and a scratch volume behind it.
+ */
+static int32_t
+nvolimage_read (uint32_t addr, uint32_t len, uint8_t * data)
+{
+    if ((addr > _flash_size) || (len > _flash_size - addr)) return E_PARM ;
+    memcpy (data, _flash + addr, len) ;
+    return EOK ;
+}
+
+static int32_t
+nvolimage_write (uint32_t addr, uint32_t len, const uint8_t * data)
+{
+    uint32_t i ;
+
+    if ((addr > _flash_size) || (len > _flash_size - addr)) return E_PARM ;
+    for (i = 0 ; i < len ; i++) {
+        _flash[addr + i] &= data[i] ;
+    }
+    return EOK ;
+}
+
+static int32_t
+nvolimage_erase (uint32_t addr_start, uint32_t addr_end)
+{
+    if ((addr_end < addr_start) || (addr_end > _flash_size)) return E_PARM ;
+    memset (_flash + addr_start, 0xFF, addr_end - addr_start) ;
+    return EOK ;
+}
+
+static const uint8_t *
+nvolimage_map (uint32_t addr, uint32_t len)
+{
+    if ((addr > _flash_size) || (len > _flash_size - addr)) return 0 ;
+    return _flash + addr ;
+}
+
+static void
+nvolimage_config (NVOL3_CONFIG_T * config, const char * name, uint32_t base,
+                    uint32_t sector_size)
+{
+    memset (config, 0, sizeof(NVOL3_CONFIG_T)) ;
+    config->name = name ;
+    config->flash.read = nvolimage_read ;
+    config->flash.write = nvolimage_write ;
+    config->flash.erase = nvolimage_erase ;
+    config->flash.map = nvolimage_map ;
+    config->sector1_addr = base ;
+    config->sector2_addr = base + sector_size ;
+    config->sector_size = sector_size ;
+    config->record_size = sizeof(NVOL3_RECORD_HEAD_T) + _type->key_size +
+            _type->data_size ;
+    config->key_size = _type->key_size ;
+    config->hashsize = _type->hashsize ;
+    config->keyspec = _type->keyspec ;
+    config->version = NVOL3_SECTOR_VERSION ;
+    config->write_cb = nvol3_callback_tallie ;
+}
+
+static int32_t
+nvolimage_registry_cmp (const char * first, const char * second)
+{
+    return strncmp (first, second, REGISTRY_KEY_LENGTH) ;
+}
+
+static int32_t
+nvolimage_strtab_cmp (const char * first, const char * second)
+{
+    uint32_t a, b ;
+
+    memcpy (&a, first, sizeof(a)) ;
+    memcpy (&b, second, sizeof(b)) ;
+    return a < b ? -1 : a > b ? 1 : 0 ;
+}
+
+/*
+ * Key as stored in FLASH, a \0 padded string or a uint32_t id.
+ */
+static int32_t
+nvolimage_key (const char * key, uint8_t * stored)
+{
+    char * end ;
+    uint32_t id ;
+
+    if (_type->keyspec == DICTIONARY_KEYSPEC_UINT) {
+        id = strtoul (key, &end, 0) ;
+        if (*end || (end == key) || (id > (STRTAB_KEY_T)-1)) return E_FMT ;
+        memcpy (stored, &id, sizeof(id)) ;
+
+    } else {
+        if (strlen (key) > _type->key_size) return E_FMT ;
+        memset (stored, 0, _type->key_size) ;
+        memcpy (stored, key, strlen (key)) ;
+
+    }
+
+    return EOK ;
+}
+
+/*
+ * Check a stored key, an image of another type has the key of a record
+ * where this type expects it to be, or its data.
+ */
+static int32_t
+nvolimage_key_check (const uint8_t * stored)
+{
+    uint32_t id ;
+    uint32_t i ;
+
+    if (_type->keyspec == DICTIONARY_KEYSPEC_UINT) {
+        memcpy (&id, stored, sizeof(id)) ;
+        return id > (STRTAB_KEY_T)-1 ? E_FMT : EOK ;
+
+    }
+    for (i = 0 ; (i < _type->key_size) && stored[i] ; i++) {
+        if ((stored[i] < ' ') || (stored[i] >= 0x7F)) return E_FMT ;
+    }
+    if (!i) return E_FMT ;
+    for ( ; i < _type->key_size ; i++) {
+        if (stored[i]) return E_FMT ;
+    }
+
+    return EOK ;
+}
+
+static void
+nvolimage_key_str (const uint8_t * stored, char * key, uint32_t size)
+{
+    uint32_t id ;
+
+    if (_type->keyspec == DICTIONARY_KEYSPEC_UINT) {
+        memcpy (&id, stored, sizeof(id)) ;
+        snprintf (key, size, "%u", id) ;
+
+    } else {
+        snprintf (key, size, "%.*s", (int)_type->key_size, (const char *)stored) ;
+
+    }
+}
+
+static int
+nvolimage_load_file (NVOL3_INSTANCE_T * instance, NVOL3_RECORD_T * record,
+                    const char * name)
+{
+    static char line[NVOLIMAGE_LINE_MAX] ;
+    FILE * in = fopen (name, "r") ;
+    uint32_t lineno = 0 ;
+    KVLINE_T kv ;
+    int32_t res = EOK ;
+
+    if (!in) {
+        perror (name) ;
+        return -1 ;
+    }
+
+    while (fgets (line, sizeof(line), in)) {
+        lineno++ ;
+        res = kvline_check (line, sizeof(line)) ;
+        if (res != EOK) {
+            fprintf (stderr, "%s:%u: line too long\n", name, lineno) ;
+            break ;
+        }
+        res = kvline_parse (line, &kv) ;
+        if (res == E_EMPTY) {
+            res = EOK ;
+            continue ;
+        }
+        if ((res != EOK) ||
+                (nvolimage_key (kv.key, record->key_and_data) != EOK)) {
+            fprintf (stderr, "%s:%u: invalid line\n", name, lineno) ;
+            res = E_FMT ;
+            break ;
+        }
+        if (!kv.value_length || (kv.value_length > _type->data_size)) {
+            fprintf (stderr, "%s:%u: value length %u not 1 to %u\n", name,
+                    lineno, kv.value_length, _type->data_size) ;
+            res = E_PARM ;
+            break ;
+        }
+        memcpy (record->key_and_data + _type->key_size, kv.value,
+                kv.value_length) ;
+        res = nvol3_record_set (instance, record,
+                _type->key_size + kv.value_length) ;
+        if (res != EOK) {
+            fprintf (stderr, "%s:%u: write failed (%d), volume full?\n",
+                    name, lineno, (int)res) ;
+            break ;
+        }
+    }
+
+    fclose (in) ;
+
+    return res == EOK ? 0 : -1 ;
+}
+
+static int
+nvolimage_mkimage (int argc, char * argv[], uint32_t sector_size,
+                    const char * output)
+{
+    static NVOL3_CONFIG_T config, scratch_config ;
+    NVOL3_INSTANCE_T volume = { &config } ;
+    NVOL3_INSTANCE_T scratch = { &scratch_config } ;
+    NVOL3_ITERATOR_T it ;
+    NVOL3_RECORD_T * record ;
+    NVOL3_STATS_T stats ;
+    FILE * out ;
+    int32_t res ;
+    int i ;
+
+    if (!output || !argc) {
+        return -1 ;
+    }
+
+    nvolimage_config (&config, "image", 0, sector_size) ;
+    nvolimage_config (&scratch_config, "scratch", 2 * sector_size,
+            sector_size) ;
+    record = malloc (config.record_size) ;
+    if (!record || (nvol3_reset (&scratch) != EOK) ||
+            (nvol3_reset (&volume) != EOK)) {
+        fprintf (stderr, "initialising the volume failed\n") ;
+        return 1 ;
+    }
+
+    /*
+     * Collect the records in the scratch volume first, then copy the live
+     * ones in key order.
+     */
+    for (i = 0 ; i < argc ; i++) {
+        if (nvolimage_load_file (&scratch, record, argv[i]) < 0) {
+            return 1 ;
+        }
+    }
+    if (nvol3_snapshot_open (&scratch, &it, _type->cmp) != EOK) {
+        return 1 ;
+    }
+    while ((res = nvol3_snapshot_next (&scratch, record, &it)) >= 0) {
+        if (nvol3_record_set (&volume, record, res) != EOK) {
+            fprintf (stderr, "write failed, volume full?\n") ;
+            return 1 ;
+        }
+    }
+    nvol3_snapshot_close (&scratch, &it) ;
+
+    out = fopen (output, "wb") ;
+    if (!out) {
+        perror (output) ;
+        return 1 ;
+    }
+    if (fwrite (_flash, 2 * sector_size, 1, out) != 1) {
+        fprintf (stderr, "writing %s failed\n", output) ;
+        fclose (out) ;
+        return 1 ;
+    }
+    fclose (out) ;
+
+    nvol3_stats (&volume, &stats) ;
+    printf ("%s: %u records, %u of %u slots free\n", output, stats.live,
+            stats.empty, stats.records) ;
+
+    return 0 ;
+}
+
+static void
+nvolimage_dump (NVOL3_INSTANCE_T * volume)
+{
+    static char line[NVOLIMAGE_LINE_MAX] ;
+    const NVOL3_CONFIG_T * config = volume->config ;
+    NVOL3_RECORD_T * record = malloc (config->record_size) ;
+    NVOL3_ITERATOR_T it ;
+    char key[32] ;
+    int32_t res ;
+
+    if (!record || (nvol3_snapshot_open (volume, &it, _type->cmp) != EOK)) {
+        free (record) ;
+        return ;
+    }
+    while ((res = nvol3_snapshot_next (volume, record, &it)) >= 0) {
+        nvolimage_key_str (record->key_and_data, key, sizeof(key)) ;
+        if (kvline_format (line, sizeof(line), key,
+                (const char *)record->key_and_data + config->key_size,
+                res - config->key_size) >= 0) {
+            printf ("%s\n", line) ;
+        }
+    }
+    nvol3_snapshot_close (volume, &it) ;
+    free (record) ;
+}
+
+/*
+ * nvol3 cannot tell the record size an image was written with, records of
+ * another type are loaded at the wrong offsets. Check every live record has
+ * a key and length of this type.
+ */
+static int32_t
+nvolimage_layout_check (NVOL3_INSTANCE_T * volume)
+{
+    const NVOL3_CONFIG_T * config = volume->config ;
+    NVOL3_RECORD_T * record = malloc (config->record_size) ;
+    NVOL3_ITERATOR_T it ;
+    int32_t res ;
+    int32_t status = EOK ;
+
+    if (!record || (nvol3_snapshot_open (volume, &it, _type->cmp) != EOK)) {
+        free (record) ;
+        return E_NOMEM ;
+    }
+    while ((res = nvol3_snapshot_next (volume, record, &it)) >= 0) {
+        if ((res <= config->key_size) ||
+                (res > config->key_size + _type->data_size) ||
+                (nvolimage_key_check (record->key_and_data) != EOK)) {
+            status = E_FMT ;
+            break ;
+        }
+    }
+    nvol3_snapshot_close (volume, &it) ;
+    free (record) ;
+
+    return status ;
+}
+
+static int
+nvolimage_inspect (const char * name, uint32_t sector_size, bool dump)
+{
+    static NVOL3_CONFIG_T config ;
+    NVOL3_INSTANCE_T volume = { &config } ;
+    uint32_t chains[NVOLIMAGE_CHAIN_MAX + 1] = { 0 } ;
+    NVOL3_STATS_T stats ;
+    uint32_t i, cnt, size, written ;
+    FILE * in ;
+    long length ;
+    int32_t res ;
+
+    in = fopen (name, "rb") ;
+    if (!in) {
+        perror (name) ;
+        return 1 ;
+    }
+    fseek (in, 0, SEEK_END) ;
+    length = ftell (in) ;
+    fseek (in, 0, SEEK_SET) ;
+    if ((length <= 0) || (length > (long)(2 * sector_size)) ||
+            (fread (_flash, length, 1, in) != 1)) {
+        fprintf (stderr, "%s: not a volume of two 0x%x byte sectors\n",
+                name, sector_size) ;
+        fclose (in) ;
+        return 1 ;
+    }
+    fclose (in) ;
+
+    nvolimage_config (&config, name, 0, sector_size) ;
+    res = nvol3_validate (&volume) ;
+    if (res == EOK) {
+        res = nvol3_load (&volume) ;
+    }
+    if (res != EOK) {
+        fprintf (stderr, "%s: no valid %s volume (%d)\n", name, _type->name,
+                (int)res) ;
+        return 1 ;
+    }
+    if (nvolimage_layout_check (&volume) != EOK) {
+        fprintf (stderr, "%s: records do not match the %s layout, "
+                "wrong -t or -s?\n", name, _type->name) ;
+        return 1 ;
+    }
+    if (dump) {
+        nvolimage_dump (&volume) ;
+        return 0 ;
+    }
+    if (_verbose) {
+        nvol3_entry_log_status (&volume, 1) ;
+    }
+
+    nvol3_stats (&volume, &stats) ;
+    written = stats.live + stats.invalid + stats.error ;
+    printf ("volume        : %s, active sector 0x%x, record size %u\n",
+            _type->name, volume.sector, config.record_size) ;
+    printf ("slots         : %u total, %u live, %u invalid, %u empty, %u error\n",
+            stats.records, stats.live, stats.invalid, stats.empty,
+            stats.error) ;
+    printf ("fragmentation : %u%% of the written slots invalid\n",
+            written ? stats.invalid * 100 / written : 0) ;
+    printf ("next swap     : after %u writes, reclaims %u slots\n",
+            stats.empty, stats.invalid + stats.error) ;
+    printf ("capacity      : %u more keys\n",
+            stats.records - NVOL3_HEADROOM > stats.live ?
+            stats.records - NVOL3_HEADROOM - stats.live : 0) ;
+
+    size = dictionary_hashtab_size (volume.dict) ;
+    for (i = 0 ; i < size ; i++) {
+        cnt = dictionary_hashtab_cnt (volume.dict, i) ;
+        chains[cnt < NVOLIMAGE_CHAIN_MAX ? cnt : NVOLIMAGE_CHAIN_MAX]++ ;
+    }
+    printf ("chains        : %u buckets\n", size) ;
+    for (i = 0 ; i <= NVOLIMAGE_CHAIN_MAX ; i++) {
+        if (chains[i]) {
+            printf ("    %u%s\t: %u\n", i, i < NVOLIMAGE_CHAIN_MAX ? "" : "+",
+                    chains[i]) ;
+        }
+    }
+
+    return 0 ;
+}
+
+static void
+nvolimage_usage (void)
+{
+    fprintf (stderr,
+            "usage: nvolimage mkimage [-t type] [-s size] [-v] -o image input...\n"
+            "       nvolimage inspect [-t type] [-s size] [-v] [-d] image\n"
+            "       type registry or strtab\n") ;
+}
+
+int
+main (int argc, char * argv[])
+{
+    const char * output = 0 ;
+    uint32_t sector_size = 0 ;
+    bool dump = false ;
+    bool mkimage ;
+    unsigned int i ;
+    int opt, res ;
+
+    if ((argc < 2) || (strcmp (argv[1], "mkimage") &&
+            strcmp (argv[1], "inspect"))) {
+        nvolimage_usage () ;
+        return 1 ;
+    }
+    mkimage = !strcmp (argv[1], "mkimage") ;
+    argc-- ;
+    argv++ ;
+
+    while ((opt = getopt (argc, argv, "t:s:o:dv")) != -1) {
+        switch (opt) {
+        case 't':
+            for (i = 0 ; i < sizeof(_types) / sizeof(_types[0]) ; i++) {
+                if (!strcmp (optarg, _types[i].name)) break ;
+            }
+            if (i == sizeof(_types) / sizeof(_types[0])) {
+                nvolimage_usage () ;
+                return 1 ;
+            }
+            _type = &_types[i] ;
+            break ;
+        case 's': sector_size = strtoul (optarg, 0, 0) ; break ;
+        case 'o': output = optarg ; break ;
+        case 'd': dump = true ; break ;
+        case 'v': _verbose = true ; break ;
+        default: nvolimage_usage () ; return 1 ;
+        }
+    }
+    if (!sector_size) {
+        sector_size = _type->sector_size ;
+    }
+
+    _flash_size = 4 * sector_size ;
+    _flash = malloc (_flash_size) ;
+    if (!_flash) {
+        fprintf (stderr, "out of memory\n") ;
+        return 1 ;
+    }
+    memset (_flash, 0xFF, _flash_size) ;
+
+    if (mkimage) {
+        res = nvolimage_mkimage (argc - optind, argv + optind, sector_size,
+                output) ;
+        if (res < 0) {
+            nvolimage_usage () ;
+            return 1 ;
+        }
+        return res ;
+    }
+    if (optind != argc - 1) {
+        nvolimage_usage () ;
+        return 1 ;
+    }
+
+    return nvolimage_inspect (argv[optind], sector_size, dump) ;
+}
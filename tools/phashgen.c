@@ -0,0 +1,397 @@
+/*
+    Copyright (C) 2015-2023, Navaro, All Rights Reserved
+    SPDX-License-Identifier: MIT
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+ */
+
+/*
+ * phashgen - build a static minimal perfect hash table (see
+ * src/common/phash.h) from a key/value file, for read-only data in FLASH or
+ * ROM such as the registry factory defaults.
+ *
+ *      phashgen [-n name] [-o output] input
+ *
+ *      -n name     write C source with the image as "const uint32_t name[]"
+ *      -o output   output file, default stdout
+ *
+ * Each line of the input is a key followed by its value, see
+ * src/common/kvline.h:
+ *
+ *      user.name       "John Smith"
+ *      user.age        30
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <common/errordef.h>
+#include <common/phash.h>
+#include <common/kvline.h>
+
+#define PHASHGEN_LINE_MAX           KVLINE_LENGTH(PHASH_KEY_LENGTH_MAX, PHASH_VALUE_LENGTH_MAX)
+#define PHASHGEN_LAMBDA             4       /* average keys per bucket */
+#define PHASHGEN_SEEDS              64
+#define PHASHGEN_TRIES              (1u << 22)
+
+typedef struct PHASHGEN_KEY_S {
+    char *              key ;
+    uint32_t            key_length ;
+    char *              value ;
+    uint32_t            value_length ;      /* including the NUL of strings */
+    uint32_t            offset ;            /* in the image */
+    uint32_t            h[3] ;
+} PHASHGEN_KEY_T ;
+
+static PHASHGEN_KEY_T * _keys ;
+static uint32_t         _count ;
+
+static int
+phashgen_read (FILE * in, const char * name)
+{
+    static char line[PHASHGEN_LINE_MAX] ;
+    PHASHGEN_KEY_T * k ;
+    KVLINE_T kv ;
+    uint32_t lineno = 0 ;
+    uint32_t klen, vlen ;
+    int32_t res ;
+    char * key ;
+
+    while (fgets (line, sizeof(line), in)) {
+        lineno++ ;
+        if (kvline_check (line, sizeof(line)) != EOK) {
+            fprintf (stderr, "%s:%u: line too long\n", name, lineno) ;
+            return -1 ;
+        }
+        res = kvline_parse (line, &kv) ;
+        if (res == E_EMPTY) {
+            continue ;
+        }
+        if (res != EOK) {
+            fprintf (stderr, "%s:%u: invalid line\n", name, lineno) ;
+            return -1 ;
+        }
+        key = kv.key ;
+        klen = kv.key_length ;
+        vlen = kv.value_length ;
+        if ((klen > PHASH_KEY_LENGTH_MAX) || (vlen > PHASH_VALUE_LENGTH_MAX)) {
+            fprintf (stderr, "%s:%u: key or value too long\n", name, lineno) ;
+            return -1 ;
+        }
+
+        _keys = realloc (_keys, (_count + 1) * sizeof(PHASHGEN_KEY_T)) ;
+        if (!_keys) {
+            fprintf (stderr, "out of memory\n") ;
+            return -1 ;
+        }
+        k = &_keys[_count++] ;
+        memset (k, 0, sizeof(PHASHGEN_KEY_T)) ;
+        k->key = malloc (klen + 1) ;
+        if (k->key) memcpy (k->key, key, klen) ;
+        k->key_length = klen ;
+        k->value = malloc (vlen ? vlen : 1) ;
+        k->value_length = vlen ;
+        if (!k->key || !k->value) {
+            fprintf (stderr, "out of memory\n") ;
+            return -1 ;
+        }
+        memcpy (k->value, kv.value, vlen) ;
+    }
+
+    return 0 ;
+}
+
+/*
+ * Key order of phash_entry(), the same as strcmp() for string keys.
+ */
+static int
+phashgen_cmp (const void * a, const void * b)
+{
+    const PHASHGEN_KEY_T * ka = (const PHASHGEN_KEY_T *) a ;
+    const PHASHGEN_KEY_T * kb = (const PHASHGEN_KEY_T *) b ;
+    uint32_t len = ka->key_length < kb->key_length ?
+            ka->key_length : kb->key_length ;
+    int res = memcmp (ka->key, kb->key, len) ;
+
+    if (res) return res ;
+    return (int)ka->key_length - (int)kb->key_length ;
+}
+
+static uint32_t *   _bucket_size ;
+
+static int
+phashgen_bucket_cmp (const void * a, const void * b)
+{
+    uint32_t ba = _keys[*(const uint32_t *)a].h[0] ;
+    uint32_t bb = _keys[*(const uint32_t *)b].h[0] ;
+
+    if (_bucket_size[ba] != _bucket_size[bb]) {
+        return _bucket_size[ba] < _bucket_size[bb] ? 1 : -1 ;
+    }
+    return ba < bb ? -1 : ba > bb ? 1 : 0 ;
+}
+
+static inline uint32_t
+phashgen_slot (const PHASHGEN_KEY_T * k, uint32_t d0, uint32_t d1)
+{
+    return (k->h[1] + d0 * k->h[2] + d1) % _count ;
+}
+
+/*
+ * Try to place all buckets, largest first, with the given seed. The bucket
+ * index is kept in h[0] while placing.
+ */
+static bool
+phashgen_place (uint32_t seed, uint32_t buckets, uint32_t * disp,
+                uint32_t * slot)
+{
+    uint32_t * order = malloc (_count * sizeof(uint32_t)) ;
+    uint8_t * taken = calloc (_count, 1) ;
+    bool res = true ;
+    uint32_t i, j, first, n ;
+
+    _bucket_size = calloc (buckets, sizeof(uint32_t)) ;
+    if (!order || !taken || !_bucket_size) {
+        free (order) ; free (taken) ; free (_bucket_size) ;
+        return false ;
+    }
+
+    for (i = 0 ; i < _count ; i++) {
+        phash_hash (_keys[i].key, _keys[i].key_length, seed, _keys[i].h) ;
+        _keys[i].h[0] %= buckets ;
+        _bucket_size[_keys[i].h[0]]++ ;
+        order[i] = i ;
+    }
+    qsort (order, _count, sizeof(uint32_t), phashgen_bucket_cmp) ;
+
+    for (first = 0 ; res && (first < _count) ; first += n) {
+        uint32_t bucket = _keys[order[first]].h[0] ;
+        uint32_t tries = 0 ;
+        uint32_t d0 = 0, d1 = 0 ;
+        bool placed = false ;
+
+        n = _bucket_size[bucket] ;
+        for (d0 = 0 ; !placed && (d0 < _count) && (tries < PHASHGEN_TRIES) ; d0++) {
+            for (d1 = 0 ; (d1 < _count) && (tries < PHASHGEN_TRIES) ; d1++, tries++) {
+                for (i = 0 ; i < n ; i++) {
+                    uint32_t s = phashgen_slot (&_keys[order[first + i]], d0, d1) ;
+                    if (taken[s]) break ;
+                    for (j = 0 ; j < i ; j++) {
+                        if (phashgen_slot (&_keys[order[first + j]], d0, d1) == s) break ;
+                    }
+                    if (j < i) break ;
+                }
+                if (i == n) {
+                    placed = true ;
+                    break ;
+                }
+            }
+            if (placed) break ;
+        }
+
+        if (!placed) {
+            res = false ;
+            break ;
+        }
+        disp[bucket] = (d0 << 16) | d1 ;
+        for (i = 0 ; i < n ; i++) {
+            uint32_t k = order[first + i] ;
+            uint32_t s = phashgen_slot (&_keys[k], d0, d1) ;
+            taken[s] = 1 ;
+            slot[s] = _keys[k].offset ;
+        }
+    }
+
+    free (order) ;
+    free (taken) ;
+    free (_bucket_size) ;
+    return res ;
+}
+
+static PHASH_T *
+phashgen_build (void)
+{
+    uint32_t buckets = (_count + PHASHGEN_LAMBDA - 1) / PHASHGEN_LAMBDA ;
+    uint32_t size = PHASH_TABLE_SIZE(_count, buckets) ;
+    PHASH_T * table ;
+    uint8_t * entry ;
+    uint32_t i, seed ;
+
+    for (i = 0 ; i < _count ; i++) {
+        _keys[i].offset = size ;
+        size += PHASH_ENTRY_HEAD + _keys[i].key_length + 1 +
+                _keys[i].value_length ;
+    }
+    size = (size + 3) & ~3 ;
+
+    table = calloc (1, size) ;
+    if (!table) return 0 ;
+    table->magic = PHASH_MAGIC ;
+    table->version = PHASH_VERSION ;
+    table->count = _count ;
+    table->buckets = buckets ;
+    table->size = size ;
+
+    for (i = 0 ; i < _count ; i++) {
+        table->table[buckets + _count + i] = _keys[i].offset ;
+        entry = (uint8_t *) table + _keys[i].offset ;
+        entry[0] = _keys[i].key_length ;
+        entry[1] = _keys[i].value_length & 0xFF ;
+        entry[2] = _keys[i].value_length >> 8 ;
+        memcpy (entry + PHASH_ENTRY_HEAD, _keys[i].key, _keys[i].key_length) ;
+        memcpy (entry + PHASH_ENTRY_HEAD + _keys[i].key_length + 1,
+                _keys[i].value, _keys[i].value_length) ;
+    }
+
+    for (seed = 1 ; _count && (seed <= PHASHGEN_SEEDS) ; seed++) {
+        memset (table->table, 0, (buckets + _count) * sizeof(uint32_t)) ;
+        if (phashgen_place (seed, buckets, table->table,
+                &table->table[buckets])) {
+            table->seed = seed ;
+            break ;
+        }
+    }
+    if (_count && !table->seed) {
+        fprintf (stderr, "no perfect hash found\n") ;
+        free (table) ;
+        return 0 ;
+    }
+
+    return table ;
+}
+
+static int
+phashgen_verify (const PHASH_T * table)
+{
+    const char * value ;
+    uint32_t i ;
+
+    if (phash_check (table, table->size) != EOK) {
+        return -1 ;
+    }
+    for (i = 0 ; i < _count ; i++) {
+        if ((phash_lookup (table, _keys[i].key, _keys[i].key_length,
+                &value) != (int32_t)_keys[i].value_length) ||
+                memcmp (value, _keys[i].value, _keys[i].value_length)) {
+            return -1 ;
+        }
+    }
+
+    return 0 ;
+}
+
+static int
+phashgen_write (FILE * out, const PHASH_T * table, const char * name,
+                const char * input)
+{
+    const uint32_t * words = (const uint32_t *) table ;
+    uint32_t i ;
+
+    if (!name) {
+        return fwrite (table, table->size, 1, out) == 1 ? 0 : -1 ;
+    }
+
+    fprintf (out, "/* generated by phashgen from %s, %u keys */\n\n", input,
+            table->count) ;
+    fprintf (out, "#include <stdint.h>\n\n") ;
+    fprintf (out, "const uint32_t %s[%u] = {", name,
+            table->size / (uint32_t)sizeof(uint32_t)) ;
+    for (i = 0 ; i < table->size / sizeof(uint32_t) ; i++) {
+        fprintf (out, "%s0x%08x,", i % 6 ? " " : "\n    ", words[i]) ;
+    }
+    fprintf (out, "\n} ;\n") ;
+
+    return ferror (out) ? -1 : 0 ;
+}
+
+static void
+phashgen_usage (void)
+{
+    fprintf (stderr, "usage: phashgen [-n name] [-o output] input\n") ;
+}
+
+int
+main (int argc, char * argv[])
+{
+    const char * name = 0 ;
+    const char * output = 0 ;
+    PHASH_T * table ;
+    FILE * in ;
+    FILE * out = stdout ;
+    uint32_t i ;
+    int opt ;
+
+    while ((opt = getopt (argc, argv, "n:o:")) != -1) {
+        switch (opt) {
+        case 'n': name = optarg ; break ;
+        case 'o': output = optarg ; break ;
+        default: phashgen_usage () ; return 1 ;
+        }
+    }
+    if (optind != argc - 1) {
+        phashgen_usage () ;
+        return 1 ;
+    }
+
+    in = fopen (argv[optind], "r") ;
+    if (!in) {
+        perror (argv[optind]) ;
+        return 1 ;
+    }
+    if (phashgen_read (in, argv[optind]) < 0) {
+        return 1 ;
+    }
+    fclose (in) ;
+
+    if (_count > PHASH_COUNT_MAX) {
+        fprintf (stderr, "more than %u keys\n", PHASH_COUNT_MAX) ;
+        return 1 ;
+    }
+    qsort (_keys, _count, sizeof(PHASHGEN_KEY_T), phashgen_cmp) ;
+    for (i = 1 ; i < _count ; i++) {
+        if (!phashgen_cmp (&_keys[i-1], &_keys[i])) {
+            fprintf (stderr, "duplicate key '%.*s'\n",
+                    (int)_keys[i].key_length, _keys[i].key) ;
+            return 1 ;
+        }
+    }
+
+    table = phashgen_build () ;
+    if (!table || (phashgen_verify (table) < 0)) {
+        fprintf (stderr, "building the table failed\n") ;
+        return 1 ;
+    }
+
+    if (output) {
+        out = fopen (output, name ? "w" : "wb") ;
+        if (!out) {
+            perror (output) ;
+            return 1 ;
+        }
+    }
+    if (phashgen_write (out, table, name, argv[optind]) < 0) {
+        fprintf (stderr, "writing the table failed\n") ;
+        return 1 ;
+    }
+    if (output) fclose (out) ;
+
+    return 0 ;
+}